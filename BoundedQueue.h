@@ -0,0 +1,107 @@
+// BoundedQueue.h
+
+//  Implementation of a fixed capacity, thread-safe FIFO queue
+//  producers block while the queue is full, consumers block while it is empty
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+template<typename ItemType>
+class BoundedQueue
+{
+public:
+    BoundedQueue(int capacity);
+    ~BoundedQueue();
+
+    // blocks until there is room for the item, returns false if the queue was closed
+    bool push(const ItemType& item);
+
+    // blocks until an item is available, returns false once the queue is closed and drained
+    bool pop(ItemType& item);
+
+    // wakes up every waiting thread; no pushes are accepted afterwards, but queued items can still be popped
+    void close();
+
+    int size() const;
+
+    // C++11 syntax for preventing copying and assignment
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+private:
+    std::deque<ItemType> m_items;
+    unsigned int m_capacity;
+    bool m_closed;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+};
+
+
+template <typename ItemType>
+BoundedQueue<ItemType>::BoundedQueue(int capacity)
+        : m_capacity(capacity > 0 ? capacity : 1), m_closed(false)
+{
+}
+
+template <typename ItemType>
+BoundedQueue<ItemType>::~BoundedQueue()
+{
+    // nothing to deallocate, the deque cleans up after itself
+}
+
+template <typename ItemType>
+bool BoundedQueue<ItemType>::push(const ItemType& item)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // this is where the backpressure comes from: a producer waits here until a consumer makes room
+    m_notFull.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+    if (m_closed)
+        return false;
+
+    m_items.push_back(item);
+
+    // exactly one consumer can make use of the new item
+    m_notEmpty.notify_one();
+    return true;
+}
+
+template <typename ItemType>
+bool BoundedQueue<ItemType>::pop(ItemType& item)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+
+    // a closed queue still hands out whatever is left in it, so that shutting down never drops work
+    if (m_items.empty())
+        return false;
+
+    item = m_items.front();
+    m_items.pop_front();
+    m_notFull.notify_one();
+    return true;
+}
+
+template <typename ItemType>
+void BoundedQueue<ItemType>::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_notFull.notify_all();
+    m_notEmpty.notify_all();
+}
+
+template <typename ItemType>
+int BoundedQueue<ItemType>::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_items.size();
+}
+
+
+#endif // BOUNDEDQUEUE_H
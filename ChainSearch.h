@@ -0,0 +1,119 @@
+// ChainSearch.h
+
+//  Dijkstra's Algorithm over the graph of chains the router searches (see StreetMap.cpp)
+//  the router runs it until it settles its destination, and bounded searches until they run out of distance
+
+#ifndef CHAINSEARCH_H
+#define CHAINSEARCH_H
+
+#include "MapSnapshot.h"
+#include "SearchWorkspace.h"
+
+// every thread that searches gets a workspace, which it keeps for as long as it lives
+inline SearchWorkspace& threadSearchWorkspace()
+{
+    static thread_local SearchWorkspace workspace;
+    return workspace;
+}
+
+/*
+ The search follows whole chains of segments from one chain end to the next, so the nodes in the middle of
+ streets are never settled. Nodes are reached by the chain they were reached along, which is their parent
+ in the workspace; a source in the middle of a chain can only follow the rest of its two chains, which is
+ recorded as the chain number encoded as -2 - chain, and a target in the middle of a chain is reached part
+ way along one
+ */
+class ChainSearch
+{
+public:
+    ChainSearch(const MapSnapshot& snapshot, SearchWorkspace& ws)
+        : m_snapshot(snapshot), m_graph(snapshot.data()), m_ws(ws), m_target(-1)
+    {}
+
+    // starts a new search from source; a target of -1 means there is no particular destination
+    void start(int source, int target)
+    {
+        m_target = target;
+        m_ws.startSearch(m_graph.nodeCount());
+
+        // initially, only the source vertex is in the priority queue, and its distance is obviously zero
+        if (m_graph.isChainEnd(source))
+            m_ws.reach(source, 0, -1);
+        else {
+            for (int i = 2 * source; i < 2 * source + 2; i++)
+                followChain(m_graph.midChain[i], m_graph.midChainOffset[i], 0, -2 - m_graph.midChain[i]);
+        }
+    }
+
+    // settles and returns the closest node not settled yet, or -1 if there are none left to reach
+    int settleNext()
+    {
+        int node;
+        while ((node = m_ws.popClosest()) >= 0) {
+            /*
+             * if we have already processed a vertex, do not process it again
+             * Notice how there is a difference between visiting a vertex and processing it
+             * A vertex will be visited each time a neighbor of itself is processed
+             * Whereas it will itself be processed only once
+            */
+            if (m_ws.settled(node))
+                continue;
+            m_ws.settle(node);
+            m_graph.useNode(node);
+            return node;
+        }
+        return -1;
+    }
+
+    // update distances from source of the chain ends one chain away from a settled node, if required
+    void expand(int node)
+    {
+        double distance = m_ws.distance(node);
+        for (int c = m_graph.firstChain[node]; c < m_graph.firstChain[node + 1]; c++)
+            followChain(c, 0, distance, c);
+    }
+
+    const SearchWorkspace& workspace() const
+    {
+        return m_ws;
+    }
+
+private:
+    const MapSnapshot& m_snapshot;
+    const MapData& m_graph;
+    SearchWorkspace& m_ws;
+    int m_target;
+
+    void reachIfShorter(int node, double distance, int parent)
+    {
+        if (!m_ws.reached(node) || distance < m_ws.distance(node))
+            m_ws.reach(node, distance, parent);
+    }
+
+    // follows a chain from its edge number from, at the given distance from the source
+    void followChain(int chain, int from, double distance, int parent)
+    {
+        double weight;
+
+        // the destination may be part way along this chain
+        if (m_target >= 0 && !m_graph.isChainEnd(m_target)) {
+            for (int i = 2 * m_target; i < 2 * m_target + 2; i++)
+                if (m_graph.midChain[i] == chain && m_graph.midChainOffset[i] > from
+                    && m_snapshot.chainPartWeight(chain, from, m_graph.midChainOffset[i], weight))
+                    reachIfShorter(m_target, distance + weight, parent);
+        }
+
+        if (from == 0) {
+            // closed streets can't be travelled
+            if (!m_snapshot.chainOpen(chain))
+                return;
+            weight = m_snapshot.chainWeight(chain);
+        }
+        else if (!m_snapshot.chainPartWeight(chain, from, m_graph.chainEdgeCount(chain), weight))
+            return;
+        reachIfShorter(m_graph.chainTarget[chain], distance + weight, parent);
+    }
+};
+
+
+#endif // CHAINSEARCH_H
@@ -0,0 +1,341 @@
+// ConcurrentHashMap.h
+
+//  A hash map which any number of threads may read and insert into at once
+//  finds never lock or wait, inserts only ever retry a compare-and-swap, and the map
+//  grows a few buckets at a time, with every insert helping to move the old buckets over
+
+#ifndef CONCURRENTHASHMAP_H
+#define CONCURRENTHASHMAP_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ Every bucket is a singly linked list which only ever grows at its head, so a reader walking a list
+ never sees it change underneath it, and an insert is a single compare-and-swap of the head.
+ Associating a new value with a key that is already present puts a node for it in front of the old
+ one, so the old value is never modified while someone may be reading it.
+
+ When the map grows, a table with twice the buckets is made, and the buckets of the old table are
+ moved over in chunks by whichever threads insert next. A bucket is moved by building its two new
+ lists privately and then swapping the old head for a marker, which tells readers and writers to look
+ in the new table; if an insert got to the old head first, the move is simply tried again. The last
+ thread to finish a chunk makes the new table the current one.
+
+ Nothing is freed while the map is in use: nodes replaced by newer values and old tables are kept
+ until the map is reset or destroyed, since a reader could still be looking at them. Pointers
+ returned by find therefore stay valid until then. This suits maps which mostly gain new keys,
+ like coordinate interning, rather than ones whose values change often.
+
+ Like ExpandableHashMap, the key type needs a function unsigned int hasher(const KeyType&).
+ */
+
+template<typename KeyType, typename ValueType>
+class ConcurrentHashMap
+{
+public:
+    ConcurrentHashMap(double maximumLoadFactor = 0.5);
+    ~ConcurrentHashMap();
+
+    // empties the map; unlike everything else, this must not run while other threads use the map
+    void reset();
+
+    int size() const;
+    void associate(const KeyType& key, const ValueType& value);
+
+    // returns the value of key, associating value with it first if the key isn't in the map yet;
+    // when several threads race to add the same key, they all get the value of the one that won
+    const ValueType* findOrAssociate(const KeyType& key, const ValueType& value);
+
+    const ValueType* find(const KeyType& key) const;
+
+    // C++11 syntax for preventing copying and assignment
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+private:
+    struct Node
+    {
+        KeyType key;
+        ValueType value;
+        Node* next;
+    };
+
+    struct Table
+    {
+        Table(unsigned int n)
+            : buckets(n), heads(new std::atomic<Node*>[n]), movedLists(new Node*[n]), next(nullptr), claimed(0), moved(0)
+        {
+            for (unsigned int i = 0; i < n; i++) {
+                heads[i].store(nullptr, std::memory_order_relaxed);
+                movedLists[i] = nullptr;
+            }
+        }
+
+        unsigned int buckets;
+        std::unique_ptr<std::atomic<Node*>[]> heads;
+        std::unique_ptr<Node*[]> movedLists;    // what a bucket held before it was moved, so it can be freed
+        std::atomic<Table*> next;           // the table this one is being moved into, if it is growing
+        std::atomic<unsigned int> claimed;  // buckets handed out to be moved
+        std::atomic<unsigned int> moved;    // buckets finished moving
+    };
+
+    double m_loadFactor;
+    std::atomic<Table*> m_table;
+    std::atomic<unsigned int> m_size;
+
+    // every table ever made, so they can all be freed at the end (guarded by m_tablesMutex)
+    std::mutex m_tablesMutex;
+    std::vector<Table*> m_tables;
+
+    // buckets a thread moves at a time when it helps the map grow
+    static const unsigned int MOVE_CHUNK = 64;
+
+    // marks a bucket which has been moved to the next table; no real node lives at this address
+    static Node* movedMarker()
+    {
+        static char marker;
+        return reinterpret_cast<Node*>(&marker);
+    }
+
+    // adds a node for key, unless onlyIfAbsent and the key is already there; returns the key's node
+    Node* insert(const KeyType& key, const ValueType& value, bool onlyIfAbsent);
+
+    // the first node for key in a list, or nullptr
+    static Node* search(Node* head, const KeyType& key, Node* stopAt = nullptr);
+
+    void startGrowing(Table* t);
+    void helpGrow(Table* t);
+    void moveBucket(Table* from, Table* to, unsigned int i);
+    void freeAll();
+};
+
+
+template <typename KeyType, typename ValueType>
+ConcurrentHashMap<KeyType, ValueType>::ConcurrentHashMap(double maximumLoadFactor)
+        : m_loadFactor(maximumLoadFactor), m_size(0)
+{
+    Table* t = new Table(8); // initially 8 buckets
+    m_tables.push_back(t);
+    m_table.store(t);
+}
+
+template <typename KeyType, typename ValueType>
+ConcurrentHashMap<KeyType, ValueType>::~ConcurrentHashMap()
+{
+    freeAll();
+}
+
+template <typename KeyType, typename ValueType>
+void ConcurrentHashMap<KeyType, ValueType>::freeAll()
+{
+    // a node belongs to the table whose list it was created in; moving a bucket copies its nodes
+    for (Table* t : m_tables) {
+        for (unsigned int i = 0; i < t->buckets; i++) {
+            Node* n = t->heads[i].load(std::memory_order_relaxed);
+            if (n == movedMarker())
+                n = t->movedLists[i];
+            while (n != nullptr) {
+                Node* next = n->next;
+                delete n;
+                n = next;
+            }
+        }
+        delete t;
+    }
+    m_tables.clear();
+}
+
+template <typename KeyType, typename ValueType>
+void ConcurrentHashMap<KeyType, ValueType>::reset()
+{
+    freeAll();
+    Table* t = new Table(8);
+    m_tables.push_back(t);
+    m_table.store(t);
+    m_size = 0;
+}
+
+template <typename KeyType, typename ValueType>
+int ConcurrentHashMap<KeyType, ValueType>::size() const
+{
+    return m_size.load(std::memory_order_relaxed);
+}
+
+template <typename KeyType, typename ValueType>
+typename ConcurrentHashMap<KeyType, ValueType>::Node*
+ConcurrentHashMap<KeyType, ValueType>::search(Node* head, const KeyType& key, Node* stopAt)
+{
+    for (Node* n = head; n != stopAt && n != nullptr; n = n->next) {
+        if (n->key == key)
+            return n;
+    }
+    return nullptr;
+}
+
+template <typename KeyType, typename ValueType>
+const ValueType* ConcurrentHashMap<KeyType, ValueType>::find(const KeyType& key) const
+{
+    unsigned int hasher(const KeyType& k);
+    unsigned int h = hasher(key);
+
+    // a moved bucket sends us on to the next table, which has the bucket's nodes and everything added since
+    Table* t = m_table.load(std::memory_order_acquire);
+    for (;;) {
+        Node* head = t->heads[h % t->buckets].load(std::memory_order_acquire);
+        if (head != movedMarker()) {
+            Node* n = search(head, key);
+            return n == nullptr ? nullptr : &n->value;
+        }
+        t = t->next.load(std::memory_order_acquire);
+    }
+}
+
+template <typename KeyType, typename ValueType>
+void ConcurrentHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
+{
+    insert(key, value, false);
+}
+
+template <typename KeyType, typename ValueType>
+const ValueType* ConcurrentHashMap<KeyType, ValueType>::findOrAssociate(const KeyType& key, const ValueType& value)
+{
+    return &insert(key, value, true)->value;
+}
+
+template <typename KeyType, typename ValueType>
+typename ConcurrentHashMap<KeyType, ValueType>::Node*
+ConcurrentHashMap<KeyType, ValueType>::insert(const KeyType& key, const ValueType& value, bool onlyIfAbsent)
+{
+    unsigned int hasher(const KeyType& k);
+    unsigned int h = hasher(key);
+    Node* node = nullptr;   // made once, and reused if the compare-and-swap has to be retried
+    Node* checkedUpTo = nullptr;
+    Node* found = nullptr;
+
+    for (;;) {
+        // a map which is growing gets a little help from every insert
+        Table* t = m_table.load(std::memory_order_acquire);
+        if (t->next.load(std::memory_order_acquire) != nullptr)
+            helpGrow(t);
+
+        // find the table which currently holds the key's bucket
+        std::atomic<Node*>* bucket;
+        Node* head;
+        for (;;) {
+            bucket = &t->heads[h % t->buckets];
+            head = bucket->load(std::memory_order_acquire);
+            if (head != movedMarker())
+                break;
+            t = t->next.load(std::memory_order_acquire);
+            checkedUpTo = nullptr;
+        }
+
+        // only the nodes added since we last looked at this list need checking again
+        Node* existing = search(head, key, checkedUpTo);
+        if (existing != nullptr)
+            found = existing;
+        checkedUpTo = head;
+        if (found != nullptr && onlyIfAbsent) {
+            delete node;
+            return found;
+        }
+
+        if (node == nullptr)
+            node = new Node{key, value, nullptr};
+        node->next = head;
+        if (bucket->compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed)) {
+            if (found != nullptr)
+                return node;
+
+            // a new key might push the table over its load factor
+            unsigned int size = m_size.fetch_add(1, std::memory_order_relaxed) + 1;
+            if (size > m_loadFactor * t->buckets)
+                startGrowing(t);
+            return node;
+        }
+    }
+}
+
+template <typename KeyType, typename ValueType>
+void ConcurrentHashMap<KeyType, ValueType>::startGrowing(Table* t)
+{
+    // only the current table grows, and only once; a map which is still growing finishes that first
+    if (t != m_table.load(std::memory_order_acquire) || t->next.load(std::memory_order_acquire) != nullptr)
+        return;
+
+    Table* bigger = new Table(t->buckets * 2);
+    Table* expected = nullptr;
+    if (!t->next.compare_exchange_strong(expected, bigger, std::memory_order_acq_rel)) {
+        delete bigger;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_tablesMutex);
+        m_tables.push_back(bigger);
+    }
+    helpGrow(t);
+}
+
+template <typename KeyType, typename ValueType>
+void ConcurrentHashMap<KeyType, ValueType>::helpGrow(Table* t)
+{
+    // once every bucket has been handed out, there is nothing left to help with
+    if (t->claimed.load(std::memory_order_relaxed) >= t->buckets)
+        return;
+    Table* next = t->next.load(std::memory_order_acquire);
+    unsigned int first = t->claimed.fetch_add(MOVE_CHUNK, std::memory_order_relaxed);
+    if (first >= t->buckets)
+        return;
+    unsigned int last = std::min(first + MOVE_CHUNK, t->buckets);
+    for (unsigned int i = first; i < last; i++)
+        moveBucket(t, next, i);
+
+    // whoever moves the last bucket makes the new table the current one
+    if (t->moved.fetch_add(last - first, std::memory_order_acq_rel) + (last - first) == t->buckets)
+        m_table.store(next, std::memory_order_release);
+}
+
+template <typename KeyType, typename ValueType>
+void ConcurrentHashMap<KeyType, ValueType>::moveBucket(Table* from, Table* to, unsigned int i)
+{
+    unsigned int hasher(const KeyType& k);
+
+    // the keys of bucket i all land in bucket i or i + from->buckets of the doubled table, and nobody
+    // else writes to those until bucket i is marked as moved, so we can build their lists in peace
+    for (;;) {
+        Node* head = from->heads[i].load(std::memory_order_acquire);
+        std::vector<Node*> copies;
+        Node* lists[2] = { nullptr, nullptr };
+        Node* tails[2] = { nullptr, nullptr };
+        for (Node* n = head; n != nullptr; n = n->next) {
+            // the first node of a key is its newest value; older ones are left behind
+            unsigned int j = hasher(n->key) % to->buckets;
+            int half = j == i ? 0 : 1;
+            if (search(lists[half], n->key) != nullptr)
+                continue;
+            Node* copy = new Node{n->key, n->value, nullptr};
+            copies.push_back(copy);
+            if (tails[half] == nullptr)
+                lists[half] = copy;
+            else
+                tails[half]->next = copy;
+            tails[half] = copy;
+        }
+        to->heads[i].store(lists[0], std::memory_order_relaxed);
+        to->heads[i + from->buckets].store(lists[1], std::memory_order_relaxed);
+
+        // publishes the new lists along with the marker; if a node was added meanwhile, start over
+        if (from->heads[i].compare_exchange_strong(head, movedMarker(), std::memory_order_acq_rel)) {
+            from->movedLists[i] = head;
+            return;
+        }
+        for (Node* copy : copies)
+            delete copy;
+    }
+}
+
+
+#endif // CONCURRENTHASHMAP_H
@@ -1,7 +1,723 @@
 #include "provided.h"
+#include "HilbertCurve.h"
+#include "Trace.h"
 #include <vector>
+#include <deque>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <unordered_map>
 using namespace std;
 
+// with fewer deliveries than this the order is left as it was given
+const size_t LARGE_INSTANCE_STOPS = 1000;
+
+// how many of its nearest stops each stop considers linking to
+const int NEIGHBOR_LIST_SIZE = 8;
+
+// improvements smaller than this are rounding error, and chasing them could loop forever
+const double MIN_GAIN = 1e-10;
+
+// the most moves the local search after adding or cancelling one delivery makes, which keeps it short
+// even if the change sets off a long run of small improvements
+const size_t REPAIR_MOVES = 100;
+
+// the moves need a few stops to work with; smaller tours are left alone
+const size_t MIN_IMPROVABLE_STOPS = 5;
+
+// the nearest few stops to every stop, found with a grid laid over the stops rather than by
+// comparing every pair, so both the time and the memory needed grow about linearly with the stops;
+// stops can then be added and removed one at a time, which only changes the lists near them
+class NeighborLists
+{
+public:
+    NeighborLists(const vector<GeoCoord>& stops, int k);
+
+    // the neighbors of stop s, nearest first
+    const int* begin(int s) const
+    {
+        return m_neighbors.data() + (size_t) s * m_k;
+    }
+    const int* end(int s) const
+    {
+        return begin(s) + m_count[s];
+    }
+
+    // the last of the stops has just been added; it gets neighbors of its own, and becomes a neighbor
+    // of every stop it is nearer to than one of theirs
+    void addStop(const vector<GeoCoord>& stops);
+
+    // stop s is about to be taken out of the stops, with the last stop taking its number; the stops
+    // which had s as a neighbor find another
+    void removeStop(const vector<GeoCoord>& stops, int s);
+
+private:
+    int m_k;
+    vector<int> m_neighbors;    // stop s has the m_count[s] neighbors from m_neighbors[s * m_k] on
+    vector<int> m_count;
+
+    // the stops projected onto a flat plane; over the area one depot serves this barely distorts
+    // distances, and it is only used to find candidates, which are then ordered by true distance
+    double m_lonScale;
+    vector<double> m_x, m_y;
+
+    // the grid used to add and remove stops, made the first time one is, and again whenever the number
+    // of stops has doubled or halved since, so its cells keep holding about two stops each
+    size_t m_gridStops;         // how many stops there were when it was made; 0 until then
+    double m_cellSize;
+    double m_minX, m_minY;
+    unordered_map<uint64_t, vector<int> > m_cells;
+    int m_minCol, m_maxCol, m_minRow, m_maxRow;     // every stop is in a cell within these
+    double m_reach;             // no stop's furthest neighbor is further than this on the plane
+
+    double planeDistance2(int s, int t) const
+    {
+        return (m_x[t] - m_x[s]) * (m_x[t] - m_x[s]) + (m_y[t] - m_y[s]) * (m_y[t] - m_y[s]);
+    }
+    int colOf(int s) const
+    {
+        return (int) floor((m_x[s] - m_minX) / m_cellSize);
+    }
+    int rowOf(int s) const
+    {
+        return (int) floor((m_y[s] - m_minY) / m_cellSize);
+    }
+    static uint64_t cellKey(int col, int row)
+    {
+        return (uint64_t) (uint32_t) col << 32 | (uint32_t) row;
+    }
+
+    // the distance on the plane to the furthest neighbor of s, or infinity if it has fewer than k
+    double radius(int s) const;
+
+    // keeps the nearest of the candidates (nearest on the plane) as the neighbors of s, nearest first
+    void setNeighbors(const vector<GeoCoord>& stops, int s, vector<pair<double, int> >& candidates);
+
+    void makeGrid();
+    void addToGrid(int s);
+    void removeFromGrid(int s);
+
+    // the stops in the cells r cells away from the cell of s, in one direction or the other
+    void stopsInRing(int s, int r, vector<int>& found) const;
+
+    // the stops on the grid which may be within distance of s on the plane (and maybe some beyond)
+    void stopsNear(int s, double distance, vector<int>& found) const;
+
+    // finds the neighbors of s among the stops on the grid
+    void findNeighbors(const vector<GeoCoord>& stops, int s);
+};
+
+NeighborLists::NeighborLists(const vector<GeoCoord>& stops, int k)
+    : m_k(k), m_lonScale(1), m_gridStops(0), m_cellSize(1), m_minX(0), m_minY(0), m_minCol(0), m_maxCol(0),
+      m_minRow(0), m_maxRow(0), m_reach(0)
+{
+    TraceSpan span("optimize", "neighbor lists");
+    int n = stops.size();
+    k = min(k, n - 1);
+    if (n == 0)
+        return;
+
+    double meanLat = 0;
+    for (const auto& gc : stops)
+        meanLat += gc.latitude;
+    m_lonScale = cos(meanLat / n * M_PI / 180);
+    m_x.resize(n);
+    m_y.resize(n);
+    for (int s = 0; s < n; s++) {
+        m_x[s] = stops[s].longitude * m_lonScale;
+        m_y[s] = stops[s].latitude;
+    }
+    double minX = *min_element(m_x.begin(), m_x.end()), maxX = *max_element(m_x.begin(), m_x.end());
+    double minY = *min_element(m_y.begin(), m_y.end()), maxY = *max_element(m_y.begin(), m_y.end());
+
+    // square cells holding about two stops each
+    int side = max(1, (int) sqrt(n / 2.0));
+    double cellSize = max(maxX - minX, maxY - minY) / side;
+    if (cellSize <= 0)
+        cellSize = 1;
+    int cols = (int) ((maxX - minX) / cellSize) + 1;
+    int rows = (int) ((maxY - minY) / cellSize) + 1;
+    auto colOf = [&](int s) { return min(cols - 1, (int) ((m_x[s] - minX) / cellSize)); };
+    auto rowOf = [&](int s) { return min(rows - 1, (int) ((m_y[s] - minY) / cellSize)); };
+
+    // the stops grouped by cell, laid out the same way as the edges of the street graph
+    vector<int> cellFirst(cols * rows + 1, 0);
+    vector<int> cellStops(n);
+    for (int s = 0; s < n; s++)
+        cellFirst[rowOf(s) * cols + colOf(s) + 1]++;
+    for (int c = 0; c < cols * rows; c++)
+        cellFirst[c + 1] += cellFirst[c];
+    vector<int> fill(cellFirst.begin(), cellFirst.end() - 1);
+    for (int s = 0; s < n; s++)
+        cellStops[fill[rowOf(s) * cols + colOf(s)]++] = s;
+
+    vector<pair<double, int> > candidates;
+    m_neighbors.resize((size_t) n * m_k);
+    m_count.assign(n, 0);
+    for (int s = 0; s < n; s++) {
+        int col = colOf(s), row = rowOf(s);
+        candidates.clear();
+
+        // search rings of cells further and further out; a stop beyond ring r is at least
+        // r cells away, so once k candidates are closer than that, the search is over
+        for (int r = 0; k > 0; r++) {
+            for (int j = row - r; j <= row + r; j++) {
+                if (j < 0 || j >= rows)
+                    continue;
+                bool edgeRow = (j == row - r || j == row + r);
+                for (int i = col - r; i <= col + r; i += (edgeRow || r == 0) ? 1 : 2 * r) {
+                    if (i < 0 || i >= cols)
+                        continue;
+                    for (int c = cellFirst[j * cols + i]; c < cellFirst[j * cols + i + 1]; c++) {
+                        int t = cellStops[c];
+                        if (t != s)
+                            candidates.push_back(make_pair(planeDistance2(s, t), t));
+                    }
+                }
+            }
+            if ((int) candidates.size() >= k) {
+                nth_element(candidates.begin(), candidates.begin() + k - 1, candidates.end());
+                double reach = r * cellSize;
+                if (candidates[k - 1].first <= reach * reach)
+                    break;
+            }
+            if (r > cols && r > rows)
+                break;
+        }
+        setNeighbors(stops, s, candidates);
+    }
+}
+
+double NeighborLists::radius(int s) const
+{
+    // with fewer, every other stop is a neighbor, and so would be any new one
+    if (m_count[s] < m_k)
+        return numeric_limits<double>::infinity();
+    double furthest = 0;
+    for (const int* n = begin(s); n != end(s); n++)
+        furthest = max(furthest, planeDistance2(s, *n));
+    return sqrt(furthest);
+}
+
+void NeighborLists::setNeighbors(const vector<GeoCoord>& stops, int s, vector<pair<double, int> >& candidates)
+{
+    if ((int) candidates.size() > m_k) {
+        nth_element(candidates.begin(), candidates.begin() + m_k - 1, candidates.end());
+        candidates.resize(m_k);
+    }
+    for (auto& c : candidates)
+        c.first = distanceEarthMiles(stops[s], stops[c.second]);
+    sort(candidates.begin(), candidates.end());
+    m_count[s] = candidates.size();
+    int* neighbors = m_neighbors.data() + (size_t) s * m_k;
+    for (size_t i = 0; i < candidates.size(); i++)
+        neighbors[i] = candidates[i].second;
+}
+
+void NeighborLists::makeGrid()
+{
+    int n = m_x.size();
+    m_gridStops = n;
+    double minX = *min_element(m_x.begin(), m_x.end()), maxX = *max_element(m_x.begin(), m_x.end());
+    double minY = *min_element(m_y.begin(), m_y.end()), maxY = *max_element(m_y.begin(), m_y.end());
+    int side = max(1, (int) sqrt(n / 2.0));
+    m_cellSize = max(maxX - minX, maxY - minY) / side;
+    if (m_cellSize <= 0)
+        m_cellSize = 1;
+    m_minX = minX;
+    m_minY = minY;
+    m_minCol = m_minRow = 0;
+    m_maxCol = m_maxRow = 0;
+    m_cells.clear();
+    m_reach = 0;
+    for (int s = 0; s < n; s++) {
+        addToGrid(s);
+        m_reach = max(m_reach, radius(s));
+    }
+}
+
+void NeighborLists::addToGrid(int s)
+{
+    int col = colOf(s), row = rowOf(s);
+    m_cells[cellKey(col, row)].push_back(s);
+    m_minCol = min(m_minCol, col);
+    m_maxCol = max(m_maxCol, col);
+    m_minRow = min(m_minRow, row);
+    m_maxRow = max(m_maxRow, row);
+}
+
+void NeighborLists::removeFromGrid(int s)
+{
+    vector<int>& cell = m_cells[cellKey(colOf(s), rowOf(s))];
+    cell.erase(find(cell.begin(), cell.end(), s));
+}
+
+void NeighborLists::stopsInRing(int s, int r, vector<int>& found) const
+{
+    int col = colOf(s), row = rowOf(s);
+    for (int j = max(row - r, m_minRow); j <= min(row + r, m_maxRow); j++) {
+        bool edgeRow = (j == row - r || j == row + r);
+        for (int i = col - r; i <= col + r; i += (edgeRow || r == 0) ? 1 : 2 * r) {
+            if (i < m_minCol || i > m_maxCol)
+                continue;
+            auto cell = m_cells.find(cellKey(i, j));
+            if (cell != m_cells.end())
+                found.insert(found.end(), cell->second.begin(), cell->second.end());
+        }
+    }
+}
+
+void NeighborLists::stopsNear(int s, double distance, vector<int>& found) const
+{
+    // a stop within distance is in a cell at most this many cells away, and none are beyond the last ring
+    int col = colOf(s), row = rowOf(s);
+    int lastRing = max(max(col - m_minCol, m_maxCol - col), max(row - m_minRow, m_maxRow - row));
+    if (distance / m_cellSize < lastRing)
+        lastRing = (int) (distance / m_cellSize) + 1;
+    found.clear();
+    for (int r = 0; r <= lastRing; r++)
+        stopsInRing(s, r, found);
+}
+
+void NeighborLists::findNeighbors(const vector<GeoCoord>& stops, int s)
+{
+    int col = colOf(s), row = rowOf(s);
+    int lastRing = max(max(col - m_minCol, m_maxCol - col), max(row - m_minRow, m_maxRow - row));
+    vector<int> found;
+    vector<pair<double, int> > candidates;
+
+    // the same search of rings of cells as in making the lists
+    for (int r = 0; r <= lastRing; r++) {
+        found.clear();
+        stopsInRing(s, r, found);
+        for (int t : found)
+            if (t != s)
+                candidates.push_back(make_pair(planeDistance2(s, t), t));
+        if ((int) candidates.size() >= m_k) {
+            nth_element(candidates.begin(), candidates.begin() + m_k - 1, candidates.end());
+            double reach = r * m_cellSize;
+            if (candidates[m_k - 1].first <= reach * reach)
+                break;
+        }
+    }
+    setNeighbors(stops, s, candidates);
+}
+
+void NeighborLists::addStop(const vector<GeoCoord>& stops)
+{
+    if (m_gridStops == 0 || m_x.size() >= 2 * m_gridStops)
+        makeGrid();
+    int t = stops.size() - 1;
+    m_x.push_back(stops[t].longitude * m_lonScale);
+    m_y.push_back(stops[t].latitude);
+    m_count.push_back(0);
+    m_neighbors.resize(m_neighbors.size() + m_k);
+
+    findNeighbors(stops, t);
+    m_reach = max(m_reach, radius(t));
+
+    // t can only be nearer to a stop than its furthest neighbor if that stop is within reach of it
+    vector<int> near;
+    stopsNear(t, m_reach, near);
+    vector<pair<double, int> > candidates;
+    for (int s : near) {
+        double d2 = planeDistance2(s, t);
+        double r = radius(s);
+        if (d2 >= r * r)
+            continue;
+        candidates.assign(1, make_pair(d2, t));
+        for (const int* n = begin(s); n != end(s); n++)
+            candidates.push_back(make_pair(planeDistance2(s, *n), *n));
+        setNeighbors(stops, s, candidates);
+    }
+    addToGrid(t);
+}
+
+void NeighborLists::removeStop(const vector<GeoCoord>& stops, int s)
+{
+    if (m_gridStops == 0 || 2 * m_x.size() <= m_gridStops)
+        makeGrid();
+    removeFromGrid(s);
+
+    // every stop with s as a neighbor is within reach of it
+    vector<int> near;
+    stopsNear(s, m_reach, near);
+    for (int t : near) {
+        if (find(begin(t), end(t), s) == end(t))
+            continue;
+        findNeighbors(stops, t);
+        m_reach = max(m_reach, radius(t));
+    }
+
+    // the last stop takes the number of s, in the lists of the stops within reach of it too
+    int last = m_x.size() - 1;
+    if (s != last) {
+        stopsNear(last, m_reach, near);
+        for (int t : near)
+            replace(m_neighbors.begin() + (size_t) t * m_k, m_neighbors.begin() + (size_t) t * m_k + m_count[t], last, s);
+        removeFromGrid(last);
+        m_x[s] = m_x[last];
+        m_y[s] = m_y[last];
+        m_count[s] = m_count[last];
+        copy(begin(last), end(last), m_neighbors.begin() + (size_t) s * m_k);
+        addToGrid(s);
+    }
+    m_x.pop_back();
+    m_y.pop_back();
+    m_count.pop_back();
+    m_neighbors.resize(m_neighbors.size() - m_k);
+}
+
+/*
+ A round trip through every stop, improved by 2-opt and Or-opt moves.
+
+ A 2-opt move removes two links of the tour and reconnects it the other way, which reverses the path
+ between them. An Or-opt move takes out a run of one to three stops and puts it back, either way
+ round, between two other neighboring stops; it is carried out as two or three 2-opt moves.
+ Only links to a stop's nearest neighbors are tried, since a good tour almost never links stops which
+ are far apart. Every stop has a "don't look" bit, here being out of the queue: a stop is only looked
+ at again once one of the links next to it has changed.
+ */
+class TourImprover
+{
+public:
+    // every stop is looked at to begin with, or, given changed, only those stops
+    TourImprover(const vector<GeoCoord>& stops, const vector<int>& order, const vector<int>* changed = nullptr);
+
+    // makes moves until none of the stops looked at can improve the tour, or maxMoves have been made,
+    // and gives how much shorter they made it; stops still waiting to be looked at then no longer are
+    double improve(size_t maxMoves = SIZE_MAX);
+
+    // stop s will be looked at by the next improve
+    void enqueue(int s);
+
+    // the stops in tour order, starting with stop 0
+    void getOrder(vector<int>& order) const;
+
+    // starts again from another tour of the same stops
+    void setOrder(const vector<int>& order);
+
+    // the last of the stops has just been added; it goes in beside whichever of its neighbors it lengthens
+    // the tour least next to, between before and after, and this gives how much longer the tour gets
+    double addStop(int& before, int& after);
+
+    // takes stop s out of the tour, linking the stops before and after it, and gives how much shorter the
+    // tour gets; the last stop takes the number of s, which the caller must then do to the stops too
+    double removeStop(int s, int& before, int& after);
+
+private:
+    const vector<GeoCoord>& m_stops;
+    NeighborLists m_neighbors;
+    vector<int> m_order;        // the tour, as a cycle
+    vector<int> m_position;     // where each stop is in m_order
+    deque<int> m_queue;
+    vector<bool> m_queued;
+
+    int size() const
+    {
+        return m_order.size();
+    }
+    int next(int s) const
+    {
+        int p = m_position[s] + 1;
+        return m_order[p == size() ? 0 : p];
+    }
+    int prev(int s) const
+    {
+        int p = m_position[s];
+        return m_order[p == 0 ? size() - 1 : p - 1];
+    }
+    double dist(int s, int t) const
+    {
+        return distanceEarthMiles(m_stops[s], m_stops[t]);
+    }
+
+    // reverses the path from one stop forward to another
+    void reversePath(int from, int to);
+
+    // replaces the links a-b and c-d with a-c and b-d; b and d must follow a and c in the same direction
+    void move2opt(int a, int b, int c, int d);
+
+    // each makes a move from a if it can, and gives how much shorter it made the tour, or 0 if it made none
+    double try2opt(int a);
+    double tryOrOpt(int a);
+};
+
+TourImprover::TourImprover(const vector<GeoCoord>& stops, const vector<int>& order, const vector<int>* changed)
+    : m_stops(stops), m_neighbors(stops, NEIGHBOR_LIST_SIZE), m_order(order), m_position(stops.size()),
+      m_queued(stops.size(), false)
+{
+    for (int p = 0; p < size(); p++) {
+        m_position[m_order[p]] = p;
+        if (changed == nullptr)
+            enqueue(m_order[p]);
+    }
+    if (changed != nullptr)
+        for (int s : *changed)
+            enqueue(s);
+}
+
+void TourImprover::enqueue(int s)
+{
+    if (!m_queued[s]) {
+        m_queued[s] = true;
+        m_queue.push_back(s);
+    }
+}
+
+double TourImprover::improve(size_t maxMoves)
+{
+    TraceSpan span("optimize", "2-opt and Or-opt");
+    span.arg("stops", m_queue.size());
+    size_t moves = 0;
+    double gain = 0;
+    while (!m_queue.empty() && moves < maxMoves) {
+        int a = m_queue.front();
+        m_queue.pop_front();
+        m_queued[a] = false;
+
+        // the moves queue every stop whose links they change, a included
+        double g = try2opt(a);
+        if (g == 0)
+            g = tryOrOpt(a);
+        if (g > 0) {
+            moves++;
+            gain += g;
+        }
+    }
+    while (!m_queue.empty()) {
+        m_queued[m_queue.front()] = false;
+        m_queue.pop_front();
+    }
+    span.arg("moves", moves);
+    return gain;
+}
+
+void TourImprover::getOrder(vector<int>& order) const
+{
+    order.clear();
+    int s = 0;
+    do {
+        order.push_back(s);
+        s = next(s);
+    } while (s != 0);
+}
+
+void TourImprover::setOrder(const vector<int>& order)
+{
+    m_order = order;
+    for (int p = 0; p < size(); p++)
+        m_position[m_order[p]] = p;
+}
+
+double TourImprover::addStop(int& before, int& after)
+{
+    int t = m_stops.size() - 1;
+    m_neighbors.addStop(m_stops);
+
+    // the links either side of each neighbor; a stop is rarely worth putting between two far from it
+    double bestCost = numeric_limits<double>::infinity();
+    for (const int* n = m_neighbors.begin(t); n != m_neighbors.end(t); n++) {
+        int links[2][2] = { { prev(*n), *n }, { *n, next(*n) } };
+        for (const auto& link : links) {
+            double cost = dist(link[0], t) + dist(t, link[1]) - dist(link[0], link[1]);
+            if (cost < bestCost) {
+                before = link[0];
+                after = link[1];
+                bestCost = cost;
+            }
+        }
+    }
+
+    // every stop after the new one moves along, though that is only copying numbers
+    int p = m_position[before] + 1;
+    m_order.insert(m_order.begin() + p, t);
+    m_position.push_back(p);
+    m_queued.push_back(false);
+    for (int i = p + 1; i < size(); i++)
+        m_position[m_order[i]] = i;
+    return bestCost;
+}
+
+double TourImprover::removeStop(int s, int& before, int& after)
+{
+    before = prev(s);
+    after = next(s);
+    double saving = dist(before, s) + dist(s, after) - dist(before, after);
+    m_neighbors.removeStop(m_stops, s);
+
+    int p = m_position[s];
+    m_order.erase(m_order.begin() + p);
+    for (int i = p; i < size(); i++)
+        m_position[m_order[i]] = i;
+    int last = m_position.size() - 1;
+    if (s != last) {
+        m_position[s] = m_position[last];
+        m_order[m_position[s]] = s;
+        before = (before == last) ? s : before;
+        after = (after == last) ? s : after;
+    }
+    m_position.pop_back();
+    m_queued.pop_back();
+    return saving;
+}
+
+void TourImprover::reversePath(int from, int to)
+{
+    int n = size();
+    int i = m_position[from];
+    int j = m_position[to];
+    int length = (j - i + n) % n + 1;
+
+    // reversing the rest of the tour instead gives the same cycle, so reverse whichever is shorter
+    if (2 * length > n) {
+        i = m_position[next(to)];
+        j = m_position[prev(from)];
+        length = n - length;
+    }
+
+    for (int k = 0; k < length / 2; k++) {
+        swap(m_order[i], m_order[j]);
+        m_position[m_order[i]] = i;
+        m_position[m_order[j]] = j;
+        i = (i + 1 == n) ? 0 : i + 1;
+        j = (j == 0) ? n - 1 : j - 1;
+    }
+}
+
+void TourImprover::move2opt(int a, int b, int c, int d)
+{
+    if (next(a) == b)
+        reversePath(b, c);
+    else
+        reversePath(a, d);
+}
+
+double TourImprover::try2opt(int a)
+{
+    for (int forward = 1; forward >= 0; forward--) {
+        int b = forward ? next(a) : prev(a);
+        double ab = dist(a, b);
+
+        for (const int* n = m_neighbors.begin(a); n != m_neighbors.end(a); n++) {
+            int c = *n;
+            // the new link a-c has to be shorter than a-b for the move to have any chance,
+            // and the neighbors only get further away
+            double g1 = ab - dist(a, c);
+            if (g1 <= MIN_GAIN)
+                break;
+            int d = forward ? next(c) : prev(c);
+            if (c == b || d == a)
+                continue;
+
+            double gain = g1 + dist(c, d) - dist(b, d);
+            if (gain > MIN_GAIN) {
+                move2opt(a, b, c, d);
+                enqueue(a);
+                enqueue(b);
+                enqueue(c);
+                enqueue(d);
+                return gain;
+            }
+        }
+    }
+    return 0;
+}
+
+double TourImprover::tryOrOpt(int a)
+{
+    for (int length = 1; length <= 3 && length + 3 <= size(); length++) {
+        for (int forward = 1; forward >= 0; forward--) {
+            // the run s1 ... s2, in tour order, with a at one end of it
+            int run[3];
+            run[0] = a;
+            for (int k = 1; k < length; k++)
+                run[k] = forward ? next(run[k - 1]) : prev(run[k - 1]);
+            int s1 = forward ? run[0] : run[length - 1];
+            int s2 = forward ? run[length - 1] : run[0];
+            int p = prev(s1);
+            int nx = next(s2);
+            auto inRun = [&](int s) { return find(run, run + length, s) != run + length; };
+
+            double removeGain = dist(p, s1) + dist(s2, nx) - dist(p, nx);
+            if (removeGain <= MIN_GAIN)
+                continue;
+
+            for (int end = 0; end < 2; end++) {
+                int e = end == 0 ? s1 : s2;
+                for (const int* n = m_neighbors.begin(e); n != m_neighbors.end(e); n++) {
+                    int c = *n;
+                    if (removeGain - dist(e, c) <= MIN_GAIN)
+                        break;
+                    if (inRun(c))
+                        continue;
+
+                    // try putting the run either side of c, either way round
+                    for (int side = 0; side < 2; side++) {
+                        int x = side == 0 ? c : prev(c);
+                        int y = next(x);
+                        if (inRun(x) || inRun(y))
+                            continue;
+                        double xy = dist(x, y);
+                        double sameWay = dist(x, s1) + dist(s2, y) - xy;
+                        double reversed = dist(x, s2) + dist(s1, y) - xy;
+                        if (removeGain - min(sameWay, reversed) <= MIN_GAIN)
+                            continue;
+
+                        // take the run out and put it back reversed between x and y ...
+                        move2opt(p, s1, x, y);
+                        if (x != nx)
+                            move2opt(p, x, nx, s2);
+                        // ... then turn it round if it's better the way it was
+                        if (sameWay < reversed && length > 1)
+                            move2opt(x, s2, s1, y);
+
+                        enqueue(p);
+                        enqueue(nx);
+                        enqueue(s1);
+                        enqueue(s2);
+                        enqueue(x);
+                        enqueue(y);
+                        return removeGain - min(sameWay, reversed);
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// a good round trip through all of the stops, starting with stop 0
+static void optimizeTour(const vector<GeoCoord>& stops, vector<int>& order)
+{
+    // start from the order in which a Hilbert curve visits the stops, which is already a
+    // reasonable tour, since the curve visits nearby stops one after another
+    double minLat = stops[0].latitude, maxLat = stops[0].latitude;
+    double minLon = stops[0].longitude, maxLon = stops[0].longitude;
+    for (const auto &gc : stops) {
+        minLat = min(minLat, gc.latitude);
+        maxLat = max(maxLat, gc.latitude);
+        minLon = min(minLon, gc.longitude);
+        maxLon = max(maxLon, gc.longitude);
+    }
+    TraceSpan curveSpan("optimize", "Hilbert curve tour");
+    HilbertGrid grid(minLat, minLon, maxLat, maxLon);
+    vector<pair<unsigned long long, int> > curve;
+    for (int s = 0; s < (int) stops.size(); s++)
+        curve.push_back(make_pair(grid.index(stops[s]), s));
+    sort(curve.begin(), curve.end());
+    order.clear();
+    for (const auto &c : curve)
+        order.push_back(c.second);
+    curveSpan.end();
+    
+    TourImprover improver(stops, order);
+    improver.improve();
+    improver.getOrder(order);
+}
+
 class DeliveryOptimizerImpl
 {
 public:
@@ -46,6 +762,186 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
     
     // set newCrowDistance equal to the old one
     newCrowDistance = oldCrowDistance;
+    
+    if (deliveries.size() < LARGE_INSTANCE_STOPS)
+        return;
+    
+    TraceSpan span("optimize", "optimize");
+    span.arg("stops", deliveries.size());
+    
+    // stop 0 is the depot, and stop i + 1 is delivery i
+    vector<GeoCoord> stops;
+    stops.reserve(deliveries.size() + 1);
+    stops.push_back(depot);
+    for (const auto &x : deliveries)
+        stops.push_back(x.location);
+    
+    vector<int> order;
+    optimizeTour(stops, order);
+    
+    double newDistance = 0;
+    for (size_t i = 0; i < order.size(); i++)
+        newDistance += distanceEarthMiles(stops[order[i]], stops[order[(i + 1) % order.size()]]);
+    
+    span.arg("old miles", oldCrowDistance);
+    span.arg("new miles", newDistance);
+    
+    // keep the original order if, unusually, it was already better
+    if (newDistance >= oldCrowDistance)
+        return;
+    
+    vector<DeliveryRequest> reordered;
+    reordered.reserve(deliveries.size());
+    for (size_t i = 1; i < order.size(); i++)
+        reordered.push_back(deliveries[order[i] - 1]);
+    deliveries.swap(reordered);
+    newCrowDistance = newDistance;
+}
+
+/*
+ An incremental optimizer keeps the tour between changes, along with the nearest neighbors of every stop
+ and where each stop is in the tour, so a change costs about as much as the part of the tour it touches. A
+ new delivery goes in beside one of its nearest neighbors, wherever that lengthens the tour least (cheapest
+ insertion); a cancelled one is taken out and its two neighbors are linked. Either way, the 2-opt and
+ Or-opt search then starts from just the stops whose links changed, and only spreads to the stops its
+ moves touch. The length of the tour is kept up to date by what each of these changes adds or saves.
+ */
+class IncrementalOptimizerImpl
+{
+public:
+    IncrementalOptimizerImpl(const StreetMap* sm);
+    ~IncrementalOptimizerImpl();
+    void setTour(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries);
+    void optimize();
+    void addDelivery(const DeliveryRequest& delivery);
+    bool cancelDelivery(const DeliveryRequest& delivery);
+    void getDeliveries(vector<DeliveryRequest>& deliveries) const;
+    double crowDistance() const;
+private:
+    const StreetMap* m_streetMap;
+    vector<GeoCoord> m_stops;               // stop 0 is the depot, and stop i + 1 is m_deliveries[i]
+    vector<DeliveryRequest> m_deliveries;
+    unique_ptr<TourImprover> m_tour;        // the tour of m_stops, kept from one change to the next
+    double m_crowDistance;
+    
+    // starts again from a tour of stops which have all changed
+    void startTour(const vector<int>& order);
+
+    // runs a short local search from the stops given, taking what it saves off the length of the tour
+    void repair(const vector<int>& changed);
+};
+
+// the length of a round trip through the stops in order
+static double tourLength(const vector<GeoCoord>& stops, const vector<int>& order)
+{
+    double miles = 0;
+    for (size_t i = 0; i < order.size(); i++)
+        miles += distanceEarthMiles(stops[order[i]], stops[order[(i + 1) % order.size()]]);
+    return miles;
+}
+
+IncrementalOptimizerImpl::IncrementalOptimizerImpl(const StreetMap* sm)
+    : m_streetMap(sm), m_stops(1)
+{
+    startTour(vector<int>(1, 0));
+}
+
+IncrementalOptimizerImpl::~IncrementalOptimizerImpl()
+{
+}
+
+void IncrementalOptimizerImpl::startTour(const vector<int>& order)
+{
+    vector<int> none;
+    m_tour.reset(new TourImprover(m_stops, order, &none));
+    m_crowDistance = tourLength(m_stops, order);
+}
+
+void IncrementalOptimizerImpl::setTour(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries)
+{
+    m_stops.assign(1, depot);
+    m_deliveries = deliveries;
+    vector<int> order(1, 0);
+    for (const auto &x : deliveries) {
+        order.push_back(m_stops.size());
+        m_stops.push_back(x.location);
+    }
+    startTour(order);
+}
+
+void IncrementalOptimizerImpl::optimize()
+{
+    TraceSpan span("optimize", "optimize tour");
+    span.arg("stops", m_stops.size());
+    vector<int> order;
+    optimizeTour(m_stops, order);
+    
+    // keep the tour if, unusually, it was already better
+    double crowDistance = tourLength(m_stops, order);
+    if (crowDistance < m_crowDistance) {
+        m_tour->setOrder(order);
+        m_crowDistance = crowDistance;
+    }
+}
+
+void IncrementalOptimizerImpl::addDelivery(const DeliveryRequest& delivery)
+{
+    TraceSpan span("optimize", "add delivery");
+    int s = m_stops.size();
+    m_stops.push_back(delivery.location);
+    m_deliveries.push_back(delivery);
+    
+    int before, after;
+    m_crowDistance += m_tour->addStop(before, after);
+    repair(vector<int>{ before, s, after });
+}
+
+bool IncrementalOptimizerImpl::cancelDelivery(const DeliveryRequest& delivery)
+{
+    TraceSpan span("optimize", "cancel delivery");
+    size_t d = 0;
+    while (d < m_deliveries.size() && (m_deliveries[d].item != delivery.item || m_deliveries[d].location != delivery.location))
+        d++;
+    if (d == m_deliveries.size())
+        return false;
+    
+    int s = d + 1;
+    int before, after;
+    m_crowDistance -= m_tour->removeStop(s, before, after);
+    
+    // the last stop takes the number of the cancelled one, so that the stops stay numbered without gaps
+    int last = m_stops.size() - 1;
+    if (s != last) {
+        m_stops[s] = m_stops[last];
+        m_deliveries[d] = m_deliveries.back();
+    }
+    m_stops.pop_back();
+    m_deliveries.pop_back();
+    repair(vector<int>{ before, after });
+    return true;
+}
+
+void IncrementalOptimizerImpl::getDeliveries(vector<DeliveryRequest>& deliveries) const
+{
+    vector<int> order;
+    m_tour->getOrder(order);
+    deliveries.clear();
+    for (size_t i = 1; i < order.size(); i++)
+        deliveries.push_back(m_deliveries[order[i] - 1]);
+}
+
+double IncrementalOptimizerImpl::crowDistance() const
+{
+    return m_crowDistance;
+}
+
+void IncrementalOptimizerImpl::repair(const vector<int>& changed)
+{
+    if (m_stops.size() < MIN_IMPROVABLE_STOPS)
+        return;
+    for (int s : changed)
+        m_tour->enqueue(s);
+    m_crowDistance -= m_tour->improve(REPAIR_MOVES);
 }
 
 //******************** DeliveryOptimizer functions ****************************
@@ -71,3 +967,48 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
 {
     return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
 }
+
+//******************** IncrementalOptimizer functions *************************
+
+// These functions simply delegate to IncrementalOptimizerImpl's functions.
+// You probably don't want to change any of this code.
+
+IncrementalOptimizer::IncrementalOptimizer(const StreetMap* sm)
+{
+    m_impl = new IncrementalOptimizerImpl(sm);
+}
+
+IncrementalOptimizer::~IncrementalOptimizer()
+{
+    delete m_impl;
+}
+
+void IncrementalOptimizer::setTour(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries)
+{
+    m_impl->setTour(depot, deliveries);
+}
+
+void IncrementalOptimizer::optimize()
+{
+    m_impl->optimize();
+}
+
+void IncrementalOptimizer::addDelivery(const DeliveryRequest& delivery)
+{
+    m_impl->addDelivery(delivery);
+}
+
+bool IncrementalOptimizer::cancelDelivery(const DeliveryRequest& delivery)
+{
+    return m_impl->cancelDelivery(delivery);
+}
+
+void IncrementalOptimizer::getDeliveries(vector<DeliveryRequest>& deliveries) const
+{
+    m_impl->getDeliveries(deliveries);
+}
+
+double IncrementalOptimizer::crowDistance() const
+{
+    return m_impl->crowDistance();
+}
@@ -1,42 +1,138 @@
 #include "provided.h"
+#include "MapSnapshot.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include <vector>
 #include <list>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
 using namespace std;
 
 string stringAngleForProceed (double angle);
 
+// the route between two consecutive stops of a tour
+struct TourLeg
+{
+    GeoCoord start;
+    GeoCoord end;
+    StreetPath route;
+    double distance = 0;
+    DeliveryResult result = DELIVERY_SUCCESS;
+    bool cancelled = false;  // the leg was abandoned because another leg failed
+    bool reused = false;     // the route was kept from an earlier plan, so the leg needs no routing
+    future<void> routed;     // ready once the fields above have been filled in
+};
+
+// the legs of every plan are routed on one pool shared by all planners, so that many planners
+// (like the workers of the planning server) don't each start a thread per core
+// tasks on this pool must never wait for other tasks on it, or they could wait forever
+static ThreadPool& legPool()
+{
+    static ThreadPool pool(0, "leg router");
+    return pool;
+}
+
 class DeliveryPlannerImpl
 {
 public:
-    DeliveryPlannerImpl(const StreetMap* sm);
+    DeliveryPlannerImpl(const StreetMap* sm, const DepotTrees* trees);
     ~DeliveryPlannerImpl();
     DeliveryResult generateDeliveryPlan(
         const GeoCoord& depot,
         const vector<DeliveryRequest>& deliveries,
         vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+    DeliveryResult streamDeliveryPlan(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        const function<void(const vector<DeliveryCommand>&)>& onLeg,
+        double& totalDistanceTravelled) const;
+    DeliveryResult generateDeliveryTour(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        DeliveryTour& tour) const;
+    DeliveryResult replanDeliveryTour(
+        const DeliveryTour& previous,
+        const GeoCoord& position,
+        const vector<DeliveryRequest>& completed,
+        DeliveryTour& tour) const;
     
     // this is a helper function for generateDeliveryPlan, see function implementation for details
-    DeliveryResult navigate (const GeoCoord& start, const GeoCoord& end, vector<DeliveryCommand>& commands, double& totalDistanceTravelled) const;
+    void addCommandsForRoute(const StreetPath& route, vector<DeliveryCommand>& commands) const;
 private:
     
-    // this StreetMap pointer isn't very helpful for this class but it's there because the spec required it
+    // the map we plan on; every plan takes one snapshot of it and routes all of its legs on that
     const StreetMap* m_streetMap;
     
-    // a PointToPointRouter is required to generate routes to/from the depot and/or delivery locations
-    const PointToPointRouter* m_ptopRouter;
+    // the trees of the depots, if the planner was given any, shared with other planners
+    const DepotTrees* m_depotTrees;
+    
+    // routes one leg, giving up early if abort becomes true; if the leg fails, it sets abort itself
+    void routeLeg(const PointToPointRouter& router, const shared_ptr<const MapSnapshot>& snapshot, TourLeg& leg,
+                  atomic<bool>& abort, mutex& abortMutex, DeliveryResult& abortResult) const;
+    
+    // routes every leg of a tour from start, through the deliveries, back to the depot and hands the
+    // commands of each leg to onLeg, in order, as soon as it is routed; legs marked reused already have
+    // their routes, and routes are only kept if keepRoutes
+    DeliveryResult routeTour(shared_ptr<const MapSnapshot> snapshot, const GeoCoord& start, const GeoCoord& depot,
+                             const vector<DeliveryRequest>& deliveries, vector<TourLeg>& legs, bool keepRoutes,
+                             const function<void(const vector<DeliveryCommand>&)>& onLeg,
+                             double& totalDistanceTravelled) const;
+    
+    // fills in a tour from its routed legs
+    void fillTour(shared_ptr<const MapSnapshot> snapshot, const GeoCoord& start, const GeoCoord& depot,
+                  const vector<DeliveryRequest>& deliveries, vector<TourLeg>& legs, DeliveryTour& tour) const;
 };
 
-DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm)
-    : m_streetMap(sm)
+DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm, const DepotTrees* trees)
+    : m_streetMap(sm), m_depotTrees(trees)
 {
-    m_ptopRouter = new PointToPointRouter(sm);
 }
 
 DeliveryPlannerImpl::~DeliveryPlannerImpl()
 {
-    // free the memory allocated for the PointToPoint router
-    delete m_ptopRouter;
+}
+
+void DeliveryPlannerImpl::routeLeg(const PointToPointRouter& router, const shared_ptr<const MapSnapshot>& snapshot,
+                                   TourLeg& leg, atomic<bool>& abort, mutex& abortMutex, DeliveryResult& abortResult) const
+{
+    // another leg has already failed, so this one isn't needed
+    if (abort) {
+        leg.cancelled = true;
+        return;
+    }
+    
+    // legs leaving or returning to a depot with trees just follow them, on the same snapshot as the other legs
+    if (m_depotTrees != nullptr && m_depotTrees->hasDepot(leg.start))
+        leg.result = m_depotTrees->routeFromDepot(leg.start, leg.end, leg.route, leg.distance, snapshot);
+    else if (m_depotTrees != nullptr && m_depotTrees->hasDepot(leg.end))
+        leg.result = m_depotTrees->routeToDepot(leg.start, leg.end, leg.route, leg.distance, snapshot);
+    else
+        leg.result = router.generatePointToPointRoute(leg.start, leg.end, leg.route, leg.distance, &abort);
+    if (leg.result == DELIVERY_SUCCESS)
+        return;
+    
+    // either we failed, and must stop every other leg, or we were stopped because some other leg failed
+    lock_guard<mutex> lock(abortMutex);
+    if (abort)
+        leg.cancelled = true;
+    else {
+        abortResult = leg.result;
+        abort = true;
+    }
+}
+
+// a sink which adds the commands of every leg to the end of commands
+static function<void(const vector<DeliveryCommand>&)> appendTo(vector<DeliveryCommand>& commands)
+{
+    return [&commands](const vector<DeliveryCommand>& leg) {
+        commands.insert(commands.end(), leg.begin(), leg.end());
+    };
 }
 
 DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
@@ -45,138 +141,318 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
     vector<DeliveryCommand>& commands,
     double& totalDistanceTravelled) const
 {
-    // currently generates delivery commands without optimization
-
-    // local variables required to use generatePointToPointRoute
-    GeoCoord currentStart = depot;
-    GeoCoord currentDestination;
-    DeliveryCommand currentCommand;
-    totalDistanceTravelled = 0;
-    DeliveryResult r;
+    return streamDeliveryPlan(depot, deliveries, appendTo(commands), totalDistanceTravelled);
+}
 
+DeliveryResult DeliveryPlannerImpl::streamDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    const function<void(const vector<DeliveryCommand>&)>& onLeg,
+    double& totalDistanceTravelled) const
+{
+    TraceSpan span("plan", "plan");
+    span.arg("deliveries", deliveries.size());
+    
+    // every leg of this plan sees the map as it is now, even if it changes while we are routing
+    vector<TourLeg> legs(deliveries.size() + 1);
+    return routeTour(m_streetMap->snapshot(), depot, depot, deliveries, legs, false, onLeg, totalDistanceTravelled);
+}
 
-    for (auto &x : deliveries) {
+DeliveryResult DeliveryPlannerImpl::routeTour(
+    shared_ptr<const MapSnapshot> snapshot,
+    const GeoCoord& start,
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<TourLeg>& legs,
+    bool keepRoutes,
+    const function<void(const vector<DeliveryCommand>&)>& onLeg,
+    double& totalDistanceTravelled) const
+{
+    /*
+     The route of each leg of the tour depends only on where the leg starts and ends, so all of the legs
+     are routed at the same time. Meanwhile, this thread turns the legs into commands in tour order,
+     as soon as each one is ready, so the commands come out exactly as if the legs had been routed one
+     after another, and the first leg's are passed on while later legs are still being routed. If any
+     leg fails, the legs still being routed are abandoned.
+     */
+    
+    const MapData& graph = snapshot->data();
+    PointToPointRouter router(snapshot);
+    
+    // on a tiled map, have the part of the map the tour covers read in before the legs start searching it
+    double minLat = min(depot.latitude, start.latitude), maxLat = max(depot.latitude, start.latitude);
+    double minLon = min(depot.longitude, start.longitude), maxLon = max(depot.longitude, start.longitude);
+    for (const auto &x : deliveries) {
+        minLat = min(minLat, x.location.latitude);
+        maxLat = max(maxLat, x.location.latitude);
+        minLon = min(minLon, x.location.longitude);
+        maxLon = max(maxLon, x.location.longitude);
+    }
+    graph.prefetch(minLat, minLon, maxLat, maxLon);
+    
+    // check every stop before routing anything: a bad coordinate, or a stop on a piece of the map
+    // the depot isn't connected to, would otherwise only be found after routing half the tour
+    int depotNode = graph.nodeOf(depot);
+    if (depotNode < 0)
+        return BAD_COORD;
+    vector<int> stopNodes(1, graph.nodeOf(start));
+    if (stopNodes.back() < 0)
+        return BAD_COORD;
+    for (const auto &x : deliveries) {
+        stopNodes.push_back(graph.nodeOf(x.location));
+        if (stopNodes.back() < 0)
+            return BAD_COORD;
+    }
+    for (int node : stopNodes)
+        if (!graph.mayBeConnected(depotNode, node))
+            return NO_ROUTE;
+    
+    // the tour goes from its start (usually the depot) to every delivery in order, and then back to the depot
+    for (size_t i = 0; i < legs.size(); i++) {
+        legs[i].start = (i == 0) ? start : deliveries[i - 1].location;
+        legs[i].end = (i < deliveries.size()) ? deliveries[i].location : depot;
+    }
+    
+    atomic<bool> abort(false);
+    mutex abortMutex;
+    DeliveryResult abortResult = NO_ROUTE;
+    
+    // hand every leg after the first to the pool; legs which go nowhere, or were kept, need no route
+    for (size_t i = 1; i < legs.size(); i++) {
+        if (legs[i].start == legs[i].end || legs[i].reused)
+            continue;
+        shared_ptr<promise<void> > done = make_shared<promise<void> >();
+        legs[i].routed = done->get_future();
+        TourLeg* leg = &legs[i];
+        legPool().submit([this, leg, done, &router, &snapshot, &abort, &abortMutex, &abortResult] {
+            routeLeg(router, snapshot, *leg, abort, abortMutex, abortResult);
+            done->set_value();
+        });
+    }
+    
+    // the first leg is needed first, so we route it ourselves rather than wait for the pool
+    if (legs[0].start != legs[0].end && !legs[0].reused)
+        routeLeg(router, snapshot, legs[0], abort, abortMutex, abortResult);
+    
+    totalDistanceTravelled = 0;
+    DeliveryResult result = DELIVERY_SUCCESS;
+    vector<DeliveryCommand> commands;
+    for (size_t i = 0; i < legs.size(); i++) {
+        TourLeg& leg = legs[i];
         
-        // the current destination for our algorithm is always the next entry in the deliveries vector
-        currentDestination = x.location;
+        // even after a failure we wait for every leg, since the pool is still using them
+        if (leg.routed.valid()) {
+            TraceSpan waitSpan("plan", "wait for leg");
+            waitSpan.arg("leg", i);
+            leg.routed.wait();
+        }
+        if (result != DELIVERY_SUCCESS)
+            continue;
         
-        // we use this small check here to prevent memory allocation for variables and processing long paths
-        // so that the process is sped up
-        if (currentStart == currentDestination) {
-            currentCommand.initAsDeliverCommand(x.item);
-            commands.push_back(currentCommand);
-            currentStart = currentDestination;
+        // a cancelled leg didn't fail itself, the result is that of the leg which did
+        if (leg.cancelled || leg.result != DELIVERY_SUCCESS) {
+            result = leg.cancelled ? abortResult : leg.result;
+            abort = true;
             continue;
         }
         
-        // navigate will add the required commands to the vector and update totalDistanceTravelled accordingly
-        // if there is a bad result returned, we convey that to the caller
-        r = navigate(currentStart, currentDestination, commands, totalDistanceTravelled);
-        if (r == NO_ROUTE || r == BAD_COORD)
-            return r;
-
-        // at this point we have reached the delivery location, so we append the appropriate command
-        currentCommand.initAsDeliverCommand(x.item);
-        commands.push_back(currentCommand);
-        
-        // update currentStart for the next delivery
-        currentStart = currentDestination;
+        // the leg is routed, so turn it into commands, followed by the delivery it leads to
+        TraceSpan renderSpan("plan", "render commands");
+        renderSpan.arg("leg", i);
+        renderSpan.arg("segments", leg.route.size());
+        totalDistanceTravelled += leg.distance;
+        commands.clear();
+        addCommandsForRoute(leg.route, commands);
+        if (!keepRoutes)
+            leg.route.clear();
+        if (i < deliveries.size()) {
+            DeliveryCommand currentCommand;
+            currentCommand.initAsDeliverCommand(deliveries[i].item);
+            commands.push_back(currentCommand);
+        }
+        renderSpan.end();
+        onLeg(commands);
+    }
+    
+    return result;
+}
+
+void DeliveryPlannerImpl::fillTour(
+    shared_ptr<const MapSnapshot> snapshot,
+    const GeoCoord& start,
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<TourLeg>& legs,
+    DeliveryTour& tour) const
+{
+    tour.depot = depot;
+    tour.start = start;
+    tour.deliveries = deliveries;
+    tour.snapshot = snapshot;
+    tour.legs.clear();
+    tour.legDistances.clear();
+    for (auto& leg : legs) {
+        tour.legs.push_back(move(leg.route));
+        tour.legDistances.push_back(leg.distance);
     }
+}
 
-    // now that we have completed all the deliveries, we must provide commands from the last delivery location back to the depot
-    // currentStart already holds the location of the last delivery location
-    r = navigate(currentStart, depot, commands, totalDistanceTravelled);
+DeliveryResult DeliveryPlannerImpl::generateDeliveryTour(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryTour& tour) const
+{
+    TraceSpan span("plan", "plan tour");
+    span.arg("deliveries", deliveries.size());
     
-    // whatever is returned by the previous statement is the result of our function which we return to the caller
-    return r;
+    shared_ptr<const MapSnapshot> snapshot = m_streetMap->snapshot();
+    vector<TourLeg> legs(deliveries.size() + 1);
+    tour.commands.clear();
+    DeliveryResult result = routeTour(snapshot, depot, depot, deliveries, legs, true,
+                                      appendTo(tour.commands), tour.totalDistanceTravelled);
+    if (result == DELIVERY_SUCCESS)
+        fillTour(snapshot, depot, depot, deliveries, legs, tour);
+    return result;
 }
 
-/*
- This function "navigates" from the start coordinate to the end coordinate
- In the process, it generates appropriate commands and adds them to the vector of commands
- In other words, some of the work to be done by generateDelivery Plan has been factored out here
- This particular function takes care of getting a point to point route and then converting the route into commands
- The commands are then added to the vector
- */
-DeliveryResult DeliveryPlannerImpl::navigate(const GeoCoord &start,
-        const GeoCoord &end,
-        vector<DeliveryCommand> &commands,
-        double &totalDistanceTravelled) const {
+DeliveryResult DeliveryPlannerImpl::replanDeliveryTour(
+    const DeliveryTour& previous,
+    const GeoCoord& position,
+    const vector<DeliveryRequest>& completed,
+    DeliveryTour& tour) const
+{
+    /*
+     The deliveries still to be made keep the order of the previous tour, which was already a good one,
+     so the new tour differs from it only where the robot now is and where completed deliveries were
+     taken out. Every leg which still joins the same two stops keeps its route, unless the map changed
+     since in a way that could change it: a segment on it was closed or made dearer, or some segment
+     anywhere was reopened or made cheaper, which could give any leg a shorter way. Usually only the
+     leg from the robot to its next stop is routed, so re-planning costs about one route.
+     */
     
-    // there are no commands to be generated, so we simply return DELIVERY_SUCCESS
-    if (start == end)
-        return DELIVERY_SUCCESS;
+    TraceSpan span("plan", "replan tour");
+    span.arg("completed", completed.size());
     
-    // local variables required for processing and calling PointToPointRoute functions
-    double distance;
-    list<StreetSegment> currentRoute;
+    // a delivery is made once for every time it appears in completed
+    vector<DeliveryRequest> remaining;
+    vector<bool> done(completed.size(), false);
+    for (const auto& d : previous.deliveries) {
+        size_t k = 0;
+        while (k < completed.size() && (done[k] || completed[k].item != d.item || completed[k].location != d.location))
+            k++;
+        if (k < completed.size())
+            done[k] = true;
+        else
+            remaining.push_back(d);
+    }
     
-    // local variable required to hold the current command being computed
-    DeliveryCommand currentCommand;
+    shared_ptr<const MapSnapshot> snapshot = m_streetMap->snapshot();
     
-    // we try to get a route from the start coordinate to the end coordinate and store it in a temporary result variable
-    DeliveryResult tempResult = m_ptopRouter->generatePointToPointRoute(start, end, currentRoute, distance);
+    // the segments whose changes since the previous tour may have spoilt the legs going along them
+    set<int> dearer;
+    bool keepAny = previous.snapshot != nullptr && &previous.snapshot->data() == &snapshot->data();
+    vector<MapChange> changes;
+    if (keepAny && !snapshot->changesSince(previous.snapshot->version(), changes))
+        keepAny = false;
+    for (size_t k = 0; keepAny && k < changes.size(); k++) {
+        int e = changes[k].edge;
+        double before = previous.snapshot->edgeOpen(e) ? previous.snapshot->edgeWeight(e) : -1;
+        double after = snapshot->edgeOpen(e) ? snapshot->edgeWeight(e) : -1;
+        if (after >= 0 && (before < 0 || after < before))
+            keepAny = false;
+        else if (after != before)
+            dearer.insert(e);
+    }
     
-    // in case a bad result is returned, we convey that to the caller
-    if (tempResult == NO_ROUTE || tempResult == BAD_COORD)
-        return tempResult;
+    // the previous legs by the stops they join
+    map<pair<GeoCoord, GeoCoord>, size_t> previousLegs;
+    for (size_t i = 0; keepAny && i < previous.legs.size(); i++) {
+        const GeoCoord& from = (i == 0) ? previous.start : previous.deliveries[i - 1].location;
+        const GeoCoord& to = (i < previous.deliveries.size()) ? previous.deliveries[i].location : previous.depot;
+        previousLegs.insert(make_pair(make_pair(from, to), i));
+    }
     
-    // these iterators are required to iterate through the route of street segments
-    // the tempIt is used when on a route, we change streets and so need to know the angle of the change to determine a turn
-    list<StreetSegment>::iterator it, tempIt;
+    vector<TourLeg> legs(remaining.size() + 1);
+    size_t reused = 0;
+    for (size_t i = 0; i < legs.size() && !previousLegs.empty(); i++) {
+        const GeoCoord& from = (i == 0) ? position : remaining[i - 1].location;
+        const GeoCoord& to = (i < remaining.size()) ? remaining[i].location : previous.depot;
+        auto it = previousLegs.find(make_pair(from, to));
+        if (it == previousLegs.end())
+            continue;
+        // both tours are on the same map, so its segments are numbered the same in both
+        const StreetPath& route = previous.legs[it->second];
+        bool spoilt = false;
+        for (size_t k = 0; k < route.size() && !spoilt && !dearer.empty(); k++)
+            spoilt = dearer.count(route.edges()[k]) > 0;
+        if (spoilt)
+            continue;
+        legs[i].route = route;
+        legs[i].distance = previous.legDistances[it->second];
+        legs[i].reused = true;
+        reused++;
+    }
+    span.arg("reused legs", reused);
+    span.arg("routed legs", legs.size() - reused);
     
-    // at this point, no bad value has been returned by generatePointToPointRoute
-    // so we can safely add the distance it returned to totalDistanceTravelled
-    totalDistanceTravelled += distance;
+    tour.commands.clear();
+    DeliveryResult result = routeTour(snapshot, position, previous.depot, remaining, legs, true,
+                                      appendTo(tour.commands), tour.totalDistanceTravelled);
+    if (result == DELIVERY_SUCCESS)
+        fillTour(snapshot, position, previous.depot, remaining, legs, tour);
+    return result;
+}
+
+/*
+ This function converts a route into commands and adds them to the vector of commands
+ In other words, some of the work to be done by generateDelivery Plan has been factored out here
+ */
+void DeliveryPlannerImpl::addCommandsForRoute(const StreetPath& currentRoute,
+        vector<DeliveryCommand> &commands) const {
+    
+    // local variable required to hold the current command being computed
+    DeliveryCommand currentCommand;
+    
+    // the route is walked by the positions of its segments, and no segment is ever built from it
+    size_t i = 0;
     
     // we now iterate through every street segment of the route
-    // the iterator will be updated in the body of the loop
-    for (it = currentRoute.begin(); it != currentRoute.end(); ) {
+    // the position will be updated in the body of the loop
+    while (i < currentRoute.size()) {
         
-        // we store the name of the current street we are on so that proceed commands are not duplicated
-        string temp = it->name;
+        // we remember where the current street started so that proceed commands are not duplicated
+        size_t first = i;
         
         // give an initial value to the current proceed command
         // the stringAngleForProceed command does the job giving the direction corresponding to the angle of the segment
-        currentCommand.initAsProceedCommand(stringAngleForProceed(angleOfLine(*it)), temp, distanceEarthMiles(it->start, it->end));
-        
-        // the job of the tempIt iterator is to point to the last segment of the current street
-        // right now that value is pointed to by 'it'
-        tempIt = it;
+        currentCommand.initAsProceedCommand(stringAngleForProceed(currentRoute.angle(i)), currentRoute.streetName(i), currentRoute.length(i));
         
         // as long as we are on the same street, keep adding distance to the proceed command
-        while (++it != currentRoute.end() && it->name == temp) {
-            currentCommand.increaseDistance(distanceEarthMiles(it->start, it->end));
-            
-            // update tempIt to reflect the last segment of the current street
-            tempIt = it;
+        while (++i < currentRoute.size() && currentRoute.sameStreet(i, first)) {
+            currentCommand.increaseDistance(currentRoute.length(i));
         }
         
         // the proceed command was fully ready so we can now add it to the vector
         commands.push_back(currentCommand);
         
         // if we have changed streets, we must compute a turn command and add it to the vector
-        if (it != currentRoute.end()) {
+        if (i < currentRoute.size()) {
             
             // compute an angle between the previous street and the new one
-            // this is where the tempIt iterator comes handy
-            // 'it' now points to the next street while 'tempIt' still holds the last segment of the previous street
-            double switchAngle = angleBetween2Lines(*tempIt, *it);
+            // segment i is the first of the next street, and segment i - 1 the last of the previous one
+            double switchAngle = currentRoute.turnAngle(i);
             
             // computing and adding the turn command as given in the spec
             if (switchAngle >= 1 && switchAngle < 180) {
-                currentCommand.initAsTurnCommand("left", it->name);
+                currentCommand.initAsTurnCommand("left", currentRoute.streetName(i));
                 commands.push_back(currentCommand);
             }
             else if (switchAngle >= 180 && switchAngle <= 359) {
-                currentCommand.initAsTurnCommand("right", it->name);
+                currentCommand.initAsTurnCommand("right", currentRoute.streetName(i));
                 commands.push_back(currentCommand);
             }
         }
     }
-    
-    // a route was found and successfully converted to commands
-    return DELIVERY_SUCCESS;
 }
 
 //******************** DeliveryPlanner functions ******************************
@@ -186,7 +462,12 @@ DeliveryResult DeliveryPlannerImpl::navigate(const GeoCoord &start,
 
 DeliveryPlanner::DeliveryPlanner(const StreetMap* sm)
 {
-    m_impl = new DeliveryPlannerImpl(sm);
+    m_impl = new DeliveryPlannerImpl(sm, nullptr);
+}
+
+DeliveryPlanner::DeliveryPlanner(const StreetMap* sm, const DepotTrees* trees)
+{
+    m_impl = new DeliveryPlannerImpl(sm, trees);
 }
 
 DeliveryPlanner::~DeliveryPlanner()
@@ -203,6 +484,32 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
     return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
 }
 
+DeliveryResult DeliveryPlanner::streamDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    const function<void(const vector<DeliveryCommand>&)>& onLeg,
+    double& totalDistanceTravelled) const
+{
+    return m_impl->streamDeliveryPlan(depot, deliveries, onLeg, totalDistanceTravelled);
+}
+
+DeliveryResult DeliveryPlanner::generateDeliveryTour(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryTour& tour) const
+{
+    return m_impl->generateDeliveryTour(depot, deliveries, tour);
+}
+
+DeliveryResult DeliveryPlanner::replanDeliveryTour(
+    const DeliveryTour& previous,
+    const GeoCoord& position,
+    const vector<DeliveryRequest>& completed,
+    DeliveryTour& tour) const
+{
+    return m_impl->replanDeliveryTour(previous, position, completed, tour);
+}
+
 
 
 // Auxiliary function implementation
@@ -0,0 +1,156 @@
+#include "provided.h"
+#include "MapSnapshot.h"
+#include "ShortestPaths.h"
+#include "Trace.h"
+#include <vector>
+using namespace std;
+
+/*
+ Rather than routing from every depot to every delivery, the depots are all put into one search at
+ distance zero. Every node the search settles was reached along the shortest path from some depot,
+ which is then the nearest depot to that node, so each node inherits its depot from the node it was
+ reached from. The search stops as soon as every delivery has been settled.
+ */
+
+class DepotAssignerImpl
+{
+public:
+    DepotAssignerImpl(const StreetMap* sm);
+    ~DepotAssignerImpl();
+    DeliveryResult assignDeliveries(
+        const vector<GeoCoord>& depots,
+        const vector<DeliveryRequest>& deliveries,
+        vector<int>& assignment) const;
+    DeliveryResult planDeliveries(
+        const vector<GeoCoord>& depots,
+        const vector<DeliveryRequest>& deliveries,
+        bool optimize,
+        vector<DepotPlan>& plans,
+        vector<DeliveryRequest>& unassigned) const;
+
+private:
+    const StreetMap* m_streetMap;
+    DeliveryOptimizer m_optimizer;
+    DeliveryPlanner m_planner;
+};
+
+DepotAssignerImpl::DepotAssignerImpl(const StreetMap* sm)
+    : m_streetMap(sm), m_optimizer(sm), m_planner(sm)
+{
+}
+
+DepotAssignerImpl::~DepotAssignerImpl()
+{
+}
+
+DeliveryResult DepotAssignerImpl::assignDeliveries(
+        const vector<GeoCoord>& depots,
+        const vector<DeliveryRequest>& deliveries,
+        vector<int>& assignment) const
+{
+    TraceSpan span("plan", "assign depots");
+    span.arg("depots", depots.size());
+    span.arg("deliveries", deliveries.size());
+
+    shared_ptr<const MapSnapshot> snapshot = m_streetMap->snapshot();
+    const MapData& graph = snapshot->data();
+
+    vector<int> sources;
+    for (const auto& depot : depots) {
+        int node = graph.nodeOf(depot);
+        if (node < 0)
+            return BAD_COORD;
+        sources.push_back(node);
+    }
+
+    // deliveries which aren't on the map can't be assigned, but don't stop the others from being
+    vector<int> targets;
+    vector<int> deliveryNodes;
+    for (const auto& d : deliveries) {
+        deliveryNodes.push_back(graph.nodeOf(d.location));
+        if (deliveryNodes.back() >= 0)
+            targets.push_back(deliveryNodes.back());
+    }
+
+    assignment.assign(deliveries.size(), -1);
+    if (targets.empty() || sources.empty())
+        return DELIVERY_SUCCESS;
+
+    NearestSourceForest forest;
+    computeNearestSourceForest(*snapshot, sources, forest, targets);
+    for (size_t i = 0; i < deliveries.size(); i++) {
+        if (deliveryNodes[i] >= 0)
+            assignment[i] = forest.nearest[deliveryNodes[i]];
+    }
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult DepotAssignerImpl::planDeliveries(
+        const vector<GeoCoord>& depots,
+        const vector<DeliveryRequest>& deliveries,
+        bool optimize,
+        vector<DepotPlan>& plans,
+        vector<DeliveryRequest>& unassigned) const
+{
+    vector<int> assignment;
+    DeliveryResult r = assignDeliveries(depots, deliveries, assignment);
+    if (r != DELIVERY_SUCCESS)
+        return r;
+
+    // every depot gets its deliveries in the order they were given
+    plans.assign(depots.size(), DepotPlan());
+    unassigned.clear();
+    for (size_t i = 0; i < depots.size(); i++)
+        plans[i].depot = depots[i];
+    for (size_t i = 0; i < deliveries.size(); i++) {
+        if (assignment[i] < 0)
+            unassigned.push_back(deliveries[i]);
+        else
+            plans[assignment[i]].deliveries.push_back(deliveries[i]);
+    }
+
+    // a depot nobody is nearest to has nothing to plan
+    for (auto& plan : plans) {
+        if (plan.deliveries.empty())
+            continue;
+        if (optimize) {
+            double oldCrowDistance, newCrowDistance;
+            m_optimizer.optimizeDeliveryOrder(plan.depot, plan.deliveries, oldCrowDistance, newCrowDistance);
+        }
+        plan.result = m_planner.generateDeliveryPlan(plan.depot, plan.deliveries, plan.commands, plan.totalDistanceTravelled);
+    }
+    return DELIVERY_SUCCESS;
+}
+
+//******************** DepotAssigner functions ********************************
+
+// These functions simply delegate to DepotAssignerImpl's functions.
+// You probably don't want to change any of this code.
+
+DepotAssigner::DepotAssigner(const StreetMap* sm)
+{
+    m_impl = new DepotAssignerImpl(sm);
+}
+
+DepotAssigner::~DepotAssigner()
+{
+    delete m_impl;
+}
+
+DeliveryResult DepotAssigner::assignDeliveries(
+        const vector<GeoCoord>& depots,
+        const vector<DeliveryRequest>& deliveries,
+        vector<int>& assignment) const
+{
+    return m_impl->assignDeliveries(depots, deliveries, assignment);
+}
+
+DeliveryResult DepotAssigner::planDeliveries(
+        const vector<GeoCoord>& depots,
+        const vector<DeliveryRequest>& deliveries,
+        bool optimize,
+        vector<DepotPlan>& plans,
+        vector<DeliveryRequest>& unassigned) const
+{
+    return m_impl->planDeliveries(depots, deliveries, optimize, plans, unassigned);
+}
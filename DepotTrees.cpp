@@ -0,0 +1,306 @@
+#include "provided.h"
+#include "MapSnapshot.h"
+#include "ShortestPaths.h"
+#include "Trace.h"
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <algorithm>
+using namespace std;
+
+/*
+ Each depot keeps two trees over the whole map: the shortest paths from the depot to every node, and
+ from every node to the depot. A leg leaving the depot is then read off the first by following parent
+ edges back from its end, and a leg returning to it off the second by following each node's first edge
+ on its way there, so neither takes a search.
+
+ The trees are kept along with the snapshot they were found on. Once the map has changed, the next
+ route asked for brings them up to date: if no segment was reopened or made cheaper, and no segment on
+ either tree was closed or made dearer, every path on them is still a shortest one and the trees are
+ kept as they are; otherwise both are searched again, with parallel delta-stepping. Only one thread
+ brings a depot's trees up to a snapshot; any other asking for the same ones meanwhile waits for its
+ result rather than searching too. Trees are keyed by the depot's coordinate, so a
+ depot keeps its trees across a reload of the map, searched again on the new one.
+ */
+
+// the trees of one depot on one snapshot; never changed once made, so any number of threads may read them
+struct DepotTree
+{
+    shared_ptr<const MapSnapshot> snapshot;
+    int depot = -1;                             // -1 if the depot isn't on this map
+    shared_ptr<const ShortestPathTree> from;    // the shortest paths from the depot
+    shared_ptr<const ShortestPathTree> to;      // the shortest paths to the depot
+};
+
+class DepotTreesImpl
+{
+public:
+    DepotTreesImpl(const StreetMap* sm);
+    ~DepotTreesImpl();
+    bool addDepot(const GeoCoord& depot);
+    bool hasDepot(const GeoCoord& depot) const;
+    DeliveryResult routeFromDepot(
+        const GeoCoord& depot,
+        const GeoCoord& end,
+        StreetPath& path,
+        double& totalDistanceTravelled,
+        shared_ptr<const MapSnapshot> snapshot) const;
+    DeliveryResult routeToDepot(
+        const GeoCoord& start,
+        const GeoCoord& depot,
+        StreetPath& path,
+        double& totalDistanceTravelled,
+        shared_ptr<const MapSnapshot> snapshot) const;
+
+private:
+    const StreetMap* m_streetMap;
+
+    // the trees of every depot (guarded by m_mutex), replaced whenever they are brought up to date
+    mutable mutex m_mutex;
+    mutable map<GeoCoord, shared_ptr<const DepotTree> > m_trees;
+
+    // the trees being brought up to date (guarded by m_mutex), at most one snapshot for each depot
+    struct Update
+    {
+        shared_ptr<const MapSnapshot> snapshot;
+        shared_future<shared_ptr<const DepotTree> > result;
+    };
+    mutable map<GeoCoord, shared_ptr<Update> > m_updates;
+
+    // the trees of the depot on snapshot, or nullptr if it was never added
+    shared_ptr<const DepotTree> treesOf(const GeoCoord& depot, const shared_ptr<const MapSnapshot>& snapshot) const;
+};
+
+// searches both trees of a depot
+static shared_ptr<const DepotTree> buildTrees(const shared_ptr<const MapSnapshot>& snapshot, const GeoCoord& depot)
+{
+    TraceSpan span("depot", "build trees");
+    shared_ptr<DepotTree> trees = make_shared<DepotTree>();
+    trees->snapshot = snapshot;
+    trees->depot = snapshot->data().nodeOf(depot);
+    if (trees->depot < 0)
+        return trees;
+
+    shared_ptr<ShortestPathTree> from = make_shared<ShortestPathTree>();
+    shared_ptr<ShortestPathTree> to = make_shared<ShortestPathTree>();
+    computeShortestPathTreeParallel(*snapshot, trees->depot, *from);
+    computeReverseShortestPathTreeParallel(*snapshot, trees->depot, *to);
+    trees->from = from;
+    trees->to = to;
+    return trees;
+}
+
+// the trees of old, carried over to snapshot if the changes since can't have changed them, or searched again
+static shared_ptr<const DepotTree> updateTrees(const DepotTree& old, const shared_ptr<const MapSnapshot>& snapshot,
+                                               const GeoCoord& depot)
+{
+    // the log only says what changed going forwards, so trees for a later snapshot are no use for an
+    // earlier one, which a plan started before the changes may still be routing on
+    vector<MapChange> changes;
+    bool keep = old.depot >= 0 && &old.snapshot->data() == &snapshot->data() &&
+                snapshot->version() >= old.snapshot->version() &&
+                snapshot->changesSince(old.snapshot->version(), changes);
+    const MapData& graph = snapshot->data();
+    for (size_t k = 0; keep && k < changes.size(); k++) {
+        int e = changes[k].edge;
+        double before = old.snapshot->edgeOpen(e) ? old.snapshot->edgeWeight(e) : -1;
+        double after = snapshot->edgeOpen(e) ? snapshot->edgeWeight(e) : -1;
+        if (after >= 0 && (before < 0 || after < before))
+            keep = false;
+        else if (after != before)
+            keep = old.from->parentEdge[graph.edgeTarget[e]] != e && old.to->parentEdge[graph.edgeSource[e]] != e;
+    }
+    if (!keep)
+        return buildTrees(snapshot, depot);
+
+    shared_ptr<DepotTree> trees = make_shared<DepotTree>(old);
+    trees->snapshot = snapshot;
+    return trees;
+}
+
+DepotTreesImpl::DepotTreesImpl(const StreetMap* sm)
+    : m_streetMap(sm)
+{
+}
+
+DepotTreesImpl::~DepotTreesImpl() = default;
+
+bool DepotTreesImpl::addDepot(const GeoCoord& depot)
+{
+    shared_ptr<const DepotTree> trees = buildTrees(m_streetMap->snapshot(), depot);
+    if (trees->depot < 0)
+        return false;
+    lock_guard<mutex> lock(m_mutex);
+    m_trees[depot] = trees;
+    return true;
+}
+
+bool DepotTreesImpl::hasDepot(const GeoCoord& depot) const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_trees.find(depot) != m_trees.end();
+}
+
+shared_ptr<const DepotTree> DepotTreesImpl::treesOf(const GeoCoord& depot,
+                                                    const shared_ptr<const MapSnapshot>& snapshot) const
+{
+    shared_ptr<const DepotTree> old;
+    promise<shared_ptr<const DepotTree> > result;
+    shared_ptr<Update> update = make_shared<Update>();
+    shared_future<shared_ptr<const DepotTree> > theirs;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        auto it = m_trees.find(depot);
+        if (it == m_trees.end())
+            return nullptr;
+        if (it->second->snapshot == snapshot)
+            return it->second;
+        old = it->second;
+
+        // if somebody is already bringing these trees up to this snapshot, wait for theirs instead
+        shared_ptr<Update>& current = m_updates[depot];
+        if (current != nullptr && current->snapshot == snapshot)
+            theirs = current->result;
+        else {
+            update->snapshot = snapshot;
+            update->result = result.get_future().share();
+            current = update;
+        }
+    }
+    if (theirs.valid())
+        return theirs.get();
+
+    // the trees are brought up to date without the lock, so that other depots can be looked up meanwhile
+    shared_ptr<const DepotTree> trees;
+    try {
+        trees = updateTrees(*old, snapshot, depot);
+        result.set_value(trees);
+    } catch (...) {
+        result.set_exception(current_exception());
+        lock_guard<mutex> lock(m_mutex);
+        if (m_updates[depot] == update)
+            m_updates.erase(depot);
+        throw;
+    }
+
+    // the trees are only kept if nobody replaced them meanwhile, and if they are for the map as it is now;
+    // a plan still working on an older snapshot mustn't set the trees back
+    lock_guard<mutex> lock(m_mutex);
+    if (m_updates[depot] == update)
+        m_updates.erase(depot);
+    auto it = m_trees.find(depot);
+    if (it != m_trees.end() && it->second == old && snapshot == m_streetMap->snapshot())
+        it->second = trees;
+    return trees;
+}
+
+DeliveryResult DepotTreesImpl::routeFromDepot(
+        const GeoCoord& depot,
+        const GeoCoord& end,
+        StreetPath& path,
+        double& totalDistanceTravelled,
+        shared_ptr<const MapSnapshot> snapshot) const
+{
+    if (snapshot == nullptr)
+        snapshot = m_streetMap->snapshot();
+    shared_ptr<const DepotTree> trees = treesOf(depot, snapshot);
+    if (trees == nullptr || trees->depot < 0)
+        return BAD_COORD;
+    const MapData& graph = snapshot->data();
+    int target = graph.nodeOf(end);
+    if (target < 0)
+        return BAD_COORD;
+    if (!trees->from->reached(target))
+        return NO_ROUTE;
+
+    // the parent edges lead back from the end to the depot
+    vector<int> edges;
+    for (int node = target; node != trees->depot; node = graph.edgeSource[edges.back()])
+        edges.push_back(trees->from->parentEdge[node]);
+    reverse(edges.begin(), edges.end());
+
+    // the distance travelled is the actual length of the route, as the router gives it
+    totalDistanceTravelled = 0;
+    for (int e : edges)
+        totalDistanceTravelled += graph.edgeLength[e];
+    path = StreetPath(snapshot, move(edges));
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult DepotTreesImpl::routeToDepot(
+        const GeoCoord& start,
+        const GeoCoord& depot,
+        StreetPath& path,
+        double& totalDistanceTravelled,
+        shared_ptr<const MapSnapshot> snapshot) const
+{
+    if (snapshot == nullptr)
+        snapshot = m_streetMap->snapshot();
+    shared_ptr<const DepotTree> trees = treesOf(depot, snapshot);
+    if (trees == nullptr || trees->depot < 0)
+        return BAD_COORD;
+    const MapData& graph = snapshot->data();
+    int source = graph.nodeOf(start);
+    if (source < 0)
+        return BAD_COORD;
+    if (!trees->to->reached(source))
+        return NO_ROUTE;
+
+    // every node's first edge towards the depot leads on to the next node's
+    vector<int> edges;
+    for (int node = source; node != trees->depot; node = graph.edgeTarget[edges.back()])
+        edges.push_back(trees->to->parentEdge[node]);
+
+    totalDistanceTravelled = 0;
+    for (int e : edges)
+        totalDistanceTravelled += graph.edgeLength[e];
+    path = StreetPath(snapshot, move(edges));
+    return DELIVERY_SUCCESS;
+}
+
+//******************** DepotTrees functions ***********************************
+
+// These functions simply delegate to DepotTreesImpl's functions.
+// You probably don't want to change any of this code.
+
+DepotTrees::DepotTrees(const StreetMap* sm)
+{
+    m_impl = new DepotTreesImpl(sm);
+}
+
+DepotTrees::~DepotTrees()
+{
+    delete m_impl;
+}
+
+bool DepotTrees::addDepot(const GeoCoord& depot)
+{
+    return m_impl->addDepot(depot);
+}
+
+bool DepotTrees::hasDepot(const GeoCoord& depot) const
+{
+    return m_impl->hasDepot(depot);
+}
+
+DeliveryResult DepotTrees::routeFromDepot(
+        const GeoCoord& depot,
+        const GeoCoord& end,
+        StreetPath& path,
+        double& totalDistanceTravelled,
+        shared_ptr<const MapSnapshot> snapshot) const
+{
+    return m_impl->routeFromDepot(depot, end, path, totalDistanceTravelled, snapshot);
+}
+
+DeliveryResult DepotTrees::routeToDepot(
+        const GeoCoord& start,
+        const GeoCoord& depot,
+        StreetPath& path,
+        double& totalDistanceTravelled,
+        shared_ptr<const MapSnapshot> snapshot) const
+{
+    return m_impl->routeToDepot(start, depot, path, totalDistanceTravelled, snapshot);
+}
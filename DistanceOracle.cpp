@@ -0,0 +1,202 @@
+#include "provided.h"
+#include "MapSnapshot.h"
+#include "HubLabels.h"
+#include "ShortestPaths.h"
+#include <string>
+#include <memory>
+#include <vector>
+#include <limits>
+#include <thread>
+using namespace std;
+
+/*
+ The labels describe the map as it was loaded, so they are only used while the current snapshot is
+ that map with nothing changed; once a street is closed or reweighted, or a different map is loaded,
+ distances come from searches until the labels are built again for it. The labels are swapped in
+ and out atomically, so lookups never wait for a build or a load. Without labels, each row of a
+ distance matrix still only takes one search. With many ends that search would cover most of the
+ map before settling them all, so on a machine with several cores the row is instead a parallel
+ search of the whole map.
+ */
+
+// a row with at least this many ends is searched in parallel
+const size_t MIN_ENDS_FOR_PARALLEL_ROW = 32;
+
+class DistanceOracleImpl
+{
+public:
+    DistanceOracleImpl(const StreetMap* sm);
+    ~DistanceOracleImpl();
+    bool buildLabels();
+    bool loadLabels(string labelFile);
+    bool saveLabels(string labelFile) const;
+    DeliveryResult findDistance(const GeoCoord& start, const GeoCoord& end, double& miles) const;
+    DeliveryResult findDistances(
+        const vector<GeoCoord>& starts,
+        const vector<GeoCoord>& ends,
+        vector<vector<double> >& miles) const;
+
+private:
+    const StreetMap* m_streetMap;
+    shared_ptr<const HubLabels> m_labels;   // read and replaced with atomic_load and atomic_store
+
+    // the labels, if they fit the snapshot
+    shared_ptr<const HubLabels> labelsFor(const MapSnapshot& snapshot) const
+    {
+        shared_ptr<const HubLabels> labels = atomic_load(&m_labels);
+        if (labels == nullptr || !snapshot.unchanged() || labels->fingerprint() != snapshot.data().fingerprint())
+            return nullptr;
+        return labels;
+    }
+};
+
+DistanceOracleImpl::DistanceOracleImpl(const StreetMap* sm)
+    : m_streetMap(sm)
+{
+}
+
+DistanceOracleImpl::~DistanceOracleImpl()
+{
+}
+
+bool DistanceOracleImpl::buildLabels()
+{
+    shared_ptr<const MapSnapshot> snapshot = m_streetMap->snapshot();
+    atomic_store(&m_labels, HubLabels::build(snapshot->data()));
+    return true;
+}
+
+bool DistanceOracleImpl::loadLabels(string labelFile)
+{
+    shared_ptr<const HubLabels> labels = HubLabels::open(labelFile, m_streetMap->snapshot()->data().fingerprint());
+    if (labels == nullptr)
+        return false;
+    atomic_store(&m_labels, labels);
+    return true;
+}
+
+bool DistanceOracleImpl::saveLabels(string labelFile) const
+{
+    shared_ptr<const HubLabels> labels = atomic_load(&m_labels);
+    return labels != nullptr && labels->save(labelFile);
+}
+
+DeliveryResult DistanceOracleImpl::findDistance(const GeoCoord& start, const GeoCoord& end, double& miles) const
+{
+    shared_ptr<const MapSnapshot> snapshot = m_streetMap->snapshot();
+    shared_ptr<const HubLabels> labels = labelsFor(*snapshot);
+    const MapData& graph = snapshot->data();
+    int source = graph.nodeOf(start);
+    int target = graph.nodeOf(end);
+    if (source < 0 || target < 0)
+        return BAD_COORD;
+
+    // a search gives the cost of the route, as the labels and the matrix do, rather than the router's
+    // length of it, which differs once a segment is reweighted
+    double d;
+    if (labels != nullptr)
+        d = labels->distance(source, target);
+    else {
+        NearestSourceForest forest;
+        computeNearestSourceForest(*snapshot, vector<int>(1, source), forest, vector<int>(1, target));
+        d = forest.distance[target];
+    }
+    if (d == numeric_limits<double>::infinity())
+        return NO_ROUTE;
+    miles = d;
+    return DELIVERY_SUCCESS;
+}
+
+// the nodes of the coordinates, or false if one of them isn't on the map
+static bool nodesOf(const MapData& graph, const vector<GeoCoord>& coords, vector<int>& nodes)
+{
+    nodes.clear();
+    for (const auto& gc : coords) {
+        nodes.push_back(graph.nodeOf(gc));
+        if (nodes.back() < 0)
+            return false;
+    }
+    return true;
+}
+
+DeliveryResult DistanceOracleImpl::findDistances(
+        const vector<GeoCoord>& starts,
+        const vector<GeoCoord>& ends,
+        vector<vector<double> >& miles) const
+{
+    shared_ptr<const MapSnapshot> snapshot = m_streetMap->snapshot();
+    shared_ptr<const HubLabels> labels = labelsFor(*snapshot);
+    const MapData& graph = snapshot->data();
+
+    // every coordinate is looked up once, rather than once for every entry of the matrix
+    vector<int> sources, targets;
+    if (!nodesOf(graph, starts, sources) || !nodesOf(graph, ends, targets))
+        return BAD_COORD;
+
+    miles.assign(starts.size(), vector<double>(ends.size()));
+    bool parallelRows = targets.size() >= MIN_ENDS_FOR_PARALLEL_ROW && thread::hardware_concurrency() > 1;
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (labels != nullptr) {
+            for (size_t j = 0; j < targets.size(); j++)
+                miles[i][j] = labels->distance(sources[i], targets[j]);
+            continue;
+        }
+        if (parallelRows) {
+            ShortestPathTree tree;
+            computeShortestPathTreeParallel(*snapshot, sources[i], tree);
+            for (size_t j = 0; j < targets.size(); j++)
+                miles[i][j] = tree.distance[targets[j]];
+            continue;
+        }
+
+        // one search from the start, which stops once it has settled every end
+        NearestSourceForest forest;
+        computeNearestSourceForest(*snapshot, vector<int>(1, sources[i]), forest, targets);
+        for (size_t j = 0; j < targets.size(); j++)
+            miles[i][j] = forest.distance[targets[j]];
+    }
+    return DELIVERY_SUCCESS;
+}
+
+//******************** DistanceOracle functions *******************************
+
+// These functions simply delegate to DistanceOracleImpl's functions.
+// You probably don't want to change any of this code.
+
+DistanceOracle::DistanceOracle(const StreetMap* sm)
+{
+    m_impl = new DistanceOracleImpl(sm);
+}
+
+DistanceOracle::~DistanceOracle()
+{
+    delete m_impl;
+}
+
+bool DistanceOracle::buildLabels()
+{
+    return m_impl->buildLabels();
+}
+
+bool DistanceOracle::loadLabels(string labelFile)
+{
+    return m_impl->loadLabels(labelFile);
+}
+
+bool DistanceOracle::saveLabels(string labelFile) const
+{
+    return m_impl->saveLabels(labelFile);
+}
+
+DeliveryResult DistanceOracle::findDistance(const GeoCoord& start, const GeoCoord& end, double& miles) const
+{
+    return m_impl->findDistance(start, end, miles);
+}
+
+DeliveryResult DistanceOracle::findDistances(
+        const vector<GeoCoord>& starts,
+        const vector<GeoCoord>& ends,
+        vector<vector<double> >& miles) const
+{
+    return m_impl->findDistances(starts, ends, miles);
+}
@@ -0,0 +1,73 @@
+// HilbertCurve.h
+
+//  Positions of coordinates along a Hilbert curve
+//  the curve visits every cell of a grid laid over the map, and cells which are close together
+//  along the curve are close together on the map, so sorting by curve position keeps neighbours together
+
+#ifndef HILBERTCURVE_H
+#define HILBERTCURVE_H
+
+#include "provided.h"
+#include <algorithm>
+
+// the grid is 2^16 cells on a side, which is finer than the precision of the map data
+const int HILBERT_ORDER = 16;
+
+// the distance along the Hilbert curve of cell (x, y) of a 2^order by 2^order grid
+inline unsigned long long hilbertIndex(unsigned int x, unsigned int y, int order = HILBERT_ORDER)
+{
+    unsigned long long n = 1ULL << order;
+    unsigned long long d = 0;
+    for (unsigned long long s = n / 2; s > 0; s /= 2) {
+        unsigned int rx = (x & s) > 0;
+        unsigned int ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+
+        // rotate the quadrant, so that the curve inside it is the right way round
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+// scales coordinates onto the grid covering a bounding box
+class HilbertGrid
+{
+public:
+    HilbertGrid()
+        : m_minLat(0), m_minLon(0), m_latScale(0), m_lonScale(0)
+    {}
+
+    HilbertGrid(double minLat, double minLon, double maxLat, double maxLon)
+        : m_minLat(minLat), m_minLon(minLon)
+    {
+        // a box with no height or width still has to map somewhere
+        double cells = (1ULL << HILBERT_ORDER) - 1;
+        m_latScale = maxLat > minLat ? cells / (maxLat - minLat) : 0;
+        m_lonScale = maxLon > minLon ? cells / (maxLon - minLon) : 0;
+    }
+
+    unsigned long long index(const GeoCoord& gc) const
+    {
+        return hilbertIndex(cell(gc.longitude, m_minLon, m_lonScale), cell(gc.latitude, m_minLat, m_latScale));
+    }
+
+private:
+    double m_minLat, m_minLon;
+    double m_latScale, m_lonScale;
+
+    static unsigned int cell(double v, double min, double scale)
+    {
+        double c = (v - min) * scale;
+        double last = (1ULL << HILBERT_ORDER) - 1;
+        return (unsigned int) std::max(0.0, std::min(c, last));
+    }
+};
+
+
+#endif // HILBERTCURVE_H
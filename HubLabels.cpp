@@ -0,0 +1,374 @@
+#include "HubLabels.h"
+#include "Trace.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <limits>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+/*
+ The labels are built in two steps. First the nodes are put in the order in which a contraction
+ hierarchy would contract them: repeatedly the node whose removal would need the fewest shortcuts
+ between its neighbours (and whose neighbours have been contracted least) goes next, so dead ends and
+ the middle of streets go first and the junctions of long through roads go last. The last node
+ contracted is the most important hub.
+
+ Then, from the most important node down, each node is made a hub of every node it reaches by a
+ search from it, unless the labels so far already give the right distance to that node, in which
+ case the search doesn't continue past it either (pruned landmark labelling). With a contraction
+ order, the first few hubs cover most shortest paths, so the searches quickly get short and the
+ labels stay small.
+
+ A label file holds the three arrays of the labels, each starting on a page boundary like the
+ arrays of a tiled map file, and is mapped into memory rather than read.
+ */
+
+const char LABEL_FILE_MAGIC[8] = { 'G', 'O', 'O', 'B', 'H', 'U', 'B', 'L' };
+const uint32_t LABEL_FILE_VERSION = 1;
+const size_t LABEL_FILE_ALIGNMENT = 4096;
+
+enum LabelSection
+{
+    FIRST_ENTRY, HUB, HUB_DISTANCE,
+    NUM_LABEL_SECTIONS
+};
+
+struct LabelFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numNodes;
+    uint64_t fingerprint;                       // of the map the labels were built from
+    uint64_t offset[NUM_LABEL_SECTIONS];        // where each array starts in the file
+    uint64_t count[NUM_LABEL_SECTIONS];         // how many elements it has
+};
+
+struct MappedLabelFile
+{
+    const char* base;
+    size_t size;
+
+    ~MappedLabelFile()
+    {
+        munmap(const_cast<char*>(base), size);
+    }
+};
+
+// a witness search gives up after settling this many nodes, and the shortcut is added just in case
+const int WITNESS_SETTLE_LIMIT = 256;
+
+const double INFINITE_DISTANCE = numeric_limits<double>::infinity();
+
+typedef vector<pair<int, double> > Neighbors;
+
+// adds an edge to the neighbor list, or shortens the one already there
+static void addEdge(Neighbors& neighbors, int node, double length)
+{
+    for (auto& n : neighbors) {
+        if (n.first == node) {
+            n.second = min(n.second, length);
+            return;
+        }
+    }
+    neighbors.push_back(make_pair(node, length));
+}
+
+// the shortcuts contracting node v needs, between neighbors which have no other path as short as the one through v
+static void findShortcuts(const vector<Neighbors>& graph, int v, vector<double>& distance,
+                          vector<tuple<int, int, double> >& shortcuts)
+{
+    shortcuts.clear();
+    const Neighbors& neighbors = graph[v];
+    double longest = 0;
+    for (const auto& n : neighbors)
+        longest = max(longest, n.second);
+
+    vector<int> touched;
+    vector<pair<double, int> > queue;
+    for (size_t a = 0; a < neighbors.size(); a++) {
+        int u = neighbors[a].first;
+        double limit = neighbors[a].second + longest;
+
+        // a small Dijkstra from u which avoids v and stops at the longest path through v
+        distance[u] = 0;
+        touched.push_back(u);
+        queue.push_back(make_pair(0.0, u));
+        int settled = 0;
+        while (!queue.empty() && settled < WITNESS_SETTLE_LIMIT) {
+            pop_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+            double d = queue.back().first;
+            int x = queue.back().second;
+            queue.pop_back();
+            if (d > distance[x])
+                continue;
+            if (d > limit)
+                break;
+            settled++;
+            for (const auto& n : graph[x]) {
+                if (n.first == v || d + n.second >= distance[n.first])
+                    continue;
+                if (distance[n.first] == INFINITE_DISTANCE)
+                    touched.push_back(n.first);
+                distance[n.first] = d + n.second;
+                queue.push_back(make_pair(d + n.second, n.first));
+                push_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+            }
+        }
+
+        // edges go both ways, so each pair of neighbors only needs looking at once
+        for (size_t b = a + 1; b < neighbors.size(); b++) {
+            int w = neighbors[b].first;
+            double through = neighbors[a].second + neighbors[b].second;
+            if (distance[w] > through)
+                shortcuts.push_back(make_tuple(u, w, through));
+        }
+
+        for (int x : touched)
+            distance[x] = INFINITE_DISTANCE;
+        touched.clear();
+        queue.clear();
+    }
+}
+
+// the nodes in the order a contraction hierarchy would contract them, least important first
+static vector<int> contractionOrder(const MapData& map)
+{
+    TraceSpan span("labels", "contraction order");
+    int numNodes = map.nodeCount();
+    vector<Neighbors> graph(numNodes);
+    for (int u = 0; u < numNodes; u++) {
+        for (int e = map.firstEdge[u]; e < map.firstEdge[u + 1]; e++) {
+            if (map.edgeTarget[e] != u)
+                addEdge(graph[u], map.edgeTarget[e], map.edgeLength[e]);
+        }
+    }
+
+    vector<double> distance(numNodes, INFINITE_DISTANCE);
+    vector<tuple<int, int, double> > shortcuts;
+    vector<int> contractedNeighbors(numNodes, 0);
+    auto priority = [&](int v) {
+        findShortcuts(graph, v, distance, shortcuts);
+        return (int) shortcuts.size() - (int) graph[v].size() + contractedNeighbors[v];
+    };
+
+    // priorities only ever change for the neighbors of a contracted node, so they are updated lazily:
+    // a node is looked at again when it comes out of the queue, and put back if it is no longer the best
+    vector<pair<int, int> > queue;
+    for (int v = 0; v < numNodes; v++)
+        queue.push_back(make_pair(priority(v), v));
+    make_heap(queue.begin(), queue.end(), greater<pair<int, int> >());
+
+    vector<bool> contracted(numNodes, false);
+    vector<int> order;
+    order.reserve(numNodes);
+    while (!queue.empty()) {
+        pop_heap(queue.begin(), queue.end(), greater<pair<int, int> >());
+        int v = queue.back().second;
+        queue.pop_back();
+        if (contracted[v])
+            continue;
+        int p = priority(v);
+        if (!queue.empty() && p > queue.front().first) {
+            queue.push_back(make_pair(p, v));
+            push_heap(queue.begin(), queue.end(), greater<pair<int, int> >());
+            continue;
+        }
+
+        // priority(v) has just found v's shortcuts
+        for (const auto& s : shortcuts) {
+            addEdge(graph[get<0>(s)], get<1>(s), get<2>(s));
+            addEdge(graph[get<1>(s)], get<0>(s), get<2>(s));
+        }
+        for (const auto& n : graph[v]) {
+            Neighbors& other = graph[n.first];
+            for (size_t i = 0; i < other.size(); i++) {
+                if (other[i].first == v) {
+                    other[i] = other.back();
+                    other.pop_back();
+                    break;
+                }
+            }
+            contractedNeighbors[n.first]++;
+        }
+        Neighbors().swap(graph[v]);
+        contracted[v] = true;
+        order.push_back(v);
+    }
+    return order;
+}
+
+HubLabels::HubLabels()
+    : m_fingerprint(0)
+{
+}
+
+HubLabels::~HubLabels() = default;
+
+shared_ptr<const HubLabels> HubLabels::build(const MapData& map)
+{
+    TraceSpan span("labels", "build labels");
+    int numNodes = map.nodeCount();
+    vector<int> order = contractionOrder(map);
+
+    TraceSpan pruneSpan("labels", "prune labels");
+    vector<vector<pair<int, double> > > labels(numNodes);
+    vector<double> rootHubDistance(numNodes, INFINITE_DISTANCE);  // by hub, the label of the current root
+    vector<double> distance(numNodes, INFINITE_DISTANCE);
+    vector<int> touched;
+    vector<pair<double, int> > queue;
+    for (int hub = 0; hub < numNodes; hub++) {
+        int root = order[numNodes - 1 - hub];
+        for (const auto& entry : labels[root])
+            rootHubDistance[entry.first] = entry.second;
+
+        distance[root] = 0;
+        touched.push_back(root);
+        queue.push_back(make_pair(0.0, root));
+        while (!queue.empty()) {
+            pop_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+            double d = queue.back().first;
+            int u = queue.back().second;
+            queue.pop_back();
+            if (d > distance[u])
+                continue;
+
+            // a more important hub already lies on a shortest path from the root to u, and so
+            // on the shortest paths to everything beyond u too
+            bool covered = false;
+            for (const auto& entry : labels[u]) {
+                if (rootHubDistance[entry.first] + entry.second <= d) {
+                    covered = true;
+                    break;
+                }
+            }
+            if (covered)
+                continue;
+
+            labels[u].push_back(make_pair(hub, d));
+            for (int e = map.firstEdge[u]; e < map.firstEdge[u + 1]; e++) {
+                int v = map.edgeTarget[e];
+                double newDistance = d + map.edgeLength[e];
+                if (newDistance < distance[v]) {
+                    if (distance[v] == INFINITE_DISTANCE)
+                        touched.push_back(v);
+                    distance[v] = newDistance;
+                    queue.push_back(make_pair(newDistance, v));
+                    push_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+                }
+            }
+        }
+
+        for (int x : touched)
+            distance[x] = INFINITE_DISTANCE;
+        touched.clear();
+        for (const auto& entry : labels[root])
+            rootHubDistance[entry.first] = INFINITE_DISTANCE;
+    }
+
+    // hubs were added in order of importance, so every label is already sorted
+    shared_ptr<HubLabels> result(new HubLabels());
+    result->m_fingerprint = map.fingerprint();
+    result->m_firstEntryStorage.reserve(numNodes + 1);
+    for (int n = 0; n < numNodes; n++) {
+        result->m_firstEntryStorage.push_back(result->m_hubStorage.size());
+        for (const auto& entry : labels[n]) {
+            result->m_hubStorage.push_back(entry.first);
+            result->m_hubDistanceStorage.push_back(entry.second);
+        }
+        vector<pair<int, double> >().swap(labels[n]);
+    }
+    result->m_firstEntryStorage.push_back(result->m_hubStorage.size());
+    result->m_firstEntry = ArrayView<uint32_t>(result->m_firstEntryStorage);
+    result->m_hub = ArrayView<int32_t>(result->m_hubStorage);
+    result->m_hubDistance = ArrayView<double>(result->m_hubDistanceStorage);
+    pruneSpan.arg("entries", result->entryCount());
+    return result;
+}
+
+shared_ptr<const HubLabels> HubLabels::open(const string& labelFile, unsigned long long fingerprint)
+{
+    int fd = ::open(labelFile.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(LabelFileHeader)) {
+        close(fd);
+        return nullptr;
+    }
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return nullptr;
+
+    unique_ptr<MappedLabelFile> file(new MappedLabelFile);
+    file->base = (const char*) base;
+    file->size = st.st_size;
+
+    const LabelFileHeader& h = *(const LabelFileHeader*) file->base;
+    if (memcmp(h.magic, LABEL_FILE_MAGIC, sizeof(h.magic)) != 0 || h.version != LABEL_FILE_VERSION
+        || h.fingerprint != fingerprint)
+        return nullptr;
+
+    // every array has to lie inside the file
+    const size_t elementSize[NUM_LABEL_SECTIONS] = { sizeof(uint32_t), sizeof(int32_t), sizeof(double) };
+    for (int s = 0; s < NUM_LABEL_SECTIONS; s++) {
+        if (h.offset[s] % LABEL_FILE_ALIGNMENT != 0 || h.offset[s] > file->size
+            || h.count[s] > (file->size - h.offset[s]) / elementSize[s])
+            return nullptr;
+    }
+
+    shared_ptr<HubLabels> labels(new HubLabels());
+    const char* b = file->base;
+    labels->m_fingerprint = h.fingerprint;
+    labels->m_firstEntry = ArrayView<uint32_t>((const uint32_t*) (b + h.offset[FIRST_ENTRY]), h.count[FIRST_ENTRY]);
+    labels->m_hub = ArrayView<int32_t>((const int32_t*) (b + h.offset[HUB]), h.count[HUB]);
+    labels->m_hubDistance = ArrayView<double>((const double*) (b + h.offset[HUB_DISTANCE]), h.count[HUB_DISTANCE]);
+
+    // as with tiled maps, only the ends of the arrays are checked, since checking every entry would read the whole file
+    if (labels->m_firstEntry.size() != (size_t) h.numNodes + 1 || labels->m_hubDistance.size() != labels->m_hub.size()
+        || labels->m_firstEntry[h.numNodes] != labels->m_hub.size())
+        return nullptr;
+
+    labels->m_file = move(file);
+    return labels;
+}
+
+// appends an array to the file, starting on a page boundary, and records where it went
+template <typename T>
+static void writeSection(ofstream& out, LabelFileHeader& h, LabelSection s, const ArrayView<T>& v)
+{
+    size_t at = out.tellp();
+    size_t start = (at + LABEL_FILE_ALIGNMENT - 1) / LABEL_FILE_ALIGNMENT * LABEL_FILE_ALIGNMENT;
+    out << string(start - at, '\0');
+    h.offset[s] = start;
+    h.count[s] = v.size();
+    out.write((const char*) v.begin(), v.size() * sizeof(T));
+}
+
+bool HubLabels::save(const string& labelFile) const
+{
+    LabelFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LABEL_FILE_MAGIC, sizeof(h.magic));
+    h.version = LABEL_FILE_VERSION;
+    h.numNodes = nodeCount();
+    h.fingerprint = m_fingerprint;
+
+    // the header is written again once the sections know where they start
+    ofstream out(labelFile, ios::binary | ios::trunc);
+    out.write((const char*) &h, sizeof(h));
+    writeSection(out, h, FIRST_ENTRY, m_firstEntry);
+    writeSection(out, h, HUB, m_hub);
+    writeSection(out, h, HUB_DISTANCE, m_hubDistance);
+    out.seekp(0);
+    out.write((const char*) &h, sizeof(h));
+    return bool(out);
+}
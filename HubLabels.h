@@ -0,0 +1,95 @@
+// HubLabels.h
+
+//  A hub labelling of the street graph: every node keeps a short list of hubs with its distance to each,
+//  chosen so that the shortest path between any two nodes passes through a hub they share
+//  a road distance is then the smallest sum over the shared hubs of the two lists, with no search at all
+
+#ifndef HUBLABELS_H
+#define HUBLABELS_H
+
+#include "MapData.h"
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct MappedLabelFile;
+
+class HubLabels
+{
+public:
+    ~HubLabels();
+
+    // labels every node of the map as it was loaded, so closures and changed weights are ignored
+    // every segment is an edge in both directions, so one label per node serves both directions
+    static std::shared_ptr<const HubLabels> build(const MapData& graph);
+
+    // maps a file written by save into memory; nullptr if it isn't one, or was written for another map
+    static std::shared_ptr<const HubLabels> open(const std::string& labelFile, unsigned long long fingerprint);
+    bool save(const std::string& labelFile) const;
+
+    // the road distance between two nodes, infinity if they aren't connected
+    double distance(int node1, int node2) const
+    {
+        // both labels are sorted by hub, so they are merged like two sorted lists; which list moves on
+        // is computed rather than branched on, since the branch would be mispredicted half the time
+        const int32_t* hub = m_hub.begin();
+        const double* hubDistance = m_hubDistance.begin();
+        uint32_t i = m_firstEntry[node1], iEnd = m_firstEntry[node1 + 1];
+        uint32_t j = m_firstEntry[node2], jEnd = m_firstEntry[node2 + 1];
+        double best = std::numeric_limits<double>::infinity();
+        while (i < iEnd && j < jEnd) {
+            int32_t a = hub[i];
+            int32_t b = hub[j];
+            if (a == b) {
+                double d = hubDistance[i] + hubDistance[j];
+                if (d < best)
+                    best = d;
+            }
+            i += a <= b;
+            j += b <= a;
+        }
+        return best;
+    }
+
+    unsigned long long fingerprint() const
+    {
+        return m_fingerprint;
+    }
+
+    int nodeCount() const
+    {
+        return m_firstEntry.empty() ? 0 : m_firstEntry.size() - 1;
+    }
+
+    // the hubs of all the labels together
+    size_t entryCount() const
+    {
+        return m_hub.size();
+    }
+
+    // C++11 syntax for preventing copying and assignment
+    HubLabels(const HubLabels&) = delete;
+    HubLabels& operator=(const HubLabels&) = delete;
+
+private:
+    HubLabels();
+
+    unsigned long long m_fingerprint;
+
+    // the label of node n is entries m_firstEntry[n] up to m_firstEntry[n + 1]; hubs are numbered by
+    // importance, most important first, and kept apart from their distances so a merge only reads hubs
+    ArrayView<uint32_t> m_firstEntry;
+    ArrayView<int32_t> m_hub;
+    ArrayView<double> m_hubDistance;
+
+    // a built labelling owns its arrays, an opened one points into its mapped file
+    std::vector<uint32_t> m_firstEntryStorage;
+    std::vector<int32_t> m_hubStorage;
+    std::vector<double> m_hubDistanceStorage;
+    std::unique_ptr<MappedLabelFile> m_file;
+};
+
+
+#endif // HUBLABELS_H
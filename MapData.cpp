@@ -0,0 +1,560 @@
+#include "provided.h"
+#include "MapData.h"
+#include "HilbertCurve.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+/*
+ A tiled map file holds the same arrays as a map held in memory, each starting on a page boundary,
+ and is mapped into memory rather than read. Because nodes are numbered along a Hilbert curve, the
+ nodes of a tile (and their edges and chains, which are grouped by node) are a contiguous stretch of
+ every array, and the operating system reads those pages in when a search first touches them.
+ Opening a tiled map only reads its header, so it takes the same time however big the map is.
+
+ The TileCache decides which tiles stay in memory. A search reports every node it settles, which
+ marks the node's tile as used; the first use of a tile reads the whole tile in at once, and when
+ the tiles in memory take up more than the memory budget, the least recently used ones are dropped.
+ Dropping a tile only discards pages which are unchanged copies of the file, so a search which is
+ still reading one just has the pages read in again. The budget counts the tiles themselves; the
+ few pages a coordinate lookup reads outside of them are not counted, and neither are the pages a
+ search reads again from a tile dropped while it ran, so a single search covering more of the map
+ than the budget can briefly hold more than the budget in memory.
+ */
+
+const char TILE_FILE_MAGIC[8] = { 'G', 'O', 'O', 'B', 'T', 'I', 'L', 'E' };
+const unsigned int TILE_FILE_VERSION = 2;
+const size_t TILE_FILE_ALIGNMENT = 4096;
+
+enum TileSection
+{
+    NODE_KEY, COORD_OFFSET, COORD_TEXT, NODE_COMPONENT,
+    FIRST_EDGE, EDGE_SOURCE, EDGE_TARGET, EDGE_STREET, EDGE_LENGTH, EDGE_CHAIN,
+    FIRST_CHAIN, CHAIN_SOURCE, CHAIN_TARGET, CHAIN_FIRST_EDGE, CHAIN_EDGES, CHAIN_LENGTH,
+    MID_CHAIN, MID_CHAIN_OFFSET, STREET_OFFSET, STREET_TEXT, TILE_BOX,
+    NUM_TILE_SECTIONS
+};
+
+struct TileFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t tileShift;
+    uint32_t numNodes;
+    uint32_t unused;
+    double minLat, minLon, maxLat, maxLon;      // the box the Hilbert curve numbering the nodes covers
+    uint64_t fingerprint;                       // of the map the file was written from
+    uint64_t offset[NUM_TILE_SECTIONS];         // where each array starts in the file
+    uint64_t count[NUM_TILE_SECTIONS];          // how many elements it has
+};
+
+struct MappedTileFile
+{
+    const char* base;
+    size_t size;
+
+    ~MappedTileFile()
+    {
+        munmap(const_cast<char*>(base), size);
+    }
+};
+
+// when a page of the file is first touched, the operating system also maps the pages around it (within
+// a block of this size) which it has already read, and those may belong to the tiles next door
+const uintptr_t FAULT_AROUND_BYTES = 64 << 10;
+
+// asks the operating system to read in (or drop) the pages covering part of the file
+// drops cover the whole blocks around the range, so that no pages mapped along with the tile are left behind;
+// a neighboring tile still in use which loses a page just has it mapped again, from memory
+static void advise(const char* start, size_t length, int advice)
+{
+    uintptr_t block = advice == MADV_DONTNEED ? FAULT_AROUND_BYTES : sysconf(_SC_PAGESIZE);
+    uintptr_t from = (uintptr_t) start / block * block;
+    uintptr_t to = ((uintptr_t) start + length + block - 1) / block * block;
+    if (to > from)
+        madvise((void*) from, to - from, advice);
+}
+
+// FNV-1a, fed the map one piece at a time
+class Fingerprint
+{
+public:
+    Fingerprint()
+        : m_hash(14695981039346656037ULL)
+    {}
+
+    void add(const void* data, size_t length)
+    {
+        const unsigned char* p = (const unsigned char*) data;
+        for (size_t i = 0; i < length; i++) {
+            m_hash ^= p[i];
+            m_hash *= 1099511628211ULL;
+        }
+    }
+
+    // strings are followed by their length, so that "ab" + "c" and "a" + "bc" differ
+    void add(const string& s)
+    {
+        add(s.data(), s.size());
+        size_t length = s.size();
+        add(&length, sizeof(length));
+    }
+
+    unsigned long long value() const
+    {
+        return m_hash;
+    }
+
+private:
+    unsigned long long m_hash;
+};
+
+MapData::MapData()
+    : m_numNodes(0), m_fingerprint(0)
+{
+}
+
+MapData::MapData(unique_ptr<MapArrays> arrays)
+    : m_numNodes(arrays->nodes.size()), m_arrays(move(arrays))
+{
+    firstEdge = m_arrays->firstEdge;
+    edgeSource = m_arrays->edgeSource;
+    edgeTarget = m_arrays->edgeTarget;
+    edgeStreet = m_arrays->edgeStreet;
+    edgeLength = m_arrays->edgeLength;
+    nodeComponent = m_arrays->nodeComponent;
+    firstChain = m_arrays->firstChain;
+    chainSource = m_arrays->chainSource;
+    chainTarget = m_arrays->chainTarget;
+    chainFirstEdge = m_arrays->chainFirstEdge;
+    chainEdges = m_arrays->chainEdges;
+    chainLength = m_arrays->chainLength;
+    edgeChain = m_arrays->edgeChain;
+    midChain = m_arrays->midChain;
+    midChainOffset = m_arrays->midChainOffset;
+
+    // everything else in a map is worked out from these
+    Fingerprint f;
+    for (const auto& gc : m_arrays->nodes) {
+        f.add(gc.latitudeText);
+        f.add(gc.longitudeText);
+    }
+    f.add(edgeSource.begin(), edgeSource.size() * sizeof(int));
+    f.add(edgeTarget.begin(), edgeTarget.size() * sizeof(int));
+    f.add(edgeStreet.begin(), edgeStreet.size() * sizeof(int));
+    for (const auto& name : m_arrays->streetNames)
+        f.add(name);
+    m_fingerprint = f.value();
+}
+
+MapData::~MapData()
+{
+    // the tile cache goes before the file it keeps track of
+    m_tiles.reset();
+}
+
+GeoCoord MapData::node(int n) const
+{
+    if (m_arrays != nullptr)
+        return m_arrays->nodes[n];
+    const char* text = m_coordText.begin();
+    return GeoCoord(string(text + m_coordOffset[2 * n], text + m_coordOffset[2 * n + 1]),
+                    string(text + m_coordOffset[2 * n + 1], text + m_coordOffset[2 * n + 2]));
+}
+
+void MapData::location(int n, double& latitude, double& longitude) const
+{
+    if (m_arrays != nullptr) {
+        latitude = m_arrays->nodes[n].latitude;
+        longitude = m_arrays->nodes[n].longitude;
+        return;
+    }
+
+    // the texts of the coordinates run into each other, so each is copied out to be read on its own
+    const char* text = m_coordText.begin();
+    char number[64];
+    for (int i = 0; i < 2; i++) {
+        size_t length = min<size_t>(sizeof(number) - 1, m_coordOffset[2 * n + i + 1] - m_coordOffset[2 * n + i]);
+        memcpy(number, text + m_coordOffset[2 * n + i], length);
+        number[length] = '\0';
+        (i == 0 ? latitude : longitude) = strtod(number, nullptr);
+    }
+}
+
+string MapData::streetName(int street) const
+{
+    if (m_arrays != nullptr)
+        return m_arrays->streetNames[street];
+    const char* text = m_streetText.begin();
+    return string(text + m_streetOffset[street], text + m_streetOffset[street + 1]);
+}
+
+int MapData::nodeOf(const GeoCoord& gc) const
+{
+    if (m_arrays != nullptr) {
+        const int* n = m_arrays->coordToNode.find(gc);
+        return n == nullptr ? -1 : *n;
+    }
+
+    // the nodes are in Hilbert curve order, so the nodes in gc's cell of the curve's grid are next to each other
+    unsigned long long key = m_grid.index(gc);
+    auto range = equal_range(m_nodeKey.begin(), m_nodeKey.end(), key);
+    for (auto k = range.first; k != range.second; k++) {
+        int n = k - m_nodeKey.begin();
+        const char* text = m_coordText.begin();
+        if (gc.latitudeText.compare(0, string::npos, text + m_coordOffset[2 * n], m_coordOffset[2 * n + 1] - m_coordOffset[2 * n]) == 0
+            && gc.longitudeText.compare(0, string::npos, text + m_coordOffset[2 * n + 1], m_coordOffset[2 * n + 2] - m_coordOffset[2 * n + 1]) == 0)
+            return n;
+    }
+    return -1;
+}
+
+//******************** Tiled map files ****************************************
+
+bool MapData::isTileFile(const string& file)
+{
+    ifstream in(file, ios::binary);
+    char magic[sizeof(TILE_FILE_MAGIC)];
+    return in.read(magic, sizeof(magic)) && memcmp(magic, TILE_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+shared_ptr<MapData> MapData::openTiles(const string& tileFile, size_t memoryBudget)
+{
+    int fd = open(tileFile.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(TileFileHeader)) {
+        close(fd);
+        return nullptr;
+    }
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return nullptr;
+
+    // pages are read in a tile at a time, so reading ahead of a fault would only pull in other tiles
+    madvise(base, st.st_size, MADV_RANDOM);
+
+    unique_ptr<MappedTileFile> file(new MappedTileFile);
+    file->base = (const char*) base;
+    file->size = st.st_size;
+
+    const TileFileHeader& h = *(const TileFileHeader*) file->base;
+    if (memcmp(h.magic, TILE_FILE_MAGIC, sizeof(h.magic)) != 0 || h.version != TILE_FILE_VERSION
+        || h.tileShift != (uint32_t) TILE_SHIFT)
+        return nullptr;
+
+    // every array has to lie inside the file
+    const size_t elementSize[NUM_TILE_SECTIONS] = {
+        sizeof(unsigned long long), sizeof(unsigned int), sizeof(char), sizeof(int),
+        sizeof(int), sizeof(int), sizeof(int), sizeof(int), sizeof(double), sizeof(int),
+        sizeof(int), sizeof(int), sizeof(int), sizeof(int), sizeof(int), sizeof(double),
+        sizeof(int), sizeof(int), sizeof(unsigned int), sizeof(char), sizeof(double)
+    };
+    for (int s = 0; s < NUM_TILE_SECTIONS; s++) {
+        if (h.offset[s] % TILE_FILE_ALIGNMENT != 0 || h.offset[s] > file->size
+            || h.count[s] > (file->size - h.offset[s]) / elementSize[s])
+            return nullptr;
+    }
+
+    shared_ptr<MapData> data(new MapData());
+    const char* b = file->base;
+    data->m_numNodes = h.numNodes;
+    data->m_fingerprint = h.fingerprint;
+    data->m_nodeKey = ArrayView<unsigned long long>((const unsigned long long*) (b + h.offset[NODE_KEY]), h.count[NODE_KEY]);
+    data->m_coordOffset = ArrayView<unsigned int>((const unsigned int*) (b + h.offset[COORD_OFFSET]), h.count[COORD_OFFSET]);
+    data->m_coordText = ArrayView<char>(b + h.offset[COORD_TEXT], h.count[COORD_TEXT]);
+    data->nodeComponent = ArrayView<int>((const int*) (b + h.offset[NODE_COMPONENT]), h.count[NODE_COMPONENT]);
+    data->firstEdge = ArrayView<int>((const int*) (b + h.offset[FIRST_EDGE]), h.count[FIRST_EDGE]);
+    data->edgeSource = ArrayView<int>((const int*) (b + h.offset[EDGE_SOURCE]), h.count[EDGE_SOURCE]);
+    data->edgeTarget = ArrayView<int>((const int*) (b + h.offset[EDGE_TARGET]), h.count[EDGE_TARGET]);
+    data->edgeStreet = ArrayView<int>((const int*) (b + h.offset[EDGE_STREET]), h.count[EDGE_STREET]);
+    data->edgeLength = ArrayView<double>((const double*) (b + h.offset[EDGE_LENGTH]), h.count[EDGE_LENGTH]);
+    data->edgeChain = ArrayView<int>((const int*) (b + h.offset[EDGE_CHAIN]), h.count[EDGE_CHAIN]);
+    data->firstChain = ArrayView<int>((const int*) (b + h.offset[FIRST_CHAIN]), h.count[FIRST_CHAIN]);
+    data->chainSource = ArrayView<int>((const int*) (b + h.offset[CHAIN_SOURCE]), h.count[CHAIN_SOURCE]);
+    data->chainTarget = ArrayView<int>((const int*) (b + h.offset[CHAIN_TARGET]), h.count[CHAIN_TARGET]);
+    data->chainFirstEdge = ArrayView<int>((const int*) (b + h.offset[CHAIN_FIRST_EDGE]), h.count[CHAIN_FIRST_EDGE]);
+    data->chainEdges = ArrayView<int>((const int*) (b + h.offset[CHAIN_EDGES]), h.count[CHAIN_EDGES]);
+    data->chainLength = ArrayView<double>((const double*) (b + h.offset[CHAIN_LENGTH]), h.count[CHAIN_LENGTH]);
+    data->midChain = ArrayView<int>((const int*) (b + h.offset[MID_CHAIN]), h.count[MID_CHAIN]);
+    data->midChainOffset = ArrayView<int>((const int*) (b + h.offset[MID_CHAIN_OFFSET]), h.count[MID_CHAIN_OFFSET]);
+    data->m_streetOffset = ArrayView<unsigned int>((const unsigned int*) (b + h.offset[STREET_OFFSET]), h.count[STREET_OFFSET]);
+    data->m_streetText = ArrayView<char>(b + h.offset[STREET_TEXT], h.count[STREET_TEXT]);
+    data->m_tileBox = ArrayView<double>((const double*) (b + h.offset[TILE_BOX]), h.count[TILE_BOX]);
+
+    // the arrays have to agree about how many nodes, edges and chains there are; only their ends are
+    // checked, since checking every entry would mean reading the whole file
+    size_t n = h.numNodes;
+    size_t edges = data->edgeSource.size();
+    size_t chains = data->chainSource.size();
+    if (data->m_nodeKey.size() != n || data->m_coordOffset.size() != 2 * n + 1 || data->nodeComponent.size() != n
+        || data->firstEdge.size() != n + 1 || data->edgeTarget.size() != edges || data->edgeStreet.size() != edges
+        || data->edgeLength.size() != edges || data->edgeChain.size() != edges || data->firstChain.size() != n + 1
+        || data->chainTarget.size() != chains || data->chainFirstEdge.size() != chains + 1
+        || data->chainLength.size() != chains || data->midChain.size() != 2 * n || data->midChainOffset.size() != 2 * n
+        || data->m_streetOffset.empty() || data->m_tileBox.size() != 4 * (size_t) data->tileCount()
+        || (size_t) data->firstEdge[n] != edges || (size_t) data->firstChain[n] != chains
+        || (size_t) data->chainFirstEdge[chains] != data->chainEdges.size()
+        || data->m_coordOffset[2 * n] > data->m_coordText.size()
+        || data->m_streetOffset[data->m_streetOffset.size() - 1] > data->m_streetText.size())
+        return nullptr;
+
+    data->m_grid = HilbertGrid(h.minLat, h.minLon, h.maxLat, h.maxLon);
+    data->m_file = move(file);
+    data->m_tiles.reset(new TileCache(*data, memoryBudget));
+    return data;
+}
+
+// appends an array to the file, starting on a page boundary, and records where it went
+template <typename T>
+static void writeSection(ofstream& out, TileFileHeader& h, TileSection s, const T* data, size_t count)
+{
+    size_t at = out.tellp();
+    size_t start = (at + TILE_FILE_ALIGNMENT - 1) / TILE_FILE_ALIGNMENT * TILE_FILE_ALIGNMENT;
+    out << string(start - at, '\0');
+    h.offset[s] = start;
+    h.count[s] = count;
+    out.write((const char*) data, count * sizeof(T));
+}
+
+template <typename T>
+static void writeSection(ofstream& out, TileFileHeader& h, TileSection s, const ArrayView<T>& v)
+{
+    writeSection(out, h, s, v.begin(), v.size());
+}
+
+template <typename T>
+static void writeSection(ofstream& out, TileFileHeader& h, TileSection s, const vector<T>& v)
+{
+    writeSection(out, h, s, v.data(), v.size());
+}
+
+bool MapData::saveTiles(const string& tileFile) const
+{
+    int n = nodeCount();
+    vector<GeoCoord> coords;
+    coords.reserve(n);
+    for (int i = 0; i < n; i++)
+        coords.push_back(node(i));
+
+    // the same grid over the same box that the nodes were numbered with
+    TileFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TILE_FILE_MAGIC, sizeof(h.magic));
+    h.version = TILE_FILE_VERSION;
+    h.tileShift = TILE_SHIFT;
+    h.numNodes = n;
+    h.fingerprint = fingerprint();
+    if (n > 0) {
+        h.minLat = h.maxLat = coords[0].latitude;
+        h.minLon = h.maxLon = coords[0].longitude;
+    }
+    for (const auto& gc : coords) {
+        h.minLat = min(h.minLat, gc.latitude);
+        h.maxLat = max(h.maxLat, gc.latitude);
+        h.minLon = min(h.minLon, gc.longitude);
+        h.maxLon = max(h.maxLon, gc.longitude);
+    }
+    HilbertGrid grid(h.minLat, h.minLon, h.maxLat, h.maxLon);
+
+    vector<unsigned long long> keys(n);
+    vector<unsigned int> coordOffset;
+    string coordText;
+    for (int i = 0; i < n; i++) {
+        keys[i] = grid.index(coords[i]);
+        coordOffset.push_back(coordText.size());
+        coordText += coords[i].latitudeText;
+        coordOffset.push_back(coordText.size());
+        coordText += coords[i].longitudeText;
+    }
+    coordOffset.push_back(coordText.size());
+
+    // coordinates are looked up by their position on the curve, so the nodes have to be in curve order
+    if (!is_sorted(keys.begin(), keys.end()) || coordText.size() > UINT32_MAX)
+        return false;
+
+    int numStreets = m_arrays != nullptr ? m_arrays->streetNames.size() : m_streetOffset.size() - 1;
+    vector<unsigned int> streetOffset;
+    string streetText;
+    for (int s = 0; s < numStreets; s++) {
+        streetOffset.push_back(streetText.size());
+        streetText += streetName(s);
+    }
+    streetOffset.push_back(streetText.size());
+    if (streetText.size() > UINT32_MAX)
+        return false;
+
+    vector<double> tileBox;
+    for (int t = 0; t < tileCount(); t++) {
+        int first = t << TILE_SHIFT;
+        int last = min(n, first + (1 << TILE_SHIFT));
+        double box[4] = { coords[first].latitude, coords[first].longitude, coords[first].latitude, coords[first].longitude };
+        for (int i = first; i < last; i++) {
+            box[0] = min(box[0], coords[i].latitude);
+            box[1] = min(box[1], coords[i].longitude);
+            box[2] = max(box[2], coords[i].latitude);
+            box[3] = max(box[3], coords[i].longitude);
+        }
+        tileBox.insert(tileBox.end(), box, box + 4);
+    }
+
+    ofstream out(tileFile, ios::binary | ios::trunc);
+    if (!out)
+        return false;
+    out.write((const char*) &h, sizeof(h));
+    writeSection(out, h, NODE_KEY, keys);
+    writeSection(out, h, COORD_OFFSET, coordOffset);
+    writeSection(out, h, COORD_TEXT, coordText.data(), coordText.size());
+    writeSection(out, h, NODE_COMPONENT, nodeComponent);
+    writeSection(out, h, FIRST_EDGE, firstEdge);
+    writeSection(out, h, EDGE_SOURCE, edgeSource);
+    writeSection(out, h, EDGE_TARGET, edgeTarget);
+    writeSection(out, h, EDGE_STREET, edgeStreet);
+    writeSection(out, h, EDGE_LENGTH, edgeLength);
+    writeSection(out, h, EDGE_CHAIN, edgeChain);
+    writeSection(out, h, FIRST_CHAIN, firstChain);
+    writeSection(out, h, CHAIN_SOURCE, chainSource);
+    writeSection(out, h, CHAIN_TARGET, chainTarget);
+    writeSection(out, h, CHAIN_FIRST_EDGE, chainFirstEdge);
+    writeSection(out, h, CHAIN_EDGES, chainEdges);
+    writeSection(out, h, CHAIN_LENGTH, chainLength);
+    writeSection(out, h, MID_CHAIN, midChain);
+    writeSection(out, h, MID_CHAIN_OFFSET, midChainOffset);
+    writeSection(out, h, STREET_OFFSET, streetOffset);
+    writeSection(out, h, STREET_TEXT, streetText.data(), streetText.size());
+    writeSection(out, h, TILE_BOX, tileBox);
+
+    // now that we know where everything went, write the header again
+    out.seekp(0);
+    out.write((const char*) &h, sizeof(h));
+    return bool(out);
+}
+
+void MapData::tileRanges(int tile, vector<pair<const char*, size_t> >& ranges) const
+{
+    int first = tile << TILE_SHIFT;
+    int last = min(m_numNodes, first + (1 << TILE_SHIFT));
+    int firstChainOfTile = firstChain[first];
+    int lastChainOfTile = firstChain[last];
+
+    ranges.clear();
+    auto add = [&](const auto& array, size_t from, size_t to) {
+        ranges.push_back(make_pair((const char*) (array.begin() + from), (to - from) * sizeof(array[0])));
+    };
+    add(m_nodeKey, first, last);
+    add(m_coordOffset, 2 * first, 2 * last + 1);
+    add(m_coordText, m_coordOffset[2 * first], m_coordOffset[2 * last]);
+    add(nodeComponent, first, last);
+    add(firstEdge, first, last + 1);
+    add(edgeSource, firstEdge[first], firstEdge[last]);
+    add(edgeTarget, firstEdge[first], firstEdge[last]);
+    add(edgeStreet, firstEdge[first], firstEdge[last]);
+    add(edgeLength, firstEdge[first], firstEdge[last]);
+    add(edgeChain, firstEdge[first], firstEdge[last]);
+    add(firstChain, first, last + 1);
+    add(chainSource, firstChainOfTile, lastChainOfTile);
+    add(chainTarget, firstChainOfTile, lastChainOfTile);
+    add(chainFirstEdge, firstChainOfTile, lastChainOfTile + 1);
+    add(chainEdges, chainFirstEdge[firstChainOfTile], chainFirstEdge[lastChainOfTile]);
+    add(chainLength, firstChainOfTile, lastChainOfTile);
+    add(midChain, 2 * first, 2 * last);
+    add(midChainOffset, 2 * first, 2 * last);
+}
+
+void MapData::prefetch(double minLat, double minLon, double maxLat, double maxLon) const
+{
+    if (m_tiles == nullptr)
+        return;
+    for (int t = 0; t < tileCount(); t++) {
+        const double* box = &m_tileBox[4 * t];
+        if (box[0] <= maxLat && box[2] >= minLat && box[1] <= maxLon && box[3] >= minLon)
+            m_tiles->use(t);
+    }
+}
+
+void MapData::setMemoryBudget(size_t bytes) const
+{
+    if (m_tiles != nullptr)
+        m_tiles->setMemoryBudget(bytes);
+}
+
+size_t MapData::residentBytes() const
+{
+    return m_tiles != nullptr ? m_tiles->residentBytes() : 0;
+}
+
+//******************** TileCache functions ************************************
+
+TileCache::TileCache(const MapData& data, size_t memoryBudget)
+    : m_data(data), m_resident(data.tileCount()), m_lastUse(data.tileCount()), m_tileBytes(data.tileCount(), 0),
+      m_clock(0), m_residentBytes(0), m_budget(memoryBudget)
+{
+}
+
+void TileCache::load(int tile)
+{
+    vector<pair<const char*, size_t> > ranges;
+    m_data.tileRanges(tile, ranges);
+
+    lock_guard<mutex> lock(m_mutex);
+    if (m_resident[tile].load(memory_order_relaxed))
+        return;
+
+    // read the whole tile in now, rather than a page at a time as the search gets to it
+    size_t bytes = 0;
+    for (const auto& r : ranges) {
+        advise(r.first, r.second, MADV_WILLNEED);
+        bytes += r.second;
+    }
+    m_tileBytes[tile] = bytes;
+    m_residentBytes += bytes;
+    m_lastUse[tile].store(m_clock.fetch_add(1, memory_order_relaxed) + 1, memory_order_relaxed);
+    m_resident[tile].store(true, memory_order_relaxed);
+
+    dropOverBudget(tile);
+}
+
+void TileCache::setMemoryBudget(size_t bytes)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_budget = bytes;
+    dropOverBudget(-1);
+}
+
+size_t TileCache::residentBytes() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_residentBytes;
+}
+
+void TileCache::dropOverBudget(int keep)
+{
+    vector<pair<const char*, size_t> > ranges;
+    while (m_residentBytes > m_budget) {
+        // the least recently used tile, other than the one just read in
+        int oldest = -1;
+        for (int t = 0; t < (int) m_resident.size(); t++) {
+            if (t != keep && m_resident[t].load(memory_order_relaxed)
+                && (oldest < 0 || m_lastUse[t].load(memory_order_relaxed) < m_lastUse[oldest].load(memory_order_relaxed)))
+                oldest = t;
+        }
+        if (oldest < 0)
+            return;
+
+        m_data.tileRanges(oldest, ranges);
+        for (const auto& r : ranges)
+            advise(r.first, r.second, MADV_DONTNEED);
+        m_resident[oldest].store(false, memory_order_relaxed);
+        m_residentBytes -= m_tileBytes[oldest];
+    }
+}
@@ -0,0 +1,303 @@
+// MapData.h
+
+//  The street graph read from a map file, shared by every snapshot taken since the last load
+//  a map is either read from a text map file and held in memory, or opened from a tiled map file,
+//  in which case each tile is only read from disk once a search reaches it
+
+#ifndef MAPDATA_H
+#define MAPDATA_H
+
+#include "provided.h"
+#include "ExpandableHashMap.h"
+#include "HilbertCurve.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// nodes are numbered along a Hilbert curve, so the 2^TILE_SHIFT nodes of a tile are a compact patch of the map
+const int TILE_SHIFT = 12;
+
+// how much memory the tiles of a tiled map may take up, unless told otherwise
+const size_t DEFAULT_MEMORY_BUDGET = 256 << 20;
+
+// a read-only array, which may live in a vector or in a mapped file
+template <typename T>
+class ArrayView
+{
+public:
+    ArrayView()
+        : m_data(nullptr), m_size(0)
+    {}
+
+    ArrayView(const T* data, size_t size)
+        : m_data(data), m_size(size)
+    {}
+
+    ArrayView(const std::vector<T>& v)
+        : m_data(v.data()), m_size(v.size())
+    {}
+
+    const T& operator[](size_t i) const
+    {
+        return m_data[i];
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    const T* begin() const
+    {
+        return m_data;
+    }
+
+    const T* end() const
+    {
+        return m_data + m_size;
+    }
+
+private:
+    const T* m_data;
+    size_t m_size;
+};
+
+// the arrays of a map while it is built from a text map file; MapData describes what they hold
+struct MapArrays
+{
+    ExpandableHashMap<GeoCoord, int> coordToNode;
+    std::vector<GeoCoord> nodes;
+    std::vector<int> firstEdge;
+    std::vector<int> edgeSource;
+    std::vector<int> edgeTarget;
+    std::vector<int> edgeStreet;
+    std::vector<double> edgeLength;
+    std::vector<std::string> streetNames;
+    std::vector<int> nodeComponent;
+    std::vector<int> firstChain;
+    std::vector<int> chainSource;
+    std::vector<int> chainTarget;
+    std::vector<int> chainFirstEdge;
+    std::vector<int> chainEdges;
+    std::vector<double> chainLength;
+    std::vector<int> edgeChain;
+    std::vector<int> midChain;
+    std::vector<int> midChainOffset;
+};
+
+class TileCache;
+class RouteCache;
+struct MappedTileFile;
+
+// every distinct coordinate is a node numbered from 0, and every directed street segment is an edge
+// the edges leaving node n are numbered firstEdge[n] up to (but not including) firstEdge[n + 1]
+class MapData
+{
+public:
+    // a map built from a text map file, held entirely in memory
+    MapData(std::unique_ptr<MapArrays> arrays);
+
+    // opens a tiled map file written by saveTiles, reading nothing but its header
+    // returns nullptr if the file isn't a tiled map file, or is damaged
+    static std::shared_ptr<MapData> openTiles(const std::string& tileFile, size_t memoryBudget);
+
+    // true if the file starts the way a tiled map file does
+    static bool isTileFile(const std::string& file);
+
+    ~MapData();
+
+    // writes the map as a tiled map file
+    bool saveTiles(const std::string& tileFile) const;
+
+    ArrayView<int> firstEdge;           // one entry per node, plus one past the end
+    ArrayView<int> edgeSource;          // the node each edge starts at
+    ArrayView<int> edgeTarget;          // the node each edge ends at
+    ArrayView<int> edgeStreet;          // the street each edge is part of
+    ArrayView<double> edgeLength;       // in miles
+    ArrayView<int> nodeComponent;       // the connected piece of the map each node is in
+
+    // the graph the router searches, in which every run of nodes that only lead from one neighbor
+    // to the next (the middle of a street between two intersections) is collapsed into the ends of
+    // the run, so every edge of it is a chain of segments from one chain end to another
+    ArrayView<int> firstChain;          // like firstEdge, except that nodes in the middle of a chain have none
+    ArrayView<int> chainSource;
+    ArrayView<int> chainTarget;
+    ArrayView<int> chainFirstEdge;      // chain c is the edges chainEdges[chainFirstEdge[c]] up to chainFirstEdge[c + 1]
+    ArrayView<int> chainEdges;
+    ArrayView<double> chainLength;      // in miles, the lengths of its edges added up in order
+    ArrayView<int> edgeChain;           // the chain every edge is part of
+
+    // a node in the middle of chains lies on exactly two of them, one each way; for every node these
+    // hold the two chains and how many edges of each come before the node, or -1 for chain ends
+    ArrayView<int> midChain;
+    ArrayView<int> midChainOffset;
+
+    int nodeCount() const
+    {
+        return m_numNodes;
+    }
+
+    // a hash of the map's coordinates, segments and street names, which tells whether node and edge
+    // numbers from another run mean the same thing on this map
+    unsigned long long fingerprint() const
+    {
+        return m_fingerprint;
+    }
+
+    // the coordinate of a node
+    GeoCoord node(int n) const;
+
+    // the latitude and longitude of a node as numbers, without making a GeoCoord
+    void location(int n, double& latitude, double& longitude) const;
+
+    std::string streetName(int street) const;
+
+    // returns the node at gc, or -1 if gc isn't on the map
+    int nodeOf(const GeoCoord& gc) const;
+
+    // false means there is certainly no route between the two nodes; true means there was one
+    // before any roads were closed, but closures may since have cut it
+    bool mayBeConnected(int node1, int node2) const
+    {
+        return nodeComponent[node1] == nodeComponent[node2];
+    }
+
+    bool isChainEnd(int node) const
+    {
+        return midChain[2 * node] < 0;
+    }
+
+    // how many edges of the chain come before a node in the middle of it
+    int offsetOnChain(int node, int chain) const
+    {
+        return midChain[2 * node] == chain ? midChainOffset[2 * node] : midChainOffset[2 * node + 1];
+    }
+
+    int chainEdgeCount(int chain) const
+    {
+        return chainFirstEdge[chain + 1] - chainFirstEdge[chain];
+    }
+
+    StreetSegment segment(int edge) const
+    {
+        return StreetSegment(node(edgeSource[edge]), node(edgeTarget[edge]), streetName(edgeStreet[edge]));
+    }
+
+    // searches call this for every node they settle, so that the tile it is in is read in (if it
+    // isn't already) and isn't the next one dropped; it does nothing for maps held in memory
+    void useNode(int node) const;
+
+    // a hint that searches will soon cover this area, so its tiles are read in ahead of time
+    void prefetch(double minLat, double minLon, double maxLat, double maxLon) const;
+
+    // the most memory the tiles in memory may take up; the least recently used tiles beyond it are dropped
+    void setMemoryBudget(size_t bytes) const;
+
+    // how much memory the tiles in memory take up, or 0 for maps held entirely in memory
+    size_t residentBytes() const;
+
+    // the routes found on this map in earlier runs, or nullptr if no route cache is in use
+    std::shared_ptr<RouteCache> routeCache() const
+    {
+        return std::atomic_load(&m_routeCache);
+    }
+
+    void setRouteCache(std::shared_ptr<RouteCache> cache) const
+    {
+        std::atomic_store(&m_routeCache, cache);
+    }
+
+    // C++11 syntax for preventing copying and assignment
+    MapData(const MapData&) = delete;
+    MapData& operator=(const MapData&) = delete;
+
+private:
+    MapData();
+
+    int m_numNodes;
+    unsigned long long m_fingerprint;
+    mutable std::shared_ptr<RouteCache> m_routeCache;
+
+    // a map read from a text file owns its arrays
+    std::unique_ptr<MapArrays> m_arrays;
+
+    // a tiled map keeps its coordinates and street names as text, and finds coordinates by their
+    // position on the Hilbert curve the nodes are numbered along
+    std::unique_ptr<MappedTileFile> m_file;
+    std::unique_ptr<TileCache> m_tiles;
+    HilbertGrid m_grid;
+    ArrayView<unsigned long long> m_nodeKey;    // the Hilbert curve position of every node, in order
+    ArrayView<unsigned int> m_coordOffset;      // node n's latitude and longitude text start at m_coordText[m_coordOffset[2n]] and [2n + 1]
+    ArrayView<char> m_coordText;
+    ArrayView<unsigned int> m_streetOffset;
+    ArrayView<char> m_streetText;
+    ArrayView<double> m_tileBox;                // the bounding box of every tile, as min and max latitude and longitude
+
+    int tileCount() const
+    {
+        return (m_numNodes + (1 << TILE_SHIFT) - 1) >> TILE_SHIFT;
+    }
+
+    // the parts of the file holding one tile, as (start, length) pairs
+    void tileRanges(int tile, std::vector<std::pair<const char*, size_t> >& ranges) const;
+
+    friend class TileCache;
+};
+
+// keeps track of which tiles of a tiled map are in memory, dropping the least recently used ones
+// when they take up more than the memory budget
+class TileCache
+{
+public:
+    TileCache(const MapData& data, size_t memoryBudget);
+
+    // cheap when the tile is already in memory, which is almost always
+    void use(int tile)
+    {
+        if (!m_resident[tile].load(std::memory_order_relaxed))
+            load(tile);
+        unsigned int now = m_clock.load(std::memory_order_relaxed);
+        if (m_lastUse[tile].load(std::memory_order_relaxed) != now)
+            m_lastUse[tile].store(now, std::memory_order_relaxed);
+    }
+
+    void setMemoryBudget(size_t bytes);
+
+    size_t residentBytes() const;
+
+    // C++11 syntax for preventing copying and assignment
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+private:
+    const MapData& m_data;
+    std::vector<std::atomic<bool> > m_resident;
+    std::vector<std::atomic<unsigned int> > m_lastUse;
+    std::vector<size_t> m_tileBytes;
+
+    // advances every time a tile is read in, so the tile with the smallest m_lastUse is the least recently used
+    std::atomic<unsigned int> m_clock;
+
+    mutable std::mutex m_mutex;     // held while reading tiles in and dropping them
+    size_t m_residentBytes;
+    size_t m_budget;
+
+    void load(int tile);
+    void dropOverBudget(int keep);
+};
+
+inline void MapData::useNode(int node) const
+{
+    if (m_tiles != nullptr)
+        m_tiles->use(node >> TILE_SHIFT);
+}
+
+
+#endif // MAPDATA_H
@@ -0,0 +1,133 @@
+// MapSnapshot.h
+
+//  An immutable view of a StreetMap at one moment in time
+//  queries take a snapshot once and use it throughout, so that a road closure published
+//  in the middle of a search can never give that search an inconsistent picture of the map
+
+#ifndef MAPSNAPSHOT_H
+#define MAPSNAPSHOT_H
+
+#include "provided.h"
+#include "MapData.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// a runtime change to one directed street segment
+struct SegmentOverride
+{
+    bool closed = false;
+    double weight = -1; // negative means the segment costs its length, as it does in the map file
+};
+
+// one entry of the change log, recording which segment changed in which version
+struct MapChange
+{
+    unsigned int version;
+    int edge;
+    GeoCoord start;
+    GeoCoord end;
+};
+
+// the cost recorded for a chain with a closed edge in it
+const double CHAIN_CLOSED = -1;
+
+class MapSnapshot
+{
+public:
+    MapSnapshot(std::shared_ptr<const MapData> data, unsigned int version);
+
+    // builds the snapshot following prev, with one edge changed
+    MapSnapshot(const MapSnapshot& prev, int edge, const SegmentOverride& o);
+
+    // the street graph this snapshot is of
+    const MapData& data() const
+    {
+        return *m_data;
+    }
+
+    // the open street segments which start at gc, returns false if gc isn't on the map
+    bool getSegmentsThatStartWith(const GeoCoord& gc, std::vector<StreetSegment>& segs) const;
+
+    // returns the edge from start to end, whether closed or not, or -1 if there is no such edge
+    int findEdge(const GeoCoord& start, const GeoCoord& end) const;
+
+    // what has been changed about an edge, the default if nothing has
+    SegmentOverride edgeOverride(int edge) const;
+
+    bool edgeOpen(int edge) const
+    {
+        // most of the time nothing has been changed, and we can skip the lookup
+        if (m_overrides.empty())
+            return true;
+        auto o = m_overrides.find(edge);
+        return o == m_overrides.end() || !o->second.closed;
+    }
+
+    // the cost of travelling along an edge, which is its length unless it has been reweighted
+    double edgeWeight(int edge) const
+    {
+        if (!m_overrides.empty()) {
+            auto o = m_overrides.find(edge);
+            if (o != m_overrides.end() && o->second.weight >= 0)
+                return o->second.weight;
+        }
+        return m_data->edgeLength[edge];
+    }
+
+    bool chainOpen(int chain) const
+    {
+        if (m_chainWeights.empty())
+            return true;
+        auto w = m_chainWeights.find(chain);
+        return w == m_chainWeights.end() || w->second != CHAIN_CLOSED;
+    }
+
+    // the cost of travelling a whole chain, which is its length unless one of its edges has been changed
+    double chainWeight(int chain) const
+    {
+        if (!m_chainWeights.empty()) {
+            auto w = m_chainWeights.find(chain);
+            if (w != m_chainWeights.end())
+                return w->second;
+        }
+        return m_data->chainLength[chain];
+    }
+
+    // the cost of travelling edges from up to (but not including) to of a chain
+    // returns false if one of them is closed
+    bool chainPartWeight(int chain, int from, int to, double& weight) const;
+
+    // true if nothing has been changed since the map was loaded, so routes found on the map as
+    // loaded (like those in the route cache) are still the shortest
+    bool unchanged() const
+    {
+        return m_overrides.empty();
+    }
+
+    // increases by one with every change published to the map
+    unsigned int version() const
+    {
+        return m_version;
+    }
+
+    // fills in the segments changed after the given version
+    // returns false if that version is too old to still be in the change log, in which
+    // case anything derived from it has to be rebuilt from scratch
+    bool changesSince(unsigned int version, std::vector<MapChange>& changes) const;
+
+    // We prevent a MapSnapshot object from being assigned; snapshots never change once published.
+    MapSnapshot& operator=(const MapSnapshot&) = delete;
+
+private:
+    std::shared_ptr<const MapData> m_data;
+    std::map<int, SegmentOverride> m_overrides;
+    std::map<int, double> m_chainWeights;   // for every chain with a changed edge, its cost or CHAIN_CLOSED
+    std::vector<MapChange> m_changes; // oldest first, every change made after version m_logStart
+    unsigned int m_logStart;
+    unsigned int m_version;
+};
+
+
+#endif // MAPSNAPSHOT_H
@@ -0,0 +1,490 @@
+#include "provided.h"
+#include "MapSnapshot.h"
+#include "Partition.h"
+#include "ChainSearch.h"
+#include "Trace.h"
+#include <vector>
+#include <list>
+#include <set>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+/*
+ The map is split into cells (see Partition.h). A node with a segment to another cell is a boundary
+ node of its cell, and for every cell the overlay keeps a clique: the cost of the cheapest way from
+ each of its boundary nodes to each other one, staying inside the cell. A route then only has to be
+ searched for inside the cells it starts and ends in; anywhere else the search is only ever at
+ boundary nodes, and it crosses a cell in one step along the clique, or leaves it along a cut segment.
+ Steps along a clique are expanded back into segments with a search inside their cell.
+
+ Building the overlay is split in two, as in customizable route planning: the cells depend only on
+ the shape of the map and are cut once, while the cliques depend on closures and weights, and are
+ customized, one search inside a cell per boundary node, whenever they change. Customizing again
+ after a change only redoes the cells the changed segments are inside of; cut segments aren't part
+ of any clique, and are read from the snapshot by every search.
+
+ An overlay belongs to one snapshot of the map, and is replaced (atomically, so routes never wait) by
+ customizing it for a later one. Until it is, routes are found by the router instead.
+ */
+
+const double NO_CROSSING = numeric_limits<double>::infinity();
+
+const char CELL_FILE_MAGIC[8] = { 'G', 'O', 'O', 'B', 'C', 'E', 'L', 'L' };
+const uint32_t CELL_FILE_VERSION = 2;
+
+struct CellFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t cell;
+    uint64_t fingerprint;       // of the map the cell is part of
+    uint64_t customization;     // of the closures and weights inside the cell (see cellCustomization)
+    uint32_t numNodes;
+    uint32_t numBoundary;
+};
+
+// the cells of a map, which stay the same for as long as the map is loaded
+struct Cells
+{
+    vector<int> cellOf;
+    vector<int> localIndex;             // the position of every node in its cell's list of nodes
+    vector<int> boundaryIndex;          // the position of every node in its cell's list of boundary nodes, -1 if it has none
+    vector<vector<int> > nodes;
+    vector<vector<int> > boundary;
+};
+
+struct Overlay
+{
+    shared_ptr<const Cells> cells;
+    shared_ptr<const MapSnapshot> snapshot;     // the closures and weights the cliques were customized for
+
+    // clique[c][i * b + j] is the cost of crossing cell c from its boundary node i to its boundary node j,
+    // where b is the number of boundary nodes of c, or NO_CROSSING if that can't be done inside the cell
+    vector<vector<double> > clique;
+};
+
+// Dijkstra from one node of a cell to the rest of it (or until it settles the node to, if there is one),
+// never leaving the cell; distance and parentEdge are indexed like the cell's nodes, and parentEdge
+// holds (global) edge numbers
+static void searchCell(const MapSnapshot& snapshot, const Cells& cells, int cell, int from,
+                       vector<double>& distance, vector<int>& parentEdge, int to = -1)
+{
+    const MapData& graph = snapshot.data();
+    const vector<int>& nodes = cells.nodes[cell];
+    distance.assign(nodes.size(), NO_CROSSING);
+    parentEdge.assign(nodes.size(), -1);
+
+    vector<pair<double, int> > queue;
+    distance[from] = 0;
+    queue.push_back(make_pair(0.0, from));
+    while (!queue.empty()) {
+        pop_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+        pair<double, int> top = queue.back();
+        queue.pop_back();
+        int local = top.second;
+        if (top.first > distance[local])
+            continue;
+        if (local == to)
+            return;
+        int node = nodes[local];
+        graph.useNode(node);
+        for (int e = graph.firstEdge[node]; e < graph.firstEdge[node + 1]; e++) {
+            int neighbor = graph.edgeTarget[e];
+            if (cells.cellOf[neighbor] != cell || !snapshot.edgeOpen(e))
+                continue;
+            int n = cells.localIndex[neighbor];
+            double d = top.first + snapshot.edgeWeight(e);
+            if (d < distance[n]) {
+                distance[n] = d;
+                parentEdge[n] = e;
+                queue.push_back(make_pair(d, n));
+                push_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+            }
+        }
+    }
+}
+
+// works out the clique of one cell for the weights of the snapshot
+static void customizeCell(const MapSnapshot& snapshot, const Cells& cells, int cell, vector<double>& clique)
+{
+    const vector<int>& boundary = cells.boundary[cell];
+    size_t b = boundary.size();
+    clique.assign(b * b, NO_CROSSING);
+    vector<double> distance;
+    vector<int> parentEdge;
+    for (size_t i = 0; i < b; i++) {
+        searchCell(snapshot, cells, cell, cells.localIndex[boundary[i]], distance, parentEdge);
+        for (size_t j = 0; j < b; j++)
+            clique[i * b + j] = distance[cells.localIndex[boundary[j]]];
+    }
+}
+
+// a fingerprint (FNV-1a) of which segments inside a cell are open and what they weigh, which is all its
+// clique depends on; a saved clique is only any use to a snapshot where this is the same
+static uint64_t cellCustomization(const MapSnapshot& snapshot, const Cells& cells, int cell)
+{
+    const MapData& graph = snapshot.data();
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](const void* data, size_t length) {
+        const unsigned char* p = (const unsigned char*) data;
+        for (size_t i = 0; i < length; i++) {
+            hash ^= p[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+    for (int node : cells.nodes[cell]) {
+        for (int e = graph.firstEdge[node]; e < graph.firstEdge[node + 1]; e++) {
+            if (cells.cellOf[graph.edgeTarget[e]] != cell)
+                continue;
+            double weight = snapshot.edgeOpen(e) ? snapshot.edgeWeight(e) : -1;
+            add(&weight, sizeof(weight));
+        }
+    }
+    return hash;
+}
+
+class OverlayRouterImpl
+{
+public:
+    OverlayRouterImpl(const StreetMap* sm);
+    ~OverlayRouterImpl();
+    bool buildOverlay(int maxCellSize);
+    bool customize();
+    int cellCount() const;
+    bool saveCell(int cell, string cellFile) const;
+    bool loadCell(string cellFile);
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const;
+
+private:
+    const StreetMap* m_streetMap;
+    PointToPointRouter m_router;    // for snapshots the overlay hasn't been customized for
+    shared_ptr<const Overlay> m_overlay;    // read and replaced with atomic_load and atomic_store
+
+    // appends the segments of the cheapest way across a cell, from one of its nodes to another; NO_ROUTE
+    // if there is none, which can only be if the clique doesn't fit the snapshot
+    DeliveryResult expandCrossing(const Overlay& overlay, int from, int to, vector<int>& edges) const;
+};
+
+OverlayRouterImpl::OverlayRouterImpl(const StreetMap* sm)
+    : m_streetMap(sm), m_router(sm)
+{
+}
+
+OverlayRouterImpl::~OverlayRouterImpl()
+{
+}
+
+bool OverlayRouterImpl::buildOverlay(int maxCellSize)
+{
+    TraceSpan span("overlay", "build");
+    shared_ptr<const MapSnapshot> snapshot = m_streetMap->snapshot();
+    const MapData& graph = snapshot->data();
+
+    shared_ptr<Cells> cells = make_shared<Cells>();
+    int numCells;
+    {
+        TraceSpan partitionSpan("overlay", "partition");
+        numCells = partitionGraph(graph, maxCellSize, cells->cellOf);
+        partitionSpan.arg("cells", numCells);
+    }
+
+    cells->nodes.resize(numCells);
+    cells->boundary.resize(numCells);
+    cells->localIndex.resize(graph.nodeCount());
+    cells->boundaryIndex.assign(graph.nodeCount(), -1);
+    for (int n = 0; n < graph.nodeCount(); n++) {
+        int c = cells->cellOf[n];
+        cells->localIndex[n] = cells->nodes[c].size();
+        cells->nodes[c].push_back(n);
+
+        graph.useNode(n);
+        bool onBoundary = false;
+        for (int e = graph.firstEdge[n]; e < graph.firstEdge[n + 1] && !onBoundary; e++)
+            onBoundary = cells->cellOf[graph.edgeTarget[e]] != c;
+        if (onBoundary) {
+            cells->boundaryIndex[n] = cells->boundary[c].size();
+            cells->boundary[c].push_back(n);
+        }
+    }
+
+    shared_ptr<Overlay> overlay = make_shared<Overlay>();
+    overlay->cells = cells;
+    overlay->snapshot = snapshot;
+    overlay->clique.resize(numCells);
+    for (int c = 0; c < numCells; c++)
+        customizeCell(*snapshot, *cells, c, overlay->clique[c]);
+    atomic_store(&m_overlay, shared_ptr<const Overlay>(overlay));
+    return true;
+}
+
+bool OverlayRouterImpl::customize()
+{
+    TraceSpan span("overlay", "customize");
+    shared_ptr<const Overlay> current = atomic_load(&m_overlay);
+    shared_ptr<const MapSnapshot> snapshot = m_streetMap->snapshot();
+
+    // the cells only fit the map they were cut from
+    if (current == nullptr || &current->snapshot->data() != &snapshot->data())
+        return false;
+    if (current->snapshot->version() == snapshot->version())
+        return true;
+
+    // only the cells with a changed segment inside them need their cliques worked out again
+    const Cells& cells = *current->cells;
+    const MapData& graph = snapshot->data();
+    set<int> changedCells;
+    vector<MapChange> changes;
+    if (snapshot->changesSince(current->snapshot->version(), changes)) {
+        for (const auto& change : changes) {
+            int c = cells.cellOf[graph.edgeSource[change.edge]];
+            if (cells.cellOf[graph.edgeTarget[change.edge]] == c)
+                changedCells.insert(c);
+        }
+    }
+    else {
+        for (int c = 0; c < (int) cells.nodes.size(); c++)
+            changedCells.insert(c);
+    }
+    span.arg("cells", changedCells.size());
+
+    shared_ptr<Overlay> overlay = make_shared<Overlay>(*current);
+    overlay->snapshot = snapshot;
+    for (int c : changedCells)
+        customizeCell(*snapshot, cells, c, overlay->clique[c]);
+    atomic_store(&m_overlay, shared_ptr<const Overlay>(overlay));
+    return true;
+}
+
+int OverlayRouterImpl::cellCount() const
+{
+    shared_ptr<const Overlay> overlay = atomic_load(&m_overlay);
+    return overlay == nullptr ? 0 : overlay->cells->nodes.size();
+}
+
+bool OverlayRouterImpl::saveCell(int cell, string cellFile) const
+{
+    shared_ptr<const Overlay> overlay = atomic_load(&m_overlay);
+    if (overlay == nullptr || cell < 0 || cell >= (int) overlay->cells->nodes.size())
+        return false;
+    const vector<int>& nodes = overlay->cells->nodes[cell];
+    const vector<int>& boundary = overlay->cells->boundary[cell];
+    const vector<double>& clique = overlay->clique[cell];
+
+    CellFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CELL_FILE_MAGIC, sizeof(h.magic));
+    h.version = CELL_FILE_VERSION;
+    h.cell = cell;
+    h.fingerprint = overlay->snapshot->data().fingerprint();
+    h.customization = cellCustomization(*overlay->snapshot, *overlay->cells, cell);
+    h.numNodes = nodes.size();
+    h.numBoundary = boundary.size();
+
+    ofstream out(cellFile, ios::binary | ios::trunc);
+    out.write((const char*) &h, sizeof(h));
+    out.write((const char*) nodes.data(), nodes.size() * sizeof(int32_t));
+    out.write((const char*) boundary.data(), boundary.size() * sizeof(int32_t));
+    out.write((const char*) clique.data(), clique.size() * sizeof(double));
+    return bool(out);
+}
+
+bool OverlayRouterImpl::loadCell(string cellFile)
+{
+    shared_ptr<const Overlay> current = atomic_load(&m_overlay);
+    if (current == nullptr)
+        return false;
+
+    ifstream in(cellFile, ios::binary);
+    CellFileHeader h;
+    if (!in.read((char*) &h, sizeof(h)) || memcmp(h.magic, CELL_FILE_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != CELL_FILE_VERSION || h.fingerprint != current->snapshot->data().fingerprint())
+        return false;
+
+    // the cell has to be one of ours, with the same nodes and the same boundary, customized for the same
+    // closures and weights inside it as ours is
+    const Cells& cells = *current->cells;
+    if (h.cell < 0 || h.cell >= (int) cells.nodes.size() || h.numNodes != cells.nodes[h.cell].size() ||
+        h.numBoundary != cells.boundary[h.cell].size() ||
+        h.customization != cellCustomization(*current->snapshot, cells, h.cell))
+        return false;
+    vector<int32_t> nodes(h.numNodes), boundary(h.numBoundary);
+    vector<double> clique((size_t) h.numBoundary * h.numBoundary);
+    if (!in.read((char*) nodes.data(), nodes.size() * sizeof(int32_t)) ||
+        !in.read((char*) boundary.data(), boundary.size() * sizeof(int32_t)) ||
+        !in.read((char*) clique.data(), clique.size() * sizeof(double)))
+        return false;
+    if (!equal(nodes.begin(), nodes.end(), cells.nodes[h.cell].begin()) ||
+        !equal(boundary.begin(), boundary.end(), cells.boundary[h.cell].begin()))
+        return false;
+
+    shared_ptr<Overlay> overlay = make_shared<Overlay>(*current);
+    overlay->clique[h.cell] = move(clique);
+    atomic_store(&m_overlay, shared_ptr<const Overlay>(overlay));
+    return true;
+}
+
+DeliveryResult OverlayRouterImpl::expandCrossing(const Overlay& overlay, int from, int to, vector<int>& edges) const
+{
+    const Cells& cells = *overlay.cells;
+    int cell = cells.cellOf[from];
+    vector<double> distance;
+    vector<int> parentEdge;
+    searchCell(*overlay.snapshot, cells, cell, cells.localIndex[from], distance, parentEdge, cells.localIndex[to]);
+
+    // the edges come out backwards, as the caller collects them
+    const MapData& graph = overlay.snapshot->data();
+    for (int n = to; n != from; n = graph.edgeSource[edges.back()]) {
+        if (parentEdge[cells.localIndex[n]] < 0)
+            return NO_ROUTE;
+        edges.push_back(parentEdge[cells.localIndex[n]]);
+    }
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult OverlayRouterImpl::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const
+{
+    shared_ptr<const Overlay> overlay = atomic_load(&m_overlay);
+    shared_ptr<const MapSnapshot> snapshot = m_streetMap->snapshot();
+    if (overlay == nullptr || overlay->snapshot->version() != snapshot->version() ||
+        &overlay->snapshot->data() != &snapshot->data())
+        return m_router.generatePointToPointRoute(start, end, route, totalDistanceTravelled);
+
+    TraceSpan span("overlay", "route");
+    const MapData& graph = snapshot->data();
+    const Cells& cells = *overlay->cells;
+    int source = graph.nodeOf(start);
+    int target = graph.nodeOf(end);
+    if (source < 0 || target < 0)
+        return BAD_COORD;
+    route.clear();
+    totalDistanceTravelled = 0;
+    if (source == target)
+        return DELIVERY_SUCCESS;
+    if (!graph.mayBeConnected(source, target))
+        return NO_ROUTE;
+
+    // a node reached across a clique records the boundary node it came from as -2 - that node
+    SearchWorkspace& ws = threadSearchWorkspace();
+    ws.startSearch(graph.nodeCount());
+    ws.reach(source, 0, -1);
+    int sourceCell = cells.cellOf[source];
+    int targetCell = cells.cellOf[target];
+    int numSettled = 0;
+    auto reachIfShorter = [&ws](int node, double d, int parent) {
+        if (!ws.settled(node) && (!ws.reached(node) || d < ws.distance(node)))
+            ws.reach(node, d, parent);
+    };
+
+    int current;
+    while ((current = ws.popClosest()) >= 0 && current != target) {
+        if (ws.settled(current))
+            continue;
+        ws.settle(current);
+        numSettled++;
+        graph.useNode(current);
+
+        // inside the cells of the two ends, every segment is followed; elsewhere, only cut segments are,
+        // and the rest of the cell is crossed along its clique
+        int cell = cells.cellOf[current];
+        bool inEndCell = cell == sourceCell || cell == targetCell;
+        for (int e = graph.firstEdge[current]; e < graph.firstEdge[current + 1]; e++) {
+            int neighbor = graph.edgeTarget[e];
+            if (snapshot->edgeOpen(e) && (inEndCell || cells.cellOf[neighbor] != cell))
+                reachIfShorter(neighbor, ws.distance(current) + snapshot->edgeWeight(e), e);
+        }
+        if (inEndCell)
+            continue;
+        const vector<int>& boundary = cells.boundary[cell];
+        const double* crossing = &overlay->clique[cell][cells.boundaryIndex[current] * boundary.size()];
+        for (size_t j = 0; j < boundary.size(); j++)
+            if (crossing[j] != NO_CROSSING && boundary[j] != current)
+                reachIfShorter(boundary[j], ws.distance(current) + crossing[j], -2 - current);
+    }
+    span.arg("settled", numSettled);
+    if (current != target)
+        return NO_ROUTE;
+
+    vector<int> edges;
+    for (int n = target; n != source; ) {
+        int parent = ws.parentEdge(n);
+        if (parent >= 0) {
+            edges.push_back(parent);
+            n = graph.edgeSource[parent];
+        }
+        else {
+            if (expandCrossing(*overlay, -2 - parent, n, edges) != DELIVERY_SUCCESS)
+                return NO_ROUTE;
+            n = -2 - parent;
+        }
+    }
+
+    // the search minimizes segment weights, but the distance travelled is the actual length of the route
+    for (auto e = edges.rbegin(); e != edges.rend(); e++) {
+        route.push_back(graph.segment(*e));
+        totalDistanceTravelled += distanceEarthMiles(route.back().start, route.back().end);
+    }
+    return DELIVERY_SUCCESS;
+}
+
+//******************** OverlayRouter functions ********************************
+
+// These functions simply delegate to OverlayRouterImpl's functions.
+// You probably don't want to change any of this code.
+
+OverlayRouter::OverlayRouter(const StreetMap* sm)
+{
+    m_impl = new OverlayRouterImpl(sm);
+}
+
+OverlayRouter::~OverlayRouter()
+{
+    delete m_impl;
+}
+
+bool OverlayRouter::buildOverlay(int maxCellSize)
+{
+    return m_impl->buildOverlay(maxCellSize);
+}
+
+bool OverlayRouter::customize()
+{
+    return m_impl->customize();
+}
+
+int OverlayRouter::cellCount() const
+{
+    return m_impl->cellCount();
+}
+
+bool OverlayRouter::saveCell(int cell, string cellFile) const
+{
+    return m_impl->saveCell(cell, cellFile);
+}
+
+bool OverlayRouter::loadCell(string cellFile)
+{
+    return m_impl->loadCell(cellFile);
+}
+
+DeliveryResult OverlayRouter::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const
+{
+    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
+}
@@ -0,0 +1,304 @@
+#include "Partition.h"
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <utility>
+using namespace std;
+
+/*
+ The graph is cut in two again and again until every piece is small enough to be a cell. Each cut is
+ made multilevel, the way METIS does it: the graph is coarsened by repeatedly merging pairs of
+ neighbouring nodes joined by the heaviest edges, until only a few dozen nodes are left; that small
+ graph is cut by growing one half from a seed node, always taking the node which adds least to the
+ cut; then the cut is carried back through every level, moving nodes across it wherever that makes it
+ smaller without unbalancing the halves. Street maps are nearly planar, so the cuts found are short.
+
+ The graph partitioned ignores direction, closures and weights: every segment is an edge in both
+ directions anyway, and the cells have to stay the same while weights change.
+ */
+
+// coarsening stops at this many nodes, or once a round of matching no longer shrinks the graph much
+const int COARSEST_NODES = 64;
+
+// how much heavier than half of the graph either half of a cut may be
+const double IMBALANCE = 0.03;
+
+// the number of seeds the coarsest graph is cut from, keeping the best cut
+const int INITIAL_TRIES = 4;
+
+// the number of passes of moving nodes across the cut at each level
+const int REFINE_PASSES = 4;
+
+// an undirected graph with weighted nodes (how many street nodes each stands for) and edges (how
+// many segments each stands for), in compressed rows
+struct WeightedGraph
+{
+    vector<int> nodeWeight;
+    vector<int> first;      // the edges of node n are first[n] up to first[n + 1]
+    vector<int> target;
+    vector<int> edgeWeight;
+
+    int size() const
+    {
+        return nodeWeight.size();
+    }
+};
+
+// builds a graph from lists of (neighbour, weight) pairs, merging the edges to the same neighbour
+static void buildGraph(vector<vector<pair<int, int> > >& adjacency, WeightedGraph& g)
+{
+    g.first.assign(1, 0);
+    g.target.clear();
+    g.edgeWeight.clear();
+    for (auto& edges : adjacency) {
+        sort(edges.begin(), edges.end());
+        for (size_t i = 0; i < edges.size(); i++) {
+            if (i > 0 && edges[i].first == edges[i - 1].first)
+                g.edgeWeight.back() += edges[i].second;
+            else {
+                g.target.push_back(edges[i].first);
+                g.edgeWeight.push_back(edges[i].second);
+            }
+        }
+        g.first.push_back(g.target.size());
+    }
+}
+
+// merges each node with its unmatched neighbour along the heaviest edge; coarseOf gets the node of
+// the coarse graph every node went into
+static void coarsen(const WeightedGraph& g, mt19937& rng, WeightedGraph& coarse, vector<int>& coarseOf)
+{
+    vector<int> order(g.size());
+    for (int i = 0; i < g.size(); i++)
+        order[i] = i;
+    shuffle(order.begin(), order.end(), rng);
+
+    coarseOf.assign(g.size(), -1);
+    int numCoarse = 0;
+    for (int n : order) {
+        if (coarseOf[n] >= 0)
+            continue;
+        int best = -1;
+        for (int e = g.first[n]; e < g.first[n + 1]; e++) {
+            int m = g.target[e];
+            if (m != n && coarseOf[m] < 0 && (best < 0 || g.edgeWeight[e] > g.edgeWeight[best]))
+                best = e;
+        }
+        coarseOf[n] = numCoarse;
+        if (best >= 0)
+            coarseOf[g.target[best]] = numCoarse;
+        numCoarse++;
+    }
+
+    coarse.nodeWeight.assign(numCoarse, 0);
+    vector<vector<pair<int, int> > > adjacency(numCoarse);
+    for (int n = 0; n < g.size(); n++) {
+        int c = coarseOf[n];
+        coarse.nodeWeight[c] += g.nodeWeight[n];
+        for (int e = g.first[n]; e < g.first[n + 1]; e++) {
+            int d = coarseOf[g.target[e]];
+            if (d != c)
+                adjacency[c].push_back(make_pair(d, g.edgeWeight[e]));
+        }
+    }
+    buildGraph(adjacency, coarse);
+}
+
+// how much the cut would shrink if n moved to the other side
+static int gain(const WeightedGraph& g, const vector<char>& side, int n)
+{
+    int result = 0;
+    for (int e = g.first[n]; e < g.first[n + 1]; e++)
+        result += (side[g.target[e]] != side[n]) ? g.edgeWeight[e] : -g.edgeWeight[e];
+    return result;
+}
+
+static int cutWeight(const WeightedGraph& g, const vector<char>& side)
+{
+    int cut = 0;
+    for (int n = 0; n < g.size(); n++)
+        for (int e = g.first[n]; e < g.first[n + 1]; e++)
+            if (side[g.target[e]] != side[n])
+                cut += g.edgeWeight[e];
+    return cut / 2;
+}
+
+// moves nodes across the cut while that makes it smaller (or, at no cost, more even) and keeps both
+// halves under maxWeight
+static void refine(const WeightedGraph& g, vector<char>& side, int maxWeight)
+{
+    int weight[2] = { 0, 0 };
+    for (int n = 0; n < g.size(); n++)
+        weight[(int) side[n]] += g.nodeWeight[n];
+
+    for (int pass = 0; pass < REFINE_PASSES; pass++) {
+        bool moved = false;
+        for (int n = 0; n < g.size(); n++) {
+            int from = side[n], to = 1 - from;
+            if (weight[to] + g.nodeWeight[n] > maxWeight)
+                continue;
+            int w = g.nodeWeight[n];
+            int gn = gain(g, side, n);
+            if (gn > 0 || (gn == 0 && weight[from] - w > weight[to] + w)) {
+                side[n] = to;
+                weight[from] -= w;
+                weight[to] += w;
+                moved = true;
+            }
+        }
+        if (!moved)
+            break;
+    }
+
+    // if the halves are still uneven (pieces of the map which aren't connected can leave them so),
+    // move whichever nodes cost least until they aren't
+    for (int heavy = 0; heavy < 2; heavy++) {
+        while (weight[heavy] > maxWeight) {
+            int best = -1, bestGain = 0;
+            for (int n = 0; n < g.size(); n++) {
+                if (side[n] != heavy || weight[1 - heavy] + g.nodeWeight[n] > maxWeight)
+                    continue;
+                int gn = gain(g, side, n);
+                if (best < 0 || gn > bestGain) {
+                    best = n;
+                    bestGain = gn;
+                }
+            }
+            if (best < 0)
+                break;
+            side[best] = 1 - heavy;
+            weight[heavy] -= g.nodeWeight[best];
+            weight[1 - heavy] += g.nodeWeight[best];
+        }
+    }
+}
+
+// cuts a small graph by growing side 1 from a seed, always taking the node next to it with the best
+// gain; if nothing is next to it (the seed's piece of the graph is used up), any node will do
+static void growCut(const WeightedGraph& g, int seed, int half, vector<char>& side)
+{
+    side.assign(g.size(), 0);
+    side[seed] = 1;
+    int grown = g.nodeWeight[seed];
+    while (grown < half) {
+        int best = -1, bestGain = 0, anyNode = -1;
+        for (int n = 0; n < g.size(); n++) {
+            if (side[n] == 1)
+                continue;
+            anyNode = n;
+            bool next = false;
+            for (int e = g.first[n]; e < g.first[n + 1] && !next; e++)
+                next = side[g.target[e]] == 1;
+            int gn = gain(g, side, n);
+            if (next && (best < 0 || gn > bestGain)) {
+                best = n;
+                bestGain = gn;
+            }
+        }
+        if (best < 0)
+            best = anyNode;
+        if (best < 0)
+            break;
+        side[best] = 1;
+        grown += g.nodeWeight[best];
+    }
+}
+
+// cuts g into two halves of about the same weight, side[n] saying which half n is in
+static void bisect(const WeightedGraph& g, mt19937& rng, vector<char>& side)
+{
+    int total = 0;
+    for (int w : g.nodeWeight)
+        total += w;
+    int maxWeight = total / 2 + max(1, (int) (total * IMBALANCE));
+
+    if (g.size() > COARSEST_NODES) {
+        WeightedGraph coarse;
+        vector<int> coarseOf;
+        coarsen(g, rng, coarse, coarseOf);
+
+        // graphs which hardly shrink any more (a star, say) are cut as they are
+        if (coarse.size() < g.size() * 0.95) {
+            vector<char> coarseSide;
+            bisect(coarse, rng, coarseSide);
+            side.resize(g.size());
+            for (int n = 0; n < g.size(); n++)
+                side[n] = coarseSide[coarseOf[n]];
+            refine(g, side, maxWeight);
+            return;
+        }
+    }
+
+    uniform_int_distribution<int> pick(0, g.size() - 1);
+    int bestCut = -1;
+    for (int t = 0; t < INITIAL_TRIES; t++) {
+        vector<char> trial;
+        growCut(g, pick(rng), total / 2, trial);
+        refine(g, trial, maxWeight);
+        int cut = cutWeight(g, trial);
+        if (bestCut < 0 || cut < bestCut) {
+            bestCut = cut;
+            side = trial;
+        }
+    }
+}
+
+// splits the street nodes in nodes into cells, numbering them from numCells on
+static void partitionNodes(const MapData& graph, const vector<int>& nodes, int maxCellSize, mt19937& rng,
+                           vector<int>& localOf, vector<int>& cellOf, int& numCells)
+{
+    if ((int) nodes.size() <= maxCellSize) {
+        for (int n : nodes)
+            cellOf[n] = numCells;
+        numCells++;
+        return;
+    }
+
+    // the subgraph of these nodes, numbered by their position in nodes
+    for (size_t i = 0; i < nodes.size(); i++)
+        localOf[nodes[i]] = i;
+    vector<vector<pair<int, int> > > adjacency(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        int n = nodes[i];
+        graph.useNode(n);
+        for (int e = graph.firstEdge[n]; e < graph.firstEdge[n + 1]; e++) {
+            int m = graph.edgeTarget[e];
+            if (localOf[m] >= 0 && m != n)
+                adjacency[i].push_back(make_pair(localOf[m], 1));
+        }
+    }
+    for (int n : nodes)
+        localOf[n] = -1;
+    WeightedGraph g;
+    g.nodeWeight.assign(nodes.size(), 1);
+    buildGraph(adjacency, g);
+
+    vector<char> side;
+    bisect(g, rng, side);
+    vector<int> halves[2];
+    for (size_t i = 0; i < nodes.size(); i++)
+        halves[(int) side[i]].push_back(nodes[i]);
+
+    // a cut which failed to split anything would recurse forever
+    if (halves[0].empty() || halves[1].empty()) {
+        halves[0].assign(nodes.begin(), nodes.begin() + nodes.size() / 2);
+        halves[1].assign(nodes.begin() + nodes.size() / 2, nodes.end());
+    }
+    for (int h = 0; h < 2; h++)
+        partitionNodes(graph, halves[h], maxCellSize, rng, localOf, cellOf, numCells);
+}
+
+int partitionGraph(const MapData& graph, int maxCellSize, vector<int>& cellOf)
+{
+    // a fixed seed, so that the same map is always cut into the same cells
+    mt19937 rng(1);
+    vector<int> nodes(graph.nodeCount());
+    for (int n = 0; n < graph.nodeCount(); n++)
+        nodes[n] = n;
+    vector<int> localOf(graph.nodeCount(), -1);
+    cellOf.assign(graph.nodeCount(), -1);
+    int numCells = 0;
+    if (!nodes.empty())
+        partitionNodes(graph, nodes, max(1, maxCellSize), rng, localOf, cellOf, numCells);
+    return numCells;
+}
@@ -0,0 +1,18 @@
+// Partition.h
+
+//  Splits the street graph into cells of a bounded number of nodes, cutting as few segments as possible
+//  the cells are what the overlay router searches inside, so fewer cut segments mean smaller overlays
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "MapData.h"
+#include <vector>
+
+// multilevel recursive bisection: cellOf gets the cell of every node, numbered from 0; cells have at
+// most maxCellSize nodes, and are about the same size
+// returns the number of cells
+int partitionGraph(const MapData& graph, int maxCellSize, std::vector<int>& cellOf);
+
+
+#endif // PARTITION_H
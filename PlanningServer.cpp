@@ -0,0 +1,993 @@
+#include "provided.h"
+#include "BoundedQueue.h"
+#include "Trace.h"
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+using namespace std;
+
+/*
+ The planning server keeps one StreetMap in memory and answers route and plan requests
+ Requests and responses are single lines of JSON, for example:
+
+   {"id": 1, "op": "route", "start": [34.0625329, -118.4470263], "end": [34.0712323, -118.4505969]}
+   {"id": 2, "op": "plan", "optimize": true, "depot": [34.0625329, -118.4470263],
+    "deliveries": [{"item": "Chicken tenders", "location": [34.0712323, -118.4505969]}]}
+   {"id": 6, "op": "plan", "stream": true, "depot": [34.0625329, -118.4470263],
+    "deliveries": [{"item": "Chicken tenders", "location": [34.0712323, -118.4505969]}]}
+   {"id": 3, "op": "close", "start": [34.0625329, -118.4470263], "end": [34.0632405, -118.4470467]}
+   {"id": 4, "op": "area", "depot": [34.0625329, -118.4470263], "miles": 1.5}
+   {"id": 5, "op": "plan", "depots": [[34.0625329, -118.4470263], [34.0712323, -118.4505969]],
+    "deliveries": [{"item": "Chicken tenders", "location": [34.0712323, -118.4505969]}]}
+   {"op": "shutdown"}
+
+ Responses echo the id of their request, since a client may pipeline many requests and
+ the worker pool answers them in whatever order they finish; a streamed plan answers with a
+ line of status "leg" for each leg as soon as it is routed, before its final line
+ */
+
+// a line longer than this can't be a sensible request, so we refuse to buffer it
+const size_t MAX_REQUEST_LENGTH = 1 << 20;
+
+// set from the signal handler, polled by the serving loops
+static volatile sig_atomic_t g_stopSignalled = 0;
+
+static void handleStopSignal(int)
+{
+    g_stopSignalled = 1;
+}
+
+//******************** A small JSON reader ************************************
+
+// just enough JSON to read requests
+// numbers keep the exact text they were written with, since GeoCoords compare by their text
+struct JsonValue
+{
+    enum Type { JNULL, JBOOL, JNUMBER, JSTRING, JARRAY, JOBJECT };
+
+    Type type = JNULL;
+    string text;                                // contents of a string, or a number as written
+    bool boolean = false;
+    vector<JsonValue> elements;                 // array elements
+    vector<pair<string, JsonValue> > members;   // object members, in the order they were written
+
+    // returns the member with the given key, or nullptr if there isn't one
+    const JsonValue* member(const string& key) const
+    {
+        for (const auto& m : members)
+            if (m.first == key)
+                return &m.second;
+        return nullptr;
+    }
+};
+
+class JsonReader
+{
+public:
+    JsonReader(const string& s) : m_s(s), m_pos(0) {}
+
+    // parses the whole string as a single value, returns false on any syntax error
+    bool parse(JsonValue& v)
+    {
+        if (!parseValue(v, 0))
+            return false;
+        skipSpace();
+        return m_pos == m_s.size();
+    }
+
+private:
+    const string& m_s;
+    size_t m_pos;
+
+    void skipSpace()
+    {
+        while (m_pos < m_s.size() && isspace((unsigned char) m_s[m_pos]))
+            m_pos++;
+    }
+
+    bool consume(char c)
+    {
+        skipSpace();
+        if (m_pos < m_s.size() && m_s[m_pos] == c) {
+            m_pos++;
+            return true;
+        }
+        return false;
+    }
+
+    bool consumeWord(const char* word)
+    {
+        size_t n = strlen(word);
+        if (m_s.compare(m_pos, n, word) != 0)
+            return false;
+        m_pos += n;
+        return true;
+    }
+
+    bool parseValue(JsonValue& v, int depth)
+    {
+        // requests are shallow, anything this deep is garbage
+        if (depth > 32)
+            return false;
+
+        skipSpace();
+        if (m_pos >= m_s.size())
+            return false;
+
+        char c = m_s[m_pos];
+        if (c == '{')
+            return parseObject(v, depth);
+        if (c == '[')
+            return parseArray(v, depth);
+        if (c == '"') {
+            v.type = JsonValue::JSTRING;
+            return parseString(v.text);
+        }
+        if (c == 't' || c == 'f') {
+            v.type = JsonValue::JBOOL;
+            v.boolean = (c == 't');
+            return consumeWord(v.boolean ? "true" : "false");
+        }
+        if (c == 'n') {
+            v.type = JsonValue::JNULL;
+            return consumeWord("null");
+        }
+        return parseNumber(v);
+    }
+
+    bool parseObject(JsonValue& v, int depth)
+    {
+        v.type = JsonValue::JOBJECT;
+        m_pos++; // the opening brace
+        if (consume('}'))
+            return true;
+        do {
+            skipSpace();
+            string key;
+            if (m_pos >= m_s.size() || m_s[m_pos] != '"' || !parseString(key) || !consume(':'))
+                return false;
+            v.members.push_back(make_pair(key, JsonValue()));
+            if (!parseValue(v.members.back().second, depth + 1))
+                return false;
+        } while (consume(','));
+        return consume('}');
+    }
+
+    bool parseArray(JsonValue& v, int depth)
+    {
+        v.type = JsonValue::JARRAY;
+        m_pos++; // the opening bracket
+        if (consume(']'))
+            return true;
+        do {
+            v.elements.push_back(JsonValue());
+            if (!parseValue(v.elements.back(), depth + 1))
+                return false;
+        } while (consume(','));
+        return consume(']');
+    }
+
+    bool parseString(string& out)
+    {
+        m_pos++; // the opening quote
+        while (m_pos < m_s.size()) {
+            char c = m_s[m_pos++];
+            if (c == '"')
+                return true;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (m_pos >= m_s.size())
+                return false;
+            char e = m_s[m_pos++];
+            switch (e) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    // street names and items are plain text, so we only decode the basic multilingual plane
+                    if (m_pos + 4 > m_s.size())
+                        return false;
+                    for (size_t i = m_pos; i < m_pos + 4; i++)
+                        if (!isxdigit((unsigned char) m_s[i]))
+                            return false;
+                    unsigned int code = stoul(m_s.substr(m_pos, 4), nullptr, 16);
+                    m_pos += 4;
+                    if (code < 0x80)
+                        out += (char) code;
+                    else if (code < 0x800) {
+                        out += (char) (0xC0 | (code >> 6));
+                        out += (char) (0x80 | (code & 0x3F));
+                    }
+                    else {
+                        out += (char) (0xE0 | (code >> 12));
+                        out += (char) (0x80 | ((code >> 6) & 0x3F));
+                        out += (char) (0x80 | (code & 0x3F));
+                    }
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return false; // no closing quote
+    }
+
+    bool parseNumber(JsonValue& v)
+    {
+        size_t start = m_pos;
+        if (m_pos < m_s.size() && m_s[m_pos] == '-')
+            m_pos++;
+        size_t digits = m_pos;
+        while (m_pos < m_s.size() && isdigit((unsigned char) m_s[m_pos]))
+            m_pos++;
+        if (m_pos == digits)
+            return false;
+        if (m_pos < m_s.size() && m_s[m_pos] == '.') {
+            m_pos++;
+            size_t fraction = m_pos;
+            while (m_pos < m_s.size() && isdigit((unsigned char) m_s[m_pos]))
+                m_pos++;
+            if (m_pos == fraction)
+                return false;
+        }
+        if (m_pos < m_s.size() && (m_s[m_pos] == 'e' || m_s[m_pos] == 'E')) {
+            m_pos++;
+            if (m_pos < m_s.size() && (m_s[m_pos] == '+' || m_s[m_pos] == '-'))
+                m_pos++;
+            size_t exponent = m_pos;
+            while (m_pos < m_s.size() && isdigit((unsigned char) m_s[m_pos]))
+                m_pos++;
+            if (m_pos == exponent)
+                return false;
+        }
+        v.type = JsonValue::JNUMBER;
+        v.text = m_s.substr(start, m_pos - start);
+        return true;
+    }
+};
+
+// quotes and escapes a string for output
+static string jsonString(const string& s)
+{
+    string out = "\"";
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                }
+                else
+                    out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// a GeoCoord is written as an array of two numbers, using the exact text it was read with
+static string jsonCoord(const GeoCoord& gc)
+{
+    return "[" + gc.latitudeText + "," + gc.longitudeText + "]";
+}
+
+static string jsonDistance(double miles)
+{
+    ostringstream oss;
+    oss.precision(10);
+    oss << miles;
+    return oss.str();
+}
+
+// reads a coordinate written either as [lat, lon] or as the string "lat lon"
+static bool readCoord(const JsonValue* v, GeoCoord& gc)
+{
+    if (v == nullptr)
+        return false;
+
+    string lat, lon;
+    if (v->type == JsonValue::JARRAY && v->elements.size() == 2) {
+        for (const auto& e : v->elements)
+            if (e.type != JsonValue::JNUMBER && e.type != JsonValue::JSTRING)
+                return false;
+        lat = v->elements[0].text;
+        lon = v->elements[1].text;
+    }
+    else if (v->type == JsonValue::JSTRING) {
+        istringstream iss(v->text);
+        if (!(iss >> lat >> lon))
+            return false;
+    }
+    else
+        return false;
+
+    // stod throws on text which isn't a number, which we report as a bad request
+    try {
+        gc = GeoCoord(lat, lon);
+    }
+    catch (const exception&) {
+        return false;
+    }
+    return true;
+}
+
+// reads a JSON number; false if it isn't one, or is too large to be a double (stod throws on those)
+static bool readNumber(const JsonValue* v, double& x)
+{
+    if (v == nullptr || v->type != JsonValue::JNUMBER)
+        return false;
+    try {
+        x = stod(v->text);
+    }
+    catch (const exception&) {
+        return false;
+    }
+    return isfinite(x);
+}
+
+//******************** Connections ********************************************
+
+// somewhere to send response lines; several workers may reply on the same connection at once
+class Connection
+{
+public:
+    virtual ~Connection() {}
+    virtual void send(const string& line) = 0;
+};
+
+class StreamConnection : public Connection
+{
+public:
+    StreamConnection(ostream& out) : m_out(out) {}
+
+    void send(const string& line) override
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_out << line << '\n';
+        m_out.flush();
+    }
+
+private:
+    ostream& m_out;
+    mutex m_mutex;
+};
+
+class SocketConnection : public Connection
+{
+public:
+    SocketConnection(int fd) : m_fd(fd) {}
+
+    // the descriptor is closed once the reader and every worker holding a reply for it are done
+    ~SocketConnection() override
+    {
+        close(m_fd);
+    }
+
+    void send(const string& line) override
+    {
+        lock_guard<mutex> lock(m_mutex);
+        string out = line + '\n';
+        size_t written = 0;
+        while (written < out.size()) {
+            // MSG_NOSIGNAL so that a client hanging up doesn't kill the whole server with SIGPIPE
+            ssize_t n = ::send(m_fd, out.data() + written, out.size() - written, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return; // the client went away, nobody is left to read the reply
+            written += n;
+        }
+    }
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+private:
+    int m_fd;
+    mutex m_mutex;
+};
+
+//******************** PlanningServerImpl *************************************
+
+// one unit of work for the pool: a raw request line and where its answer should go
+struct ServerJob
+{
+    shared_ptr<Connection> connection;
+    string line;
+};
+
+class PlanningServerImpl
+{
+public:
+    PlanningServerImpl(StreetMap* sm, int numWorkers, int queueCapacity);
+    ~PlanningServerImpl();
+    bool addDepot(const GeoCoord& depot);
+    bool serveStream(istream& in, ostream& out);
+    bool serveUnixSocket(string socketPath);
+    void stop();
+
+private:
+    StreetMap* m_streetMap; // not const, since the server also applies road closures to it
+    int m_numWorkers;
+    BoundedQueue<ServerJob> m_queue;
+    atomic<bool> m_stopping;
+    vector<thread> m_workers;
+
+    // shared by every worker, so that the area of a depot is only searched once
+    ServiceAreaFinder m_serviceAreas;
+
+    // shared by every worker's planner, so that the trees of a depot are only searched once per map change
+    DepotTrees m_depotTrees;
+
+    bool stopRequested() const
+    {
+        return m_stopping || g_stopSignalled;
+    }
+
+    void startWorkers();
+    void drainAndJoinWorkers();
+    void workerLoop();
+
+    // reads request lines from a socket and queues them, until the client hangs up or we stop
+    void readConnection(shared_ptr<SocketConnection> connection);
+
+    // turns one request line into one response line; a streamed plan sends its legs on connection first
+    // the router, planner, optimizer and assigner belong to the calling worker, so no locking is needed
+    string handleRequest(const string& line, Connection& connection, const PointToPointRouter& router,
+                         const DeliveryPlanner& planner, const DeliveryOptimizer& optimizer, const DepotAssigner& assigner);
+    string handleRoute(const JsonValue& request, const string& id, const PointToPointRouter& router);
+    string handleMapChange(const JsonValue& request, const string& id, const string& op);
+    string handleArea(const JsonValue& request, const string& id);
+    string handlePlan(const JsonValue& request, const string& id, Connection& connection, const DeliveryPlanner& planner,
+                      const DeliveryOptimizer& optimizer, const DepotAssigner& assigner);
+    string handleDepotsPlan(const JsonValue& request, const string& id, const vector<DeliveryRequest>& deliveries,
+                            bool optimize, const DepotAssigner& assigner);
+};
+
+// the body of every response starts with the id of its request, so that pipelined replies can be matched up
+static string responseHead(const string& id, const string& status)
+{
+    return "{\"id\":" + id + ",\"status\":" + jsonString(status);
+}
+
+static string errorResponse(const string& id, const string& message)
+{
+    return responseHead(id, "error") + ",\"message\":" + jsonString(message) + "}";
+}
+
+static string resultStatus(DeliveryResult r)
+{
+    switch (r) {
+        case DELIVERY_SUCCESS:
+            return "ok";
+        case NO_ROUTE:
+            return "no_route";
+        case BAD_COORD:
+            return "bad_coord";
+    }
+    return "error";
+}
+
+static void installStopHandlers()
+{
+    // no SA_RESTART, so that a blocking read is interrupted and the serving loop gets to see the flag
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleStopSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+}
+
+PlanningServerImpl::PlanningServerImpl(StreetMap* sm, int numWorkers, int queueCapacity)
+    : m_streetMap(sm), m_numWorkers(numWorkers > 0 ? numWorkers : 1), m_queue(queueCapacity), m_stopping(false),
+      m_serviceAreas(sm), m_depotTrees(sm)
+{
+}
+
+PlanningServerImpl::~PlanningServerImpl()
+{
+    // make sure no worker outlives the queue it is reading from
+    drainAndJoinWorkers();
+}
+
+bool PlanningServerImpl::addDepot(const GeoCoord& depot)
+{
+    return m_depotTrees.addDepot(depot);
+}
+
+void PlanningServerImpl::startWorkers()
+{
+    for (int i = 0; i < m_numWorkers; i++)
+        m_workers.push_back(thread(&PlanningServerImpl::workerLoop, this));
+}
+
+void PlanningServerImpl::drainAndJoinWorkers()
+{
+    // closing the queue lets the workers finish everything already queued and then exit
+    m_queue.close();
+    for (auto& w : m_workers)
+        w.join();
+    m_workers.clear();
+}
+
+void PlanningServerImpl::stop()
+{
+    m_stopping = true;
+}
+
+void PlanningServerImpl::workerLoop()
+{
+    nameTraceThread("server worker");
+    
+    // per-worker routing state, the StreetMap itself is shared read-only between all workers
+    PointToPointRouter router(m_streetMap);
+    DeliveryPlanner planner(m_streetMap, &m_depotTrees);
+    DeliveryOptimizer optimizer(m_streetMap);
+    DepotAssigner assigner(m_streetMap);
+
+    ServerJob job;
+    while (m_queue.pop(job)) {
+        TraceSpan span("server", "request");
+        span.arg("bytes", job.line.size());
+        job.connection->send(handleRequest(job.line, *job.connection, router, planner, optimizer, assigner));
+        span.end();
+
+        // release our hold on the connection right away, so a closed socket doesn't linger until the next job
+        job.connection.reset();
+    }
+}
+
+bool PlanningServerImpl::serveStream(istream& in, ostream& out)
+{
+    installStopHandlers();
+    startWorkers();
+
+    shared_ptr<Connection> connection = make_shared<StreamConnection>(out);
+    string line;
+    while (!stopRequested() && getline(in, line)) {
+        if (line.empty())
+            continue;
+
+        // a shutdown request ends the input; everything before it still gets answered
+        JsonValue request;
+        if (JsonReader(line).parse(request) && request.type == JsonValue::JOBJECT) {
+            const JsonValue* op = request.member("op");
+            if (op != nullptr && op->text == "shutdown")
+                break;
+        }
+
+        ServerJob job;
+        job.connection = connection;
+        job.line = line;
+        if (!m_queue.push(job))
+            break;
+    }
+
+    drainAndJoinWorkers();
+    return true;
+}
+
+void PlanningServerImpl::readConnection(shared_ptr<SocketConnection> connection)
+{
+    string pending;
+    char buf[65536];
+
+    while (!stopRequested()) {
+        ssize_t n = read(connection->fd(), buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; // the client hung up, or we shut down the reading side of the socket
+
+        pending.append(buf, n);
+
+        // hand off every complete line we have received so far
+        size_t lineStart = 0;
+        size_t newline;
+        while ((newline = pending.find('\n', lineStart)) != string::npos) {
+            string line = pending.substr(lineStart, newline - lineStart);
+            lineStart = newline + 1;
+            if (line.empty())
+                continue;
+
+            JsonValue request;
+            if (JsonReader(line).parse(request) && request.type == JsonValue::JOBJECT) {
+                const JsonValue* op = request.member("op");
+                if (op != nullptr && op->text == "shutdown") {
+                    m_stopping = true;
+                    return;
+                }
+            }
+
+            ServerJob job;
+            job.connection = connection;
+            job.line = line;
+
+            // blocks while the queue is full, so a client that floods us simply stops being read
+            if (!m_queue.push(job))
+                return;
+        }
+        pending.erase(0, lineStart);
+
+        if (pending.size() > MAX_REQUEST_LENGTH) {
+            connection->send(errorResponse("null", "request too long"));
+            return;
+        }
+    }
+}
+
+bool PlanningServerImpl::serveUnixSocket(string socketPath)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        return false;
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        return false;
+
+    // a socket file left behind by a previous run would make bind fail
+    unlink(socketPath.c_str());
+    if (bind(listener, (sockaddr*) &address, sizeof(address)) < 0 || listen(listener, 64) < 0) {
+        close(listener);
+        return false;
+    }
+
+    installStopHandlers();
+    startWorkers();
+
+    // every connection gets a reader thread; finished ones are joined as we go
+    struct Reader
+    {
+        thread t;
+        shared_ptr<SocketConnection> connection;
+        shared_ptr<atomic<bool> > done;
+    };
+    list<Reader> readers;
+
+    while (!stopRequested()) {
+        for (auto it = readers.begin(); it != readers.end(); ) {
+            if (*(it->done)) {
+                it->t.join();
+                it = readers.erase(it);
+            }
+            else
+                it++;
+        }
+
+        // poll with a timeout so that we notice a stop request even when nobody connects
+        pollfd p;
+        p.fd = listener;
+        p.events = POLLIN;
+        p.revents = 0;
+        if (poll(&p, 1, 200) <= 0)
+            continue;
+
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+
+        Reader r;
+        r.connection = make_shared<SocketConnection>(fd);
+        r.done = make_shared<atomic<bool> >(false);
+        shared_ptr<SocketConnection> connection = r.connection;
+        shared_ptr<atomic<bool> > done = r.done;
+        r.t = thread([this, connection, done] {
+            readConnection(connection);
+            *done = true;
+        });
+        readers.push_back(move(r));
+    }
+
+    // stop accepting new connections
+    close(listener);
+    unlink(socketPath.c_str());
+
+    // wake up readers blocked on idle clients; the writing side stays open for the replies still owed
+    for (auto& r : readers)
+        shutdown(r.connection->fd(), SHUT_RD);
+    for (auto& r : readers)
+        r.t.join();
+    readers.clear();
+
+    drainAndJoinWorkers();
+    return true;
+}
+
+string PlanningServerImpl::handleRequest(const string& line, Connection& connection, const PointToPointRouter& router,
+                                         const DeliveryPlanner& planner, const DeliveryOptimizer& optimizer,
+                                         const DepotAssigner& assigner)
+{
+    JsonValue request;
+    if (!JsonReader(line).parse(request) || request.type != JsonValue::JOBJECT)
+        return errorResponse("null", "malformed request");
+
+    // echo the id back exactly as it was given, a number or a string
+    string id = "null";
+    const JsonValue* idValue = request.member("id");
+    if (idValue != nullptr && idValue->type == JsonValue::JNUMBER)
+        id = idValue->text;
+    else if (idValue != nullptr && idValue->type == JsonValue::JSTRING)
+        id = jsonString(idValue->text);
+
+    const JsonValue* op = request.member("op");
+    if (op == nullptr || op->type != JsonValue::JSTRING)
+        return errorResponse(id, "missing op");
+    if (op->text == "route")
+        return handleRoute(request, id, router);
+    if (op->text == "plan")
+        return handlePlan(request, id, connection, planner, optimizer, assigner);
+    if (op->text == "close" || op->text == "reopen" || op->text == "weight")
+        return handleMapChange(request, id, op->text);
+    if (op->text == "area")
+        return handleArea(request, id);
+    return errorResponse(id, "unknown op " + op->text);
+}
+
+string PlanningServerImpl::handleRoute(const JsonValue& request, const string& id, const PointToPointRouter& router)
+{
+    GeoCoord start, end;
+    if (!readCoord(request.member("start"), start) || !readCoord(request.member("end"), end))
+        return errorResponse(id, "route needs start and end coordinates");
+
+    list<StreetSegment> route;
+    double distance = 0;
+    DeliveryResult r = router.generatePointToPointRoute(start, end, route, distance);
+    if (r != DELIVERY_SUCCESS)
+        return responseHead(id, resultStatus(r)) + "}";
+
+    string out = responseHead(id, "ok") + ",\"distance\":" + jsonDistance(distance) + ",\"segments\":[";
+    bool first = true;
+    for (const auto& s : route) {
+        if (!first)
+            out += ",";
+        first = false;
+        out += "{\"street\":" + jsonString(s.name) + ",\"start\":" + jsonCoord(s.start) + ",\"end\":" + jsonCoord(s.end) + "}";
+    }
+    return out + "]}";
+}
+
+string PlanningServerImpl::handleMapChange(const JsonValue& request, const string& id, const string& op)
+{
+    GeoCoord start, end;
+    if (!readCoord(request.member("start"), start) || !readCoord(request.member("end"), end))
+        return errorResponse(id, op + " needs start and end coordinates");
+
+    // a street is usually closed in both directions, so that is what we do unless told otherwise
+    const JsonValue* oneWay = request.member("oneWay");
+    bool bothDirections = !(oneWay != nullptr && oneWay->type == JsonValue::JBOOL && oneWay->boolean);
+
+    bool changed;
+    if (op == "weight") {
+        double w;
+        if (!readNumber(request.member("weight"), w))
+            return errorResponse(id, "weight needs a finite weight");
+        changed = m_streetMap->setSegmentWeight(start, end, w);
+        if (changed && bothDirections)
+            m_streetMap->setSegmentWeight(end, start, w);
+    }
+    else {
+        changed = m_streetMap->setSegmentClosed(start, end, op == "close");
+        if (changed && bothDirections)
+            m_streetMap->setSegmentClosed(end, start, op == "close");
+    }
+
+    if (!changed)
+        return errorResponse(id, "no segment from start to end");
+
+    // requests already being routed finish on the map they started with, later ones see the change
+    return responseHead(id, "ok") + ",\"version\":" + to_string(m_streetMap->version()) + "}";
+}
+
+string PlanningServerImpl::handleArea(const JsonValue& request, const string& id)
+{
+    GeoCoord depot;
+    double maxMiles;
+    if (!readCoord(request.member("depot"), depot) || !readNumber(request.member("miles"), maxMiles))
+        return errorResponse(id, "area needs a depot coordinate and miles");
+    if (maxMiles < 0)
+        return errorResponse(id, "miles must not be negative");
+
+    // with a location, the question is only whether that location is within the area
+    GeoCoord location;
+    if (request.member("location") != nullptr) {
+        if (!readCoord(request.member("location"), location))
+            return errorResponse(id, "location must be a coordinate");
+        double distance = 0;
+        DeliveryResult r = m_serviceAreas.findDistanceFromDepot(depot, maxMiles, location, distance);
+        if (r == NO_ROUTE)
+            return responseHead(id, "ok") + ",\"within\":false}";
+        if (r != DELIVERY_SUCCESS)
+            return responseHead(id, resultStatus(r)) + "}";
+        return responseHead(id, "ok") + ",\"within\":true,\"distance\":" + jsonDistance(distance) + "}";
+    }
+
+    vector<GeoCoord> boundary;
+    DeliveryResult r = m_serviceAreas.findServiceAreaBoundary(depot, maxMiles, boundary);
+    if (r != DELIVERY_SUCCESS)
+        return responseHead(id, resultStatus(r)) + "}";
+    string out = responseHead(id, "ok") + ",\"boundary\":[";
+    for (size_t i = 0; i < boundary.size(); i++) {
+        if (i > 0)
+            out += ",";
+        out += jsonCoord(boundary[i]);
+    }
+    return out + "]}";
+}
+
+// a plan's commands as a JSON array
+static string jsonCommands(const vector<DeliveryCommand>& commands)
+{
+    string out = "[";
+    for (size_t i = 0; i < commands.size(); i++) {
+        if (i > 0)
+            out += ",";
+        out += jsonString(commands[i].description());
+    }
+    return out + "]";
+}
+
+string PlanningServerImpl::handlePlan(const JsonValue& request, const string& id, Connection& connection,
+                                      const DeliveryPlanner& planner, const DeliveryOptimizer& optimizer,
+                                      const DepotAssigner& assigner)
+{
+    const JsonValue* deliveryList = request.member("deliveries");
+    if (deliveryList == nullptr || deliveryList->type != JsonValue::JARRAY)
+        return errorResponse(id, "plan needs a deliveries array");
+
+    vector<DeliveryRequest> deliveries;
+    for (const auto& d : deliveryList->elements) {
+        GeoCoord location;
+        const JsonValue* item = d.member("item");
+        if (d.type != JsonValue::JOBJECT || item == nullptr || item->type != JsonValue::JSTRING
+            || !readCoord(d.member("location"), location))
+            return errorResponse(id, "every delivery needs an item and a location");
+        deliveries.push_back(DeliveryRequest(item->text, location));
+    }
+    const JsonValue* optimizeValue = request.member("optimize");
+    bool optimize = optimizeValue != nullptr && optimizeValue->type == JsonValue::JBOOL && optimizeValue->boolean;
+
+    // with several depots, every delivery goes to the nearest one, and each depot gets a plan of its own
+    if (request.member("depots") != nullptr)
+        return handleDepotsPlan(request, id, deliveries, optimize, assigner);
+
+    GeoCoord depot;
+    if (!readCoord(request.member("depot"), depot))
+        return errorResponse(id, "plan needs a depot coordinate");
+
+    // reorder the deliveries first if the client asked for it
+    if (optimize) {
+        double oldCrowDistance, newCrowDistance;
+        optimizer.optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
+    }
+
+    // a streamed plan sends every leg on its own line as soon as it is routed, and then a last line with
+    // the status and distance of the whole plan
+    const JsonValue* streamValue = request.member("stream");
+    if (streamValue != nullptr && streamValue->type == JsonValue::JBOOL && streamValue->boolean) {
+        size_t numLegs = 0;
+        double distance = 0;
+        DeliveryResult r = planner.streamDeliveryPlan(depot, deliveries, [&](const vector<DeliveryCommand>& leg) {
+            connection.send(responseHead(id, "leg") + ",\"leg\":" + to_string(numLegs++) + ",\"commands\":" +
+                            jsonCommands(leg) + "}");
+        }, distance);
+        if (r != DELIVERY_SUCCESS)
+            return responseHead(id, resultStatus(r)) + ",\"legs\":" + to_string(numLegs) + "}";
+        return responseHead(id, "ok") + ",\"distance\":" + jsonDistance(distance) + ",\"legs\":" + to_string(numLegs) + "}";
+    }
+
+    vector<DeliveryCommand> commands;
+    double distance = 0;
+    DeliveryResult r = planner.generateDeliveryPlan(depot, deliveries, commands, distance);
+    if (r != DELIVERY_SUCCESS)
+        return responseHead(id, resultStatus(r)) + "}";
+
+    return responseHead(id, "ok") + ",\"distance\":" + jsonDistance(distance) + ",\"commands\":" + jsonCommands(commands) + "}";
+}
+
+string PlanningServerImpl::handleDepotsPlan(const JsonValue& request, const string& id,
+                                            const vector<DeliveryRequest>& deliveries, bool optimize,
+                                            const DepotAssigner& assigner)
+{
+    const JsonValue* depotList = request.member("depots");
+    vector<GeoCoord> depots;
+    if (depotList->type == JsonValue::JARRAY) {
+        for (const auto& d : depotList->elements) {
+            GeoCoord depot;
+            if (!readCoord(&d, depot))
+                return errorResponse(id, "depots must be coordinates");
+            depots.push_back(depot);
+        }
+    }
+    if (depots.empty())
+        return errorResponse(id, "depots must be coordinates");
+
+    vector<DepotPlan> plans;
+    vector<DeliveryRequest> unassigned;
+    DeliveryResult r = assigner.planDeliveries(depots, deliveries, optimize, plans, unassigned);
+    if (r != DELIVERY_SUCCESS)
+        return responseHead(id, resultStatus(r)) + "}";
+
+    // plans come in the order of the depots, and the deliveries no depot can reach are named by their items
+    string out = responseHead(id, "ok") + ",\"plans\":[";
+    for (size_t i = 0; i < plans.size(); i++) {
+        if (i > 0)
+            out += ",";
+        out += "{\"depot\":" + jsonCoord(plans[i].depot) + ",\"status\":" + jsonString(resultStatus(plans[i].result));
+        if (plans[i].result == DELIVERY_SUCCESS)
+            out += ",\"distance\":" + jsonDistance(plans[i].totalDistanceTravelled) + ",\"commands\":" + jsonCommands(plans[i].commands);
+        out += "}";
+    }
+    out += "],\"unassigned\":[";
+    for (size_t i = 0; i < unassigned.size(); i++) {
+        if (i > 0)
+            out += ",";
+        out += jsonString(unassigned[i].item);
+    }
+    return out + "]}";
+}
+
+//******************** PlanningServer functions *******************************
+
+// These functions simply delegate to PlanningServerImpl's functions.
+
+PlanningServer::PlanningServer(StreetMap* sm, int numWorkers, int queueCapacity)
+{
+    m_impl = new PlanningServerImpl(sm, numWorkers, queueCapacity);
+}
+
+PlanningServer::~PlanningServer()
+{
+    delete m_impl;
+}
+
+bool PlanningServer::addDepot(const GeoCoord& depot)
+{
+    return m_impl->addDepot(depot);
+}
+
+bool PlanningServer::serveStream(istream& in, ostream& out)
+{
+    return m_impl->serveStream(in, out);
+}
+
+bool PlanningServer::serveUnixSocket(string socketPath)
+{
+    return m_impl->serveUnixSocket(socketPath);
+}
+
+void PlanningServer::stop()
+{
+    m_impl->stop();
+}
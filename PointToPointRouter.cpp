@@ -1,42 +1,46 @@
 #include "provided.h"
-#include "ExpandableHashMap.h"
+#include "MapSnapshot.h"
+#include "ChainSearch.h"
+#include "RouteCache.h"
+#include "Trace.h"
 #include <list>
-#include <limits>
+#include <vector>
 #include <iostream>
-#include <set>
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <cmath>
 using namespace std;
 
-#define MAX_DOUBLE numeric_limits<double>::max()
-
-// declaring additional struct for implementing Dijkstra's Algorithm
-// This additional functionality is needed to elegantly implement generatePointToPointRoute
-struct processCoord {
-
-    // the location of a processCoord is that of the GeoCoord it represents
-    GeoCoord location;
-
-    // variable required for Dijkstra's algorithm implementation
-    double distanceFromSource = MAX_DOUBLE; // initializing all distances to infinity by default
-
-    // < operator defined to use sets of processCoords, ordered by distance
-    bool operator<(const processCoord &rhs) const {
-        return (this->distanceFromSource < rhs.distanceFromSource);
-    }
-};
+/*
+ Concurrency: any number of threads may route at once, with one shared router or a router each
+ A router holds nothing but a pointer to its map, so creating one per thread costs a single small allocation
+ All mutable search state lives in the calling thread's workspace (see ChainSearch.h), and the map is only read through
+ an immutable snapshot, so no locking happens during a search
+ */
 
 class PointToPointRouterImpl
 {
 public:
     PointToPointRouterImpl(const StreetMap* sm);
+    PointToPointRouterImpl(shared_ptr<const MapSnapshot> snapshot);
     ~PointToPointRouterImpl();
     DeliveryResult generatePointToPointRoute(
         const GeoCoord& start,
         const GeoCoord& end,
-        list<StreetSegment>& route,
-        double& totalDistanceTravelled) const;
+        StreetPath& route,
+        double& totalDistanceTravelled,
+        const atomic<bool>* cancelled) const;
 
 private:
+    // a router either follows a StreetMap as it changes, or sticks to one snapshot of it
     const StreetMap* m_streetMap;
+    shared_ptr<const MapSnapshot> m_pinnedSnapshot;
+
+    shared_ptr<const MapSnapshot> currentSnapshot() const
+    {
+        return m_streetMap != nullptr ? m_streetMap->snapshot() : m_pinnedSnapshot;
+    }
 };
 
 PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm)
@@ -44,143 +48,216 @@ PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm)
 {
 }
 
+PointToPointRouterImpl::PointToPointRouterImpl(shared_ptr<const MapSnapshot> snapshot)
+    : m_streetMap(nullptr), m_pinnedSnapshot(snapshot)
+{
+}
+
 PointToPointRouterImpl::~PointToPointRouterImpl() = default;
 
+// true if the edges lead one after another from source to target; a cached route is checked before it is
+// trusted, since a damaged cache file could otherwise send a route anywhere
+static bool isPath(const MapData& graph, int source, int target, const vector<int>& path)
+{
+    int at = source;
+    for (int e : path) {
+        if (e < 0 || (size_t) e >= graph.edgeSource.size() || graph.edgeSource[e] != at)
+            return false;
+        at = graph.edgeTarget[e];
+    }
+    return at == target;
+}
+
 DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
         const GeoCoord& start,
         const GeoCoord& end,
-        list<StreetSegment>& route,
-        double& totalDistanceTravelled) const
+        StreetPath& route,
+        double& totalDistanceTravelled,
+        const atomic<bool>* cancelled) const
 {
     /*
-     * This function uses an adapted form of Dijkstra's Algorithm to find the shortest path from one GeoCoord to another
+     * This function uses Dijkstra's Algorithm to find the shortest path from one GeoCoord to another
      */
 
     // if the start and end coordinates are equal, we simply return after setting the arguments to correct values
     if (start == end) {
-        route.clear();
+        route = StreetPath(currentSnapshot(), vector<int>());
         totalDistanceTravelled = 0;
         return DELIVERY_SUCCESS;
     }
 
+    // the coordinates are only put together into text when someone will read them
+    TraceSpan span("route", "route");
+    if (tracing()) {
+        span.arg("start", start.latitudeText + "," + start.longitudeText);
+        span.arg("end", end.latitudeText + "," + end.longitudeText);
+    }
+
+    // the whole search runs against one snapshot of the map, so that closures published while we are searching can't confuse us
+    shared_ptr<const MapSnapshot> snapshot = currentSnapshot();
+    const MapData& graph = snapshot->data();
+
     // if one or both of start and end do not exist in our map data, return BAD_COORD
-    vector<StreetSegment> checker; // a vector used to call getStreetSegmentsThatStartWith to determine if a bad coordinate has been passed
-    if (!m_streetMap->getSegmentsThatStartWith(start, checker) || !m_streetMap->getSegmentsThatStartWith(end, checker))
+    int source = graph.nodeOf(start);
+    int target = graph.nodeOf(end);
+    if (source < 0 || target < 0)
         return BAD_COORD;
+    graph.useNode(source);
+    graph.useNode(target);
+
+    // searching from one piece of the map for a node on another piece would explore the whole of the first piece
+    if (!graph.mayBeConnected(source, target))
+        return NO_ROUTE;
+
+    // routes found in earlier runs are only still the shortest while nothing on the map has been changed
+    shared_ptr<RouteCache> cache = snapshot->unchanged() ? graph.routeCache() : nullptr;
+    vector<int> path;
+    if (cache != nullptr && cache->find(source, target, totalDistanceTravelled, path) && isPath(graph, source, target, path)) {
+        for (int e : path)
+            graph.useNode(graph.edgeTarget[e]);
+        route = StreetPath(snapshot, move(path));
+        span.arg("cached", 1);
+        return DELIVERY_SUCCESS;
+    }
 
-    // initializing the source vertex
-    processCoord source;
-    source.location = start;
-    source.distanceFromSource = 0;
-
-    set<processCoord> processed; // set to store those coordinates which have already been processed
-    vector<StreetSegment> processor; // vector to get set of neighbors of the current coordinate (in call to getStreetSegmentsThatStartWith)
-    set<processCoord> vertexQueue; // set to represent priority queue on which to run Dijkstra's Algorithm
-    
-     // hashmap to store distance from the source to the coordinates for which we have some initial value
-    ExpandableHashMap<GeoCoord, double> distanceMap;
-    
-    // hashmap to store how the destination has to be reached, by associating each location with the segment is must be reached from
-    ExpandableHashMap<GeoCoord, StreetSegment> routeMap;
-
-    // initially, we insert only the source vertex into the priority queue
-    vertexQueue.insert(source);
-    
-    // the distance to the source is obviously, zero
-    distanceMap.associate(source.location, 0);
+    // the distance, parent and settled arrays come from this thread's workspace, already sized to the graph
+    ChainSearch search(*snapshot, threadSearchWorkspace());
+    const SearchWorkspace& ws = search.workspace();
+    search.start(source, target);
 
     // Dijkstra Processing
-    while (!vertexQueue.empty()) {
+    int current;
+    int numSettled = 0;
+    while ((current = search.settleNext()) >= 0) {
+
+        // someone else has decided they no longer need this route
+        if (cancelled != nullptr && cancelled->load(memory_order_relaxed)) {
+            span.arg("cancelled", 1);
+            return NO_ROUTE;
+        }
+        numSettled++;
 
-        // get the closest vertex to source. A set will store the vertices in sorted order
-        processCoord current = *(vertexQueue.begin());
+        // If the current vertex is the destination vertex, we update the arguments to appropriate values and return
+        if (current == target) {
+
+            // backtrack along the chains, collecting the edges of the route from last to first
+            path.clear();
+            for (int node = target; node != source; ) {
+                int parent = ws.parentEdge(node);
+                bool fromSource = parent <= -2;
+                int chain = fromSource ? -2 - parent : parent;
+
+                // only part of a chain is travelled where the route starts or ends in the middle of it
+                int first = graph.chainFirstEdge[chain];
+                int last = graph.chainFirstEdge[chain + 1];
+                if (node == target && !graph.isChainEnd(target))
+                    last = first + graph.offsetOnChain(target, chain);
+                if (fromSource)
+                    first += graph.offsetOnChain(source, chain);
+
+                for (int i = last - 1; i >= first; i--) {
+                    path.push_back(graph.chainEdges[i]);
+                    graph.useNode(graph.edgeTarget[path.back()]);
+                }
+                node = fromSource ? source : graph.chainSource[chain];
+            }
+            reverse(path.begin(), path.end());
+
+            // the search minimizes segment weights, but the distance travelled is the actual length of the route
+            totalDistanceTravelled = 0;
+            for (int e : path)
+                totalDistanceTravelled += graph.edgeLength[e];
+            if (cache != nullptr)
+                cache->add(source, target, totalDistanceTravelled, path);
+            route = StreetPath(snapshot, move(path));
+            span.arg("settled", numSettled);
+            return DELIVERY_SUCCESS;
+        }
 
-        // remove it from the priority queue
-        vertexQueue.erase(vertexQueue.begin());
+        // update distances from source of the chain ends one chain away, if required
+        search.expand(current);
+    }
 
-        /*
-         * if we have already processed a vertex, do not process it again
-         * Notice how there is a difference between visiting a vertex and processing it
-         * A vertex will be visited each time a neighbor of itself is processed
-         * Whereas it will itself be processed only once
-        */
-        
-        
-        // if the current vertex exists in our 'processed' set, find() will return an iterator other than end()
-        if (processed.find(current) != processed.end())
-            continue;
+    // NO_ROUTE returned when after all the processing, we could not find a route from source to destination
+    span.arg("settled", numSettled);
+    return NO_ROUTE;
+}
 
+//******************** StreetPath functions ***********************************
 
-        //If this is a new vertex to be processed, insert it into the processed set
-        processed.insert(current);
+StreetPath::StreetPath() = default;
 
-        // If the current vertex is the destination vertex, we update the arguments to appropriate values and return
-        if (current.location == end) {
+StreetPath::StreetPath(shared_ptr<const MapSnapshot> snapshot, vector<int> edges)
+    : m_snapshot(snapshot), m_edges(move(edges))
+{
+}
 
-            // the total distance travelled is the distance from the source vertex
-            totalDistanceTravelled = *(distanceMap.find(end));
+void StreetPath::clear()
+{
+    m_snapshot.reset();
+    m_edges.clear();
+}
+
+StreetSegment StreetPath::segment(size_t i) const
+{
+    const MapData& graph = m_snapshot->data();
+    graph.useNode(graph.edgeSource[m_edges[i]]);
+    graph.useNode(graph.edgeTarget[m_edges[i]]);
+    return graph.segment(m_edges[i]);
+}
 
-            // clear out the route parameter first so that there are no unnecessary/incorrect segments already in it
-            route.clear();
+void StreetPath::toList(list<StreetSegment>& route) const
+{
+    route.clear();
+    for (size_t i = 0; i < m_edges.size(); i++)
+        route.push_back(segment(i));
+}
 
-            // backtrack using the routeMap
-            GeoCoord routeConstructor = current.location;
-            while (routeConstructor != start) {
-                
-                StreetSegment toBeAdded = *(routeMap.find(routeConstructor));
+string StreetPath::streetName(size_t i) const
+{
+    return m_snapshot->data().streetName(m_snapshot->data().edgeStreet[m_edges[i]]);
+}
 
-                // using push_front so that the route is in order, since in our loop we're going from destination -> source
-                route.push_front(toBeAdded);
-                
-                // update routeConstructor to the previous GeoCoord on our route
-                routeConstructor = toBeAdded.start;
-            }
-            return DELIVERY_SUCCESS;
-        }
+bool StreetPath::sameStreet(size_t i, size_t j) const
+{
+    // every street in the file has a number of its own, so two numbers may still share a name
+    const MapData& graph = m_snapshot->data();
+    int a = graph.edgeStreet[m_edges[i]];
+    int b = graph.edgeStreet[m_edges[j]];
+    return a == b || graph.streetName(a) == graph.streetName(b);
+}
 
-        // if we are not at the destination point yet, get all neighbors of the current vertex
-        // if the location is not in our map, return BAD_COORD
-        if (!m_streetMap->getSegmentsThatStartWith(current.location, processor))
-            return BAD_COORD;
-
-        // update distances from source of all neighbors if required
-        for (const auto &x : processor) { // for all the street segments beginning at a particular vertex
-
-            // convert the end of the StreetSegment (in other words, neighbor of the current vertex) from a GeoCoord to a processCoord
-            processCoord temp;
-            temp.location = x.end;
-            
-            // distance used to compare needs to be stored in a variable
-            // we may already have computed an initial distance to this location, in which case we take that value for comparison
-            double comparisonDistance;
-            if (distanceMap.find(temp.location) != nullptr) {
-                comparisonDistance = *(distanceMap.find(temp.location));
-            }
-            
-            // if we have not already computed a value, we take the default value (infinity)
-            else
-                comparisonDistance = temp.distanceFromSource;
-
-            // compute the value of a new possible distance
-            double possibleNewDistance = distanceEarthMiles(current.location, x.end) + current.distanceFromSource;
-
-            // if the new distance is shorter than the original one, update appropriate fields
-            if (possibleNewDistance < comparisonDistance) {
-                temp.distanceFromSource = possibleNewDistance;
-                distanceMap.associate(temp.location, possibleNewDistance);
-                routeMap.associate(temp.location, x);
-            }
+double StreetPath::length(size_t i) const
+{
+    return m_snapshot->data().edgeLength[m_edges[i]];
+}
 
-            // insert the current neighbor into the queue so that it can be processed
-            vertexQueue.insert(temp);
-        }
+// the direction of an edge in radians, worked out the way angleOfLine does it but from the numbers
+static double edgeDirection(const MapData& graph, int edge)
+{
+    double lat1, lon1, lat2, lon2;
+    graph.useNode(graph.edgeSource[edge]);
+    graph.useNode(graph.edgeTarget[edge]);
+    graph.location(graph.edgeSource[edge], lat1, lon1);
+    graph.location(graph.edgeTarget[edge], lat2, lon2);
+    return atan2(lat2 - lat1, lon2 - lon1);
+}
 
-        // clear out the vector of street segments so that the next vertex can be processed
-        processor.clear();
-    }
+double StreetPath::angle(size_t i) const
+{
+    double result = rad2deg(edgeDirection(m_snapshot->data(), m_edges[i]));
+    if (result < 0)
+        result += 360;
+    return result;
+}
 
-    // NO_ROUTE returned when after all the processing, we could not find a route from source to destination
-    return NO_ROUTE;
+double StreetPath::turnAngle(size_t i) const
+{
+    const MapData& graph = m_snapshot->data();
+    double result = rad2deg(edgeDirection(graph, m_edges[i]) - edgeDirection(graph, m_edges[i - 1]));
+    if (result < 0)
+        result += 360;
+    return result;
 }
 
 //******************** PointToPointRouter functions ***************************
@@ -193,6 +270,11 @@ PointToPointRouter::PointToPointRouter(const StreetMap* sm)
     m_impl = new PointToPointRouterImpl(sm);
 }
 
+PointToPointRouter::PointToPointRouter(shared_ptr<const MapSnapshot> snapshot)
+{
+    m_impl = new PointToPointRouterImpl(snapshot);
+}
+
 PointToPointRouter::~PointToPointRouter()
 {
     delete m_impl;
@@ -204,5 +286,29 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
         list<StreetSegment>& route,
         double& totalDistanceTravelled) const
 {
-    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
+    return generatePointToPointRoute(start, end, route, totalDistanceTravelled, nullptr);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled,
+        const atomic<bool>* cancelled) const
+{
+    StreetPath path;
+    DeliveryResult result = m_impl->generatePointToPointRoute(start, end, path, totalDistanceTravelled, cancelled);
+    if (result == DELIVERY_SUCCESS)
+        path.toList(route);
+    return result;
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        StreetPath& path,
+        double& totalDistanceTravelled,
+        const atomic<bool>* cancelled) const
+{
+    return m_impl->generatePointToPointRoute(start, end, path, totalDistanceTravelled, cancelled);
 }
@@ -0,0 +1,403 @@
+#include "RouteCache.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+using namespace std;
+
+/*
+ A route cache file starts with a header naming the map it was written for, followed by one record per
+ route. Every record carries its length and a checksum of its contents, so a run which crashed (or was
+ killed) half way through appending leaves a damaged last record, which the next run recognizes and
+ cuts off. When the file has to shrink, the routes worth keeping are written to a new file, which then
+ replaces the old one in a single rename, so at any moment the file is either the old one or the new one.
+
+ Saving happens with the file locked, appending and rewriting alike. A rewrite renames a new file into
+ place, so a run which has locked the file checks that it is still the one at the path, and a run which
+ last saw the old one reads the new one from the start; either way, the routes other runs saved are
+ taken in before ours are added, rather than ours being written over theirs.
+
+ Routes are stored as edge numbers, which mean nothing on another map, so the header holds the
+ fingerprint of the map; a file written for a different map (or a different version of the same map)
+ is treated as empty and is replaced once there is something to save.
+ */
+
+const char ROUTE_CACHE_MAGIC[8] = { 'G', 'O', 'O', 'B', 'R', 'O', 'U', 'T' };
+const uint32_t ROUTE_CACHE_VERSION = 1;
+
+struct RouteCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t unused;
+    uint64_t fingerprint;
+};
+
+// a record is the length and checksum of its contents, then the source, target, distance,
+// number of edges and the edges themselves
+struct RecordHeader
+{
+    uint32_t length;
+    uint32_t checksum;
+};
+
+const size_t RECORD_FIXED_BYTES = 2 * sizeof(int32_t) + sizeof(double) + sizeof(uint32_t);
+
+// when the file is rewritten, it is cut down to this fraction of its size limit, so that it
+// isn't rewritten again the very next time a few routes are added
+const double REWRITE_FILL = 0.75;
+
+static uint32_t checksum(const char* data, size_t length)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char) data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static size_t recordBytes(size_t numEdges)
+{
+    return sizeof(RecordHeader) + RECORD_FIXED_BYTES + numEdges * sizeof(int32_t);
+}
+
+static void appendRecord(string& out, int source, int target, double distance, const vector<int>& edges)
+{
+    string payload(RECORD_FIXED_BYTES + edges.size() * sizeof(int32_t), '\0');
+    int32_t s = source, t = target;
+    uint32_t count = edges.size();
+    char* p = &payload[0];
+    memcpy(p, &s, sizeof(s));
+    memcpy(p + 4, &t, sizeof(t));
+    memcpy(p + 8, &distance, sizeof(distance));
+    memcpy(p + 16, &count, sizeof(count));
+    for (size_t i = 0; i < edges.size(); i++) {
+        int32_t e = edges[i];
+        memcpy(p + RECORD_FIXED_BYTES + i * sizeof(e), &e, sizeof(e));
+    }
+
+    RecordHeader h;
+    h.length = payload.size();
+    h.checksum = checksum(payload.data(), payload.size());
+    out.append((const char*) &h, sizeof(h));
+    out += payload;
+}
+
+// reads the intact records in data[from, size), passing each to found, and returns where the last one ends
+template <typename F>
+static size_t scanRecords(const char* data, size_t size, size_t from, F found)
+{
+    size_t at = from;
+    while (size - at >= sizeof(RecordHeader)) {
+        RecordHeader h;
+        memcpy(&h, data + at, sizeof(h));
+        const char* p = data + at + sizeof(h);
+        if (h.length < RECORD_FIXED_BYTES || h.length > size - at - sizeof(h)
+            || checksum(p, h.length) != h.checksum)
+            break;
+
+        int32_t source, target;
+        double distance;
+        uint32_t count;
+        memcpy(&source, p, sizeof(source));
+        memcpy(&target, p + 4, sizeof(target));
+        memcpy(&distance, p + 8, sizeof(distance));
+        memcpy(&count, p + 16, sizeof(count));
+        if (h.length != RECORD_FIXED_BYTES + (size_t) count * sizeof(int32_t))
+            break;
+        vector<int> edges(count);
+        for (uint32_t i = 0; i < count; i++) {
+            int32_t e;
+            memcpy(&e, p + RECORD_FIXED_BYTES + i * sizeof(e), sizeof(e));
+            edges[i] = e;
+        }
+        found(source, target, distance, edges);
+        at += sizeof(h) + h.length;
+    }
+    return at;
+}
+
+// reads all of a file from the given offset
+static bool readFrom(int fd, size_t from, string& bytes)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return false;
+    bytes.clear();
+    if ((size_t) st.st_size <= from)
+        return true;
+    bytes.resize(st.st_size - from);
+    size_t done = 0;
+    while (done < bytes.size()) {
+        ssize_t n = pread(fd, &bytes[done], bytes.size() - done, from + done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const string& bytes)
+{
+    size_t done = 0;
+    while (done < bytes.size()) {
+        ssize_t n = write(fd, bytes.data() + done, bytes.size() - done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+RouteCache::RouteCache(const string& cacheFile, size_t maxBytes, unsigned long long fingerprint)
+    : m_file(cacheFile), m_maxBytes(maxBytes), m_fingerprint(fingerprint),
+      m_clock(0), m_fileBytes(0), m_fileDevice(0), m_fileInode(0), m_unsavedBytes(0), m_hits(0), m_misses(0)
+{
+}
+
+shared_ptr<RouteCache> RouteCache::open(const string& cacheFile, size_t maxBytes, unsigned long long fingerprint)
+{
+    shared_ptr<RouteCache> cache(new RouteCache(cacheFile, maxBytes, fingerprint));
+    cache->read();
+    return cache;
+}
+
+void RouteCache::read()
+{
+    int fd = ::open(m_file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    string bytes;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && readFrom(fd, 0, bytes);
+    close(fd);
+
+    RouteCacheHeader h;
+    if (!ok || bytes.size() < sizeof(h))
+        return;
+    memcpy(&h, bytes.data(), sizeof(h));
+    if (memcmp(h.magic, ROUTE_CACHE_MAGIC, sizeof(h.magic)) != 0 || h.version != ROUTE_CACHE_VERSION
+        || h.fingerprint != m_fingerprint)
+        return;
+    m_fileDevice = st.st_dev;
+    m_fileInode = st.st_ino;
+
+    // later records of the same route replace earlier ones, and count as more recently used
+    m_fileBytes = scanRecords(bytes.data(), bytes.size(), sizeof(h),
+        [this](int source, int target, double distance, vector<int>& edges) {
+            Entry& e = m_entries[keyOf(source, target)];
+            e.distance = distance;
+            e.edges.swap(edges);
+            e.lastUse = ++m_clock;
+            e.saved = true;
+        });
+}
+
+bool RouteCache::find(int source, int target, double& distance, vector<int>& edges)
+{
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m_entries.find(keyOf(source, target));
+    if (it == m_entries.end()) {
+        m_misses++;
+        return false;
+    }
+    m_hits++;
+    it->second.lastUse = ++m_clock;
+    distance = it->second.distance;
+    edges = it->second.edges;
+    return true;
+}
+
+void RouteCache::add(int source, int target, double distance, const vector<int>& edges)
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    // routes which could never all fit in the file aren't worth holding on to until the next save
+    size_t bytes = recordBytes(edges.size());
+    if (m_unsavedBytes + bytes > m_maxBytes)
+        return;
+
+    Entry& e = m_entries[keyOf(source, target)];
+    e.distance = distance;
+    e.edges = edges;
+    e.lastUse = ++m_clock;
+    e.saved = false;
+    m_unsavedBytes += bytes;
+}
+
+bool RouteCache::save()
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_unsavedBytes == 0)
+        return true;
+    int fd = lockFile();
+    if (fd < 0)
+        return false;
+    bool ok = takeIn(fd);
+    if (ok)
+        ok = (m_fileBytes == 0 || m_fileBytes + m_unsavedBytes > m_maxBytes) ? rewrite() : append(fd);
+    close(fd);      // which unlocks it, once a rewrite's new file is in place
+    return ok;
+}
+
+int RouteCache::lockFile() const
+{
+    for (;;) {
+        int fd = ::open(m_file.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            return -1;
+        flock(fd, LOCK_EX);
+
+        // another run may have renamed a new file into place while we waited, leaving us the old one
+        struct stat opened, current;
+        if (fstat(fd, &opened) == 0 && stat(m_file.c_str(), &current) == 0 &&
+            opened.st_dev == current.st_dev && opened.st_ino == current.st_ino)
+            return fd;
+        close(fd);
+    }
+}
+
+bool RouteCache::takeIn(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return false;
+
+    // if this is the file we last read or wrote, only what other runs appended since is new; a run which
+    // crashed may have left a damaged record at the end, which is cut off when we append. Any other file
+    // was written by another run (or for another map), and is read from the start.
+    size_t from = m_fileBytes;
+    if (m_fileBytes == 0 || (unsigned long long) st.st_dev != m_fileDevice ||
+        (unsigned long long) st.st_ino != m_fileInode || (size_t) st.st_size < m_fileBytes) {
+        m_fileBytes = 0;
+        m_fileDevice = st.st_dev;
+        m_fileInode = st.st_ino;
+        string header;
+        RouteCacheHeader h;
+        if (!readFrom(fd, 0, header) || header.size() < sizeof(h))
+            return true;
+        memcpy(&h, header.data(), sizeof(h));
+        if (memcmp(h.magic, ROUTE_CACHE_MAGIC, sizeof(h.magic)) != 0 || h.version != ROUTE_CACHE_VERSION
+            || h.fingerprint != m_fingerprint)
+            return true;
+        from = sizeof(h);
+    }
+
+    string tail;
+    if (!readFrom(fd, from, tail))
+        return false;
+    m_fileBytes = from + scanRecords(tail.data(), tail.size(), 0,
+        [this](int source, int target, double distance, vector<int>& edges) {
+            auto it = m_entries.find(keyOf(source, target));
+            if (it != m_entries.end() && !it->second.saved)
+                return;
+            Entry& e = m_entries[keyOf(source, target)];
+            e.distance = distance;
+            e.edges.swap(edges);
+            e.lastUse = ++m_clock;
+            e.saved = true;
+        });
+    return true;
+}
+
+bool RouteCache::append(int fd)
+{
+    string out;
+    for (const auto& kv : m_entries) {
+        if (!kv.second.saved)
+            appendRecord(out, kv.first >> 32, (int) (kv.first & 0xffffffffu), kv.second.distance, kv.second.edges);
+    }
+
+    // the new records only count once they are safely on disk
+    size_t end = m_fileBytes;
+    if (ftruncate(fd, end) != 0 || lseek(fd, end, SEEK_SET) != (off_t) end || !writeAll(fd, out) || fsync(fd) != 0)
+        return false;
+
+    for (auto& kv : m_entries)
+        kv.second.saved = true;
+    m_fileBytes = end + out.size();
+    m_unsavedBytes = 0;
+    return true;
+}
+
+bool RouteCache::rewrite()
+{
+    // keep the most recently used routes which fit
+    vector<pair<unsigned long long, unsigned long long> > byUse;   // (last use, key)
+    for (const auto& kv : m_entries)
+        byUse.push_back(make_pair(kv.second.lastUse, kv.first));
+    sort(byUse.begin(), byUse.end(), greater<pair<unsigned long long, unsigned long long> >());
+
+    RouteCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ROUTE_CACHE_MAGIC, sizeof(h.magic));
+    h.version = ROUTE_CACHE_VERSION;
+    h.fingerprint = m_fingerprint;
+    string out((const char*) &h, sizeof(h));
+
+    size_t limit = m_maxBytes * REWRITE_FILL;
+    size_t bytes = out.size();
+    size_t kept = 0;
+    for (; kept < byUse.size(); kept++) {
+        bytes += recordBytes(m_entries[byUse[kept].second].edges.size());
+        if (bytes > limit)
+            break;
+    }
+
+    // the oldest routes go first in the file, so that they are still the oldest when it is next read
+    for (size_t i = kept; i-- > 0; ) {
+        unsigned long long key = byUse[i].second;
+        const Entry& e = m_entries[key];
+        appendRecord(out, key >> 32, (int) (key & 0xffffffffu), e.distance, e.edges);
+    }
+
+    // the caller holds the lock on the file this replaces, so no other run writes the temporary file meanwhile
+    string temp = m_file + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    bool ok = writeAll(fd, out) && fsync(fd) == 0 && fstat(fd, &st) == 0;
+    close(fd);
+    if (!ok || rename(temp.c_str(), m_file.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    m_fileDevice = st.st_dev;
+    m_fileInode = st.st_ino;
+
+    // the routes which didn't fit are forgotten
+    for (size_t i = kept; i < byUse.size(); i++)
+        m_entries.erase(byUse[i].second);
+    for (auto& kv : m_entries)
+        kv.second.saved = true;
+    m_fileBytes = out.size();
+    m_unsavedBytes = 0;
+    return true;
+}
+
+size_t RouteCache::size() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+size_t RouteCache::hits() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_hits;
+}
+
+size_t RouteCache::misses() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_misses;
+}
@@ -0,0 +1,100 @@
+// RouteCache.h
+
+//  Routes found on a map, kept in a file so that later runs on the same map don't search for them again
+//  the file is an append-only log: a run reads it when the cache is opened, and adds the routes it found
+//  when the cache is saved
+
+#ifndef ROUTECACHE_H
+#define ROUTECACHE_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// how big a route cache file may grow, unless told otherwise
+const size_t DEFAULT_ROUTE_CACHE_BYTES = 64 << 20;
+
+class RouteCache
+{
+public:
+    // reads the routes cached for the map with the given fingerprint; a missing file, or one written
+    // for another map, gives an empty cache, and the file is replaced when the cache is next saved
+    static std::shared_ptr<RouteCache> open(const std::string& cacheFile, size_t maxBytes, unsigned long long fingerprint);
+
+    // routes are cached by the nodes they start and end at, as the edges they follow, in order
+    bool find(int source, int target, double& distance, std::vector<int>& edges);
+    void add(int source, int target, double distance, const std::vector<int>& edges);
+
+    // appends the routes added since the last save to the file; if that would take the file over
+    // its size limit, the file is rewritten instead, keeping only the most recently used routes
+    bool save();
+
+    unsigned long long fingerprint() const
+    {
+        return m_fingerprint;
+    }
+
+    const std::string& file() const
+    {
+        return m_file;
+    }
+
+    size_t maxBytes() const
+    {
+        return m_maxBytes;
+    }
+
+    size_t size() const;
+    size_t hits() const;
+    size_t misses() const;
+
+    // C++11 syntax for preventing copying and assignment
+    RouteCache(const RouteCache&) = delete;
+    RouteCache& operator=(const RouteCache&) = delete;
+
+private:
+    RouteCache(const std::string& cacheFile, size_t maxBytes, unsigned long long fingerprint);
+
+    struct Entry
+    {
+        double distance;
+        std::vector<int> edges;
+        unsigned long long lastUse;     // larger is more recent; entries read from the file start in file order
+        bool saved;                     // already in the file
+    };
+
+    std::string m_file;
+    size_t m_maxBytes;
+    unsigned long long m_fingerprint;
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<unsigned long long, Entry> m_entries;   // keyed by source and target, see keyOf
+    unsigned long long m_clock;
+    size_t m_fileBytes;         // the end of the last intact record in the file, or 0 if the file has to be rewritten
+    unsigned long long m_fileDevice;    // which file that is, so that one renamed into its place by another
+    unsigned long long m_fileInode;     // run isn't taken for it
+    size_t m_unsavedBytes;
+    size_t m_hits;
+    size_t m_misses;
+
+    static unsigned long long keyOf(int source, int target)
+    {
+        return (unsigned long long) (unsigned int) source << 32 | (unsigned int) target;
+    }
+
+    void read();
+
+    // opens the file and locks it, creating it if there is none; -1 if it can't be opened
+    int lockFile() const;
+
+    // takes in the routes other runs added to the locked file since we last read or wrote it
+    bool takeIn(int fd);
+
+    bool append(int fd);
+    bool rewrite();
+};
+
+
+#endif // ROUTECACHE_H
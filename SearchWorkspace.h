@@ -0,0 +1,117 @@
+// SearchWorkspace.h
+
+//  Scratch space for shortest path searches over the street graph
+//  the arrays are indexed by node and kept between searches, so a search allocates nothing once
+//  the workspace has grown to the size of the graph; instead of clearing the arrays, every search
+//  gets a new epoch number, and an entry only counts if it was stamped with the current epoch
+
+#ifndef SEARCHWORKSPACE_H
+#define SEARCHWORKSPACE_H
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+class SearchWorkspace
+{
+public:
+    SearchWorkspace();
+
+    // gets ready for a new search over a graph with numNodes nodes, forgetting the previous search in O(1)
+    void startSearch(int numNodes);
+
+    // has the node been given a tentative distance in this search?
+    bool reached(int node) const
+    {
+        return m_reachedEpoch[node] == m_epoch;
+    }
+
+    // has the node's distance been finalized in this search?
+    bool settled(int node) const
+    {
+        return m_settledEpoch[node] == m_epoch;
+    }
+
+    double distance(int node) const
+    {
+        return m_distance[node];
+    }
+
+    // the edge (or, for the router, the chain of edges) the node was reached by, or -1 for the source
+    int parentEdge(int node) const
+    {
+        return m_parentEdge[node];
+    }
+
+    // records a (shorter) distance to the node and queues it to be settled
+    void reach(int node, double distance, int parentEdge)
+    {
+        m_reachedEpoch[node] = m_epoch;
+        m_distance[node] = distance;
+        m_parentEdge[node] = parentEdge;
+        m_queue.push_back(std::make_pair(distance, node));
+        std::push_heap(m_queue.begin(), m_queue.end(), std::greater<std::pair<double, int> >());
+    }
+
+    void settle(int node)
+    {
+        m_settledEpoch[node] = m_epoch;
+    }
+
+    // removes and returns the queued node with the smallest distance, or -1 if the queue is empty
+    // a node can be queued several times, so callers skip nodes which are already settled
+    int popClosest()
+    {
+        if (m_queue.empty())
+            return -1;
+        std::pop_heap(m_queue.begin(), m_queue.end(), std::greater<std::pair<double, int> >());
+        int node = m_queue.back().second;
+        m_queue.pop_back();
+        return node;
+    }
+
+    // C++11 syntax for preventing copying and assignment
+    SearchWorkspace(const SearchWorkspace&) = delete;
+    SearchWorkspace& operator=(const SearchWorkspace&) = delete;
+
+private:
+    unsigned int m_epoch;
+    std::vector<unsigned int> m_reachedEpoch;
+    std::vector<unsigned int> m_settledEpoch;
+    std::vector<double> m_distance;
+    std::vector<int> m_parentEdge;
+
+    // a binary heap of (distance, node) pairs, which keeps its capacity from one search to the next
+    std::vector<std::pair<double, int> > m_queue;
+};
+
+
+inline SearchWorkspace::SearchWorkspace()
+        : m_epoch(0)
+{
+}
+
+inline void SearchWorkspace::startSearch(int numNodes)
+{
+    // the graph may have grown since our last search (a different or reloaded map)
+    if ((int) m_distance.size() < numNodes) {
+        m_reachedEpoch.resize(numNodes, 0);
+        m_settledEpoch.resize(numNodes, 0);
+        m_distance.resize(numNodes);
+        m_parentEdge.resize(numNodes);
+    }
+
+    m_queue.clear();
+    m_epoch++;
+
+    // after four billion searches the epoch wraps around, and old stamps could look current again
+    if (m_epoch == 0) {
+        std::fill(m_reachedEpoch.begin(), m_reachedEpoch.end(), 0);
+        std::fill(m_settledEpoch.begin(), m_settledEpoch.end(), 0);
+        m_epoch = 1;
+    }
+}
+
+
+#endif // SEARCHWORKSPACE_H
@@ -0,0 +1,307 @@
+#include "provided.h"
+#include "MapSnapshot.h"
+#include "ChainSearch.h"
+#include "Trace.h"
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+using namespace std;
+
+/*
+ A service area is found with the router's search (see ChainSearch.h), which simply keeps going until the
+ next chain end is further away than the budget, instead of stopping at a destination. The search never
+ settles the nodes in the middle of chains, so once it is done, the chains leaving every settled chain end
+ are walked as far as the budget reaches; a node in the middle of a street is reached from either end of
+ its street, and keeps the shorter of the two.
+
+ Areas are remembered per depot, along with the snapshot they were found on; an area found for a larger
+ budget also answers every smaller one, and a change to the map makes them all stale at once.
+ */
+
+// depots whose areas are remembered; the least recently used one is forgotten to make room for another
+const size_t MAX_CACHED_AREAS = 64;
+
+struct ServiceArea
+{
+    shared_ptr<const MapSnapshot> snapshot;
+    double maxMiles;
+    vector<pair<int, double> > nodes;   // (node, distance from the depot), sorted by node
+};
+
+class ServiceAreaFinderImpl
+{
+public:
+    ServiceAreaFinderImpl(const StreetMap* sm);
+    ~ServiceAreaFinderImpl();
+    DeliveryResult findServiceArea(
+        const GeoCoord& depot,
+        double maxMiles,
+        vector<pair<GeoCoord, double> >& area) const;
+    DeliveryResult findDistanceFromDepot(
+        const GeoCoord& depot,
+        double maxMiles,
+        const GeoCoord& location,
+        double& miles) const;
+    DeliveryResult findServiceAreaBoundary(
+        const GeoCoord& depot,
+        double maxMiles,
+        vector<GeoCoord>& boundary) const;
+
+private:
+    struct CachedArea
+    {
+        shared_ptr<const ServiceArea> area;
+        unsigned long long lastUse;
+    };
+
+    const StreetMap* m_streetMap;
+
+    // areas by depot node (guarded by m_mutex); the areas themselves are never changed once found
+    mutable mutex m_mutex;
+    mutable map<int, CachedArea> m_areas;
+    mutable unsigned long long m_clock;
+
+    // the area of the depot for at least maxMiles on the current map, or nullptr if the depot isn't on it
+    shared_ptr<const ServiceArea> areaOf(const GeoCoord& depot, double maxMiles) const;
+};
+
+ServiceAreaFinderImpl::ServiceAreaFinderImpl(const StreetMap* sm)
+    : m_streetMap(sm), m_clock(0)
+{
+}
+
+ServiceAreaFinderImpl::~ServiceAreaFinderImpl() = default;
+
+// walks a chain from its edge number from, recording the nodes in the middle of it which are within maxMiles
+static void walkChain(const MapSnapshot& snapshot, int chain, int from, double distance, double maxMiles,
+                      vector<pair<int, double> >& nodes)
+{
+    const MapData& graph = snapshot.data();
+
+    // the last edge leads to the chain end, which the search has dealt with
+    int first = graph.chainFirstEdge[chain];
+    int last = graph.chainFirstEdge[chain + 1] - 1;
+    for (int i = first + from; i < last; i++) {
+        int e = graph.chainEdges[i];
+        if (!snapshot.edgeOpen(e))
+            return;
+        distance += snapshot.edgeWeight(e);
+        if (distance > maxMiles)
+            return;
+        nodes.push_back(make_pair(graph.edgeTarget[e], distance));
+    }
+}
+
+static shared_ptr<ServiceArea> searchServiceArea(shared_ptr<const MapSnapshot> snapshot, int depot, double maxMiles)
+{
+    TraceSpan span("route", "service area");
+    const MapData& graph = snapshot->data();
+    shared_ptr<ServiceArea> area = make_shared<ServiceArea>();
+    area->snapshot = snapshot;
+    area->maxMiles = maxMiles;
+    vector<pair<int, double> >& nodes = area->nodes;
+
+    // a depot in the middle of a chain starts out along the rest of its two chains
+    nodes.push_back(make_pair(depot, 0.0));
+    if (!graph.isChainEnd(depot)) {
+        for (int i = 2 * depot; i < 2 * depot + 2; i++)
+            walkChain(*snapshot, graph.midChain[i], graph.midChainOffset[i], 0, maxMiles, nodes);
+    }
+
+    ChainSearch search(*snapshot, threadSearchWorkspace());
+    const SearchWorkspace& ws = search.workspace();
+    search.start(depot, -1);
+    int current;
+    int numSettled = 0;
+    while ((current = search.settleNext()) >= 0) {
+        // nodes come out closest first, so the first one beyond the budget ends the search
+        double distance = ws.distance(current);
+        if (distance > maxMiles)
+            break;
+        numSettled++;
+        if (current != depot)
+            nodes.push_back(make_pair(current, distance));
+        search.expand(current);
+        for (int c = graph.firstChain[current]; c < graph.firstChain[current + 1]; c++)
+            walkChain(*snapshot, c, 0, distance, maxMiles, nodes);
+    }
+
+    // a node reached along more than one chain keeps the shortest distance, which sorts first
+    sort(nodes.begin(), nodes.end());
+    nodes.erase(unique(nodes.begin(), nodes.end(),
+                       [](const pair<int, double>& a, const pair<int, double>& b) { return a.first == b.first; }),
+                nodes.end());
+    span.arg("settled", numSettled);
+    span.arg("nodes", nodes.size());
+    return area;
+}
+
+shared_ptr<const ServiceArea> ServiceAreaFinderImpl::areaOf(const GeoCoord& depot, double maxMiles) const
+{
+    shared_ptr<const MapSnapshot> snapshot = m_streetMap->snapshot();
+    int source = snapshot->data().nodeOf(depot);
+    if (source < 0)
+        return nullptr;
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        auto it = m_areas.find(source);
+        if (it != m_areas.end() && it->second.area->snapshot == snapshot && it->second.area->maxMiles >= maxMiles) {
+            it->second.lastUse = ++m_clock;
+            return it->second.area;
+        }
+    }
+
+    // the search runs without the lock, so that other depots can be looked up meanwhile
+    shared_ptr<const ServiceArea> area = searchServiceArea(snapshot, source, maxMiles);
+
+    lock_guard<mutex> lock(m_mutex);
+
+    // areas found on an older map are no use to anyone any more
+    for (auto it = m_areas.begin(); it != m_areas.end(); ) {
+        if (it->second.area->snapshot != snapshot)
+            it = m_areas.erase(it);
+        else
+            ++it;
+    }
+    if (m_areas.size() >= MAX_CACHED_AREAS && m_areas.find(source) == m_areas.end()) {
+        auto oldest = m_areas.begin();
+        for (auto it = m_areas.begin(); it != m_areas.end(); ++it)
+            if (it->second.lastUse < oldest->second.lastUse)
+                oldest = it;
+        m_areas.erase(oldest);
+    }
+
+    // another thread may have found a larger area for the same depot while we were searching
+    CachedArea& cached = m_areas[source];
+    if (cached.area == nullptr || cached.area->snapshot != snapshot || cached.area->maxMiles < maxMiles)
+        cached.area = area;
+    cached.lastUse = ++m_clock;
+    return area;
+}
+
+DeliveryResult ServiceAreaFinderImpl::findServiceArea(
+        const GeoCoord& depot,
+        double maxMiles,
+        vector<pair<GeoCoord, double> >& area) const
+{
+    shared_ptr<const ServiceArea> found = areaOf(depot, maxMiles);
+    if (found == nullptr)
+        return BAD_COORD;
+
+    const MapData& graph = found->snapshot->data();
+    area.clear();
+    for (const auto& n : found->nodes) {
+        if (n.second <= maxMiles)
+            area.push_back(make_pair(graph.node(n.first), n.second));
+    }
+    return DELIVERY_SUCCESS;
+}
+
+DeliveryResult ServiceAreaFinderImpl::findDistanceFromDepot(
+        const GeoCoord& depot,
+        double maxMiles,
+        const GeoCoord& location,
+        double& miles) const
+{
+    shared_ptr<const ServiceArea> found = areaOf(depot, maxMiles);
+    if (found == nullptr)
+        return BAD_COORD;
+    int node = found->snapshot->data().nodeOf(location);
+    if (node < 0)
+        return BAD_COORD;
+
+    auto it = lower_bound(found->nodes.begin(), found->nodes.end(), make_pair(node, 0.0));
+    if (it == found->nodes.end() || it->first != node || it->second > maxMiles)
+        return NO_ROUTE;
+    miles = it->second;
+    return DELIVERY_SUCCESS;
+}
+
+// > 0 if a, b and c turn counterclockwise
+static double cross(const GeoCoord& a, const GeoCoord& b, const GeoCoord& c)
+{
+    return (b.longitude - a.longitude) * (c.latitude - a.latitude) - (b.latitude - a.latitude) * (c.longitude - a.longitude);
+}
+
+DeliveryResult ServiceAreaFinderImpl::findServiceAreaBoundary(
+        const GeoCoord& depot,
+        double maxMiles,
+        vector<GeoCoord>& boundary) const
+{
+    shared_ptr<const ServiceArea> found = areaOf(depot, maxMiles);
+    if (found == nullptr)
+        return BAD_COORD;
+
+    const MapData& graph = found->snapshot->data();
+    vector<GeoCoord> points;
+    for (const auto& n : found->nodes) {
+        if (n.second <= maxMiles)
+            points.push_back(graph.node(n.first));
+    }
+    sort(points.begin(), points.end(), [](const GeoCoord& a, const GeoCoord& b) {
+        return a.longitude < b.longitude || (a.longitude == b.longitude && a.latitude < b.latitude);
+    });
+
+    // Andrew's monotone chain: the lower hull from west to east, then the upper hull back again
+    boundary.clear();
+    if (points.size() < 3) {
+        boundary = points;
+        return DELIVERY_SUCCESS;
+    }
+    for (size_t i = 0; i < points.size(); i++) {
+        while (boundary.size() >= 2 && cross(boundary[boundary.size() - 2], boundary.back(), points[i]) <= 0)
+            boundary.pop_back();
+        boundary.push_back(points[i]);
+    }
+    size_t lower = boundary.size();
+    for (size_t i = points.size() - 1; i-- > 0; ) {
+        while (boundary.size() > lower && cross(boundary[boundary.size() - 2], boundary.back(), points[i]) <= 0)
+            boundary.pop_back();
+        boundary.push_back(points[i]);
+    }
+    boundary.pop_back();    // the first point again
+    return DELIVERY_SUCCESS;
+}
+
+//******************** ServiceAreaFinder functions ****************************
+
+// These functions simply delegate to ServiceAreaFinderImpl's functions.
+// You probably don't want to change any of this code.
+
+ServiceAreaFinder::ServiceAreaFinder(const StreetMap* sm)
+{
+    m_impl = new ServiceAreaFinderImpl(sm);
+}
+
+ServiceAreaFinder::~ServiceAreaFinder()
+{
+    delete m_impl;
+}
+
+DeliveryResult ServiceAreaFinder::findServiceArea(
+        const GeoCoord& depot,
+        double maxMiles,
+        vector<pair<GeoCoord, double> >& area) const
+{
+    return m_impl->findServiceArea(depot, maxMiles, area);
+}
+
+DeliveryResult ServiceAreaFinder::findDistanceFromDepot(
+        const GeoCoord& depot,
+        double maxMiles,
+        const GeoCoord& location,
+        double& miles) const
+{
+    return m_impl->findDistanceFromDepot(depot, maxMiles, location, miles);
+}
+
+DeliveryResult ServiceAreaFinder::findServiceAreaBoundary(
+        const GeoCoord& depot,
+        double maxMiles,
+        vector<GeoCoord>& boundary) const
+{
+    return m_impl->findServiceAreaBoundary(depot, maxMiles, boundary);
+}
@@ -0,0 +1,474 @@
+#include "provided.h"
+#include "MapSnapshot.h"
+#include "ShortestPaths.h"
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+const double INFINITE_DISTANCE = numeric_limits<double>::infinity();
+
+// frontiers smaller than this are relaxed on the calling thread alone, since waking the other threads would cost more
+const size_t MIN_PARALLEL_FRONTIER = 512;
+
+static void initTree(const MapSnapshot& snapshot, int source, ShortestPathTree& tree)
+{
+    int numNodes = snapshot.data().nodeCount();
+    tree.source = source;
+    tree.distance.assign(numNodes, INFINITE_DISTANCE);
+    tree.parentEdge.assign(numNodes, -1);
+}
+
+// Dijkstra from every source at once, each starting at distance zero; nearest, if given, records for every
+// node the index of the source whose path reached it, and if there are targets, the search stops once
+// they are all settled
+static void dijkstra(const MapSnapshot& snapshot, const vector<int>& sources, const vector<int>& targets,
+                     vector<double>& distance, vector<int>& parentEdge, vector<int>* nearest)
+{
+    const MapData& graph = snapshot.data();
+
+    vector<bool> isTarget;
+    int targetsLeft = 0;
+    if (!targets.empty()) {
+        isTarget.assign(graph.nodeCount(), false);
+        for (int t : targets) {
+            if (t >= 0 && t < graph.nodeCount() && !isTarget[t]) {
+                isTarget[t] = true;
+                targetsLeft++;
+            }
+        }
+    }
+
+    // a binary heap of (distance, node) pairs; a node may be queued more than once, later copies are skipped
+    vector<pair<double, int> > queue;
+    vector<bool> settled(graph.nodeCount(), false);
+    for (size_t i = 0; i < sources.size(); i++) {
+        int source = sources[i];
+        if (source < 0 || source >= graph.nodeCount() || distance[source] == 0)
+            continue;
+        distance[source] = 0;
+        if (nearest != nullptr)
+            (*nearest)[source] = i;
+        queue.push_back(make_pair(0.0, source));
+    }
+    make_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+
+    while (!queue.empty()) {
+        pop_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+        int current = queue.back().second;
+        queue.pop_back();
+        if (settled[current])
+            continue;
+        settled[current] = true;
+        graph.useNode(current);
+        if (!isTarget.empty() && isTarget[current] && --targetsLeft == 0)
+            return;
+
+        for (int e = graph.firstEdge[current]; e < graph.firstEdge[current + 1]; e++) {
+            if (!snapshot.edgeOpen(e))
+                continue;
+            int neighbor = graph.edgeTarget[e];
+            double newDistance = distance[current] + snapshot.edgeWeight(e);
+            if (newDistance < distance[neighbor]) {
+                distance[neighbor] = newDistance;
+                parentEdge[neighbor] = e;
+                if (nearest != nullptr)
+                    (*nearest)[neighbor] = (*nearest)[current];
+                queue.push_back(make_pair(newDistance, neighbor));
+                push_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+            }
+        }
+    }
+}
+
+void computeShortestPathTree(const MapSnapshot& snapshot, int source, ShortestPathTree& tree)
+{
+    initTree(snapshot, source, tree);
+    dijkstra(snapshot, vector<int>(1, source), vector<int>(), tree.distance, tree.parentEdge, nullptr);
+}
+
+void computeReverseShortestPathTree(const MapSnapshot& snapshot, int target, ShortestPathTree& tree)
+{
+    initTree(snapshot, target, tree);
+    const MapData& graph = snapshot.data();
+    if (target < 0 || target >= graph.nodeCount())
+        return;
+
+    // the same search as dijkstra, except that it relaxes the edges leading into each node it settles;
+    // there is no list of those, but they start at the nodes its own edges lead to
+    vector<pair<double, int> > queue(1, make_pair(0.0, target));
+    vector<bool> settled(graph.nodeCount(), false);
+    tree.distance[target] = 0;
+    while (!queue.empty()) {
+        pop_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+        int current = queue.back().second;
+        queue.pop_back();
+        if (settled[current])
+            continue;
+        settled[current] = true;
+        graph.useNode(current);
+
+        for (int e = graph.firstEdge[current]; e < graph.firstEdge[current + 1]; e++) {
+            int neighbor = graph.edgeTarget[e];
+            if (neighbor == current || settled[neighbor])
+                continue;
+            graph.useNode(neighbor);
+            for (int f = graph.firstEdge[neighbor]; f < graph.firstEdge[neighbor + 1]; f++) {
+                if (graph.edgeTarget[f] != current || !snapshot.edgeOpen(f))
+                    continue;
+                double newDistance = tree.distance[current] + snapshot.edgeWeight(f);
+                if (newDistance < tree.distance[neighbor]) {
+                    tree.distance[neighbor] = newDistance;
+                    tree.parentEdge[neighbor] = f;
+                    queue.push_back(make_pair(newDistance, neighbor));
+                    push_heap(queue.begin(), queue.end(), greater<pair<double, int> >());
+                }
+            }
+        }
+    }
+}
+
+void computeNearestSourceForest(const MapSnapshot& snapshot, const vector<int>& sources, NearestSourceForest& forest,
+                                const vector<int>& targets)
+{
+    int numNodes = snapshot.data().nodeCount();
+    forest.sources = sources;
+    forest.distance.assign(numNodes, INFINITE_DISTANCE);
+    forest.parentEdge.assign(numNodes, -1);
+    forest.nearest.assign(numNodes, -1);
+    dijkstra(snapshot, sources, targets, forest.distance, forest.parentEdge, &forest.nearest);
+}
+
+//******************** Delta-stepping *****************************************
+
+// a fixed group of threads which run one job after another; the calling thread is member 0
+class WorkerTeam
+{
+public:
+    WorkerTeam(int size);
+    ~WorkerTeam();
+
+    int size() const
+    {
+        return m_size;
+    }
+
+    // every member runs job(member), and this returns once they have all finished
+    void run(const function<void(int)>& job);
+
+    // C++11 syntax for preventing copying and assignment
+    WorkerTeam(const WorkerTeam&) = delete;
+    WorkerTeam& operator=(const WorkerTeam&) = delete;
+
+private:
+    int m_size;
+    vector<thread> m_helpers;
+    mutex m_mutex;
+    condition_variable m_jobReady;
+    condition_variable m_jobDone;
+    const function<void(int)>* m_job;
+    unsigned int m_generation;   // increases with every job, so helpers can tell a new job from the last one
+    int m_running;               // helpers still working on the current job
+    bool m_quitting;
+
+    void helperLoop(int member);
+};
+
+WorkerTeam::WorkerTeam(int size)
+    : m_size(size > 0 ? size : 1), m_job(nullptr), m_generation(0), m_running(0), m_quitting(false)
+{
+    for (int member = 1; member < m_size; member++)
+        m_helpers.push_back(thread(&WorkerTeam::helperLoop, this, member));
+}
+
+WorkerTeam::~WorkerTeam()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_quitting = true;
+    }
+    m_jobReady.notify_all();
+    for (auto& t : m_helpers)
+        t.join();
+}
+
+void WorkerTeam::run(const function<void(int)>& job)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_job = &job;
+        m_running = m_size - 1;
+        m_generation++;
+    }
+    m_jobReady.notify_all();
+
+    job(0);
+
+    unique_lock<mutex> lock(m_mutex);
+    m_jobDone.wait(lock, [this] { return m_running == 0; });
+}
+
+void WorkerTeam::helperLoop(int member)
+{
+    unsigned int seen = 0;
+    for (;;) {
+        const function<void(int)>* job;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_jobReady.wait(lock, [&] { return m_quitting || m_generation != seen; });
+            if (m_quitting)
+                return;
+            seen = m_generation;
+            job = m_job;
+        }
+
+        (*job)(member);
+
+        lock_guard<mutex> lock(m_mutex);
+        if (--m_running == 0)
+            m_jobDone.notify_one();
+    }
+}
+
+// a proposal to reach node by edge at the given distance
+struct Relaxation
+{
+    int node;
+    int edge;
+    double distance;
+};
+
+/*
+ Delta-stepping keeps the reached nodes in buckets of width delta and settles one bucket at a time.
+ Within a bucket nodes are settled in no particular order, so all of them can be worked on at once.
+ Edges no longer than delta (light edges) can lead back into the bucket being settled, so those are
+ relaxed over and over until the bucket stays empty; longer (heavy) edges always lead to a later
+ bucket, so they are relaxed once, for every node the bucket settled.
+
+ Every relaxation round has two parallel phases. First the frontier is split between the threads,
+ and each thread writes the relaxations it finds into buffers of its own, one buffer for each thread.
+ Then every thread applies the relaxations addressed to it; thread t owns the nodes n with n % T == t,
+ so no two threads ever write the same node and no locking is needed.
+
+ Run in reverse, it finds the paths to the source instead: a settled node relaxes the edges leading
+ into it, found among the edges of the nodes its own edges lead to, as computeReverseShortestPathTree does.
+ */
+class DeltaStepping
+{
+public:
+    DeltaStepping(const MapSnapshot& snapshot, ShortestPathTree& tree, WorkerTeam& team, double delta, bool reverse);
+    void run(int source);
+
+private:
+    const MapSnapshot& m_snapshot;
+    const MapData& m_graph;
+    ShortestPathTree& m_tree;
+    WorkerTeam& m_team;
+    double m_delta;
+    bool m_reverse;
+
+    // only buckets with nodes in them exist, since a few very long (or heavily weighted) edges
+    // could otherwise leave a huge number of empty buckets between the occupied ones
+    map<size_t, vector<int> > m_buckets;
+    vector<double> m_relaxedAt;                  // the distance at which a node's light edges were last relaxed
+    vector<vector<vector<Relaxation> > > m_out;  // m_out[from][to]: relaxations found by thread from for nodes of thread to
+    vector<vector<int> > m_improved;             // nodes each thread gave a shorter distance in the last round
+
+    size_t bucketOf(double distance) const
+    {
+        return (size_t) (distance / m_delta);
+    }
+
+    void addToBucket(int node);
+
+    // relaxes the light or heavy edges leaving (or, in reverse, entering) every node of the frontier
+    void relax(const vector<int>& frontier, bool light);
+    void addRelaxation(int node, int edge, double distance, vector<vector<Relaxation> >& out) const;
+    void findRelaxations(const vector<int>& frontier, bool light, int member, int teamSize);
+    void applyRelaxations(int member, int teamSize);
+};
+
+DeltaStepping::DeltaStepping(const MapSnapshot& snapshot, ShortestPathTree& tree, WorkerTeam& team, double delta,
+                             bool reverse)
+    : m_snapshot(snapshot), m_graph(snapshot.data()), m_tree(tree), m_team(team), m_delta(delta), m_reverse(reverse)
+{
+    int teamSize = team.size();
+    m_out.assign(teamSize, vector<vector<Relaxation> >(teamSize));
+    m_improved.assign(teamSize, vector<int>());
+    m_relaxedAt.assign(m_graph.nodeCount(), -1);
+}
+
+void DeltaStepping::addToBucket(int node)
+{
+    m_buckets[bucketOf(m_tree.distance[node])].push_back(node);
+}
+
+void DeltaStepping::run(int source)
+{
+    m_tree.distance[source] = 0;
+    addToBucket(source);
+
+    vector<int> frontier;
+    vector<int> settled;
+    vector<bool> inSettled(m_graph.nodeCount(), false);
+
+    // always work on the earliest bucket which still has nodes in it
+    while (!m_buckets.empty()) {
+        size_t i = m_buckets.begin()->first;
+        settled.clear();
+
+        // relax light edges until no more nodes fall into this bucket
+        while (m_buckets.count(i) > 0) {
+            frontier.clear();
+            for (int node : m_buckets[i]) {
+                // skip entries which are out of date: the node has since been improved into an earlier
+                // bucket, or it was added to this one twice and has already been relaxed at its distance
+                if (bucketOf(m_tree.distance[node]) != i || m_relaxedAt[node] == m_tree.distance[node])
+                    continue;
+                m_relaxedAt[node] = m_tree.distance[node];
+                frontier.push_back(node);
+                if (!inSettled[node]) {
+                    inSettled[node] = true;
+                    settled.push_back(node);
+                }
+            }
+            m_buckets.erase(i);
+            relax(frontier, true);
+        }
+
+        // the distances of everything in this bucket are now final, and heavy edges lead to later buckets
+        relax(settled, false);
+        for (int node : settled)
+            inSettled[node] = false;
+    }
+}
+
+void DeltaStepping::relax(const vector<int>& frontier, bool light)
+{
+    if (frontier.empty())
+        return;
+
+    int teamSize = m_team.size();
+    if (frontier.size() < MIN_PARALLEL_FRONTIER || teamSize == 1) {
+        // the same two phases, but every member's share is done on this thread
+        for (int member = 0; member < teamSize; member++)
+            findRelaxations(frontier, light, member, teamSize);
+        for (int member = 0; member < teamSize; member++)
+            applyRelaxations(member, teamSize);
+    }
+    else {
+        m_team.run([&](int member) { findRelaxations(frontier, light, member, teamSize); });
+        m_team.run([&](int member) { applyRelaxations(member, teamSize); });
+    }
+
+    // queue the improved nodes into the buckets of their new distances
+    for (auto& improved : m_improved) {
+        for (int node : improved)
+            addToBucket(node);
+        improved.clear();
+    }
+}
+
+void DeltaStepping::findRelaxations(const vector<int>& frontier, bool light, int member, int teamSize)
+{
+    // this member's contiguous share of the frontier
+    size_t begin = frontier.size() * member / teamSize;
+    size_t end = frontier.size() * (member + 1) / teamSize;
+    vector<vector<Relaxation> >& out = m_out[member];
+
+    // distances are only read in this phase, so every thread can look at all of them
+    for (size_t i = begin; i < end; i++) {
+        int node = frontier[i];
+        double distance = m_tree.distance[node];
+        m_graph.useNode(node);
+        for (int e = m_graph.firstEdge[node]; e < m_graph.firstEdge[node + 1]; e++) {
+            if (!m_reverse) {
+                if (m_snapshot.edgeOpen(e) && (m_snapshot.edgeWeight(e) <= m_delta) == light)
+                    addRelaxation(m_graph.edgeTarget[e], e, distance + m_snapshot.edgeWeight(e), out);
+                continue;
+            }
+
+            // the edges from the neighbour back into this node
+            int neighbor = m_graph.edgeTarget[e];
+            if (neighbor == node)
+                continue;
+            m_graph.useNode(neighbor);
+            for (int f = m_graph.firstEdge[neighbor]; f < m_graph.firstEdge[neighbor + 1]; f++) {
+                if (m_graph.edgeTarget[f] == node && m_snapshot.edgeOpen(f) &&
+                    (m_snapshot.edgeWeight(f) <= m_delta) == light)
+                    addRelaxation(neighbor, f, distance + m_snapshot.edgeWeight(f), out);
+            }
+        }
+    }
+}
+
+void DeltaStepping::addRelaxation(int node, int edge, double distance, vector<vector<Relaxation> >& out) const
+{
+    if (distance >= m_tree.distance[node])
+        return;
+    Relaxation r;
+    r.node = node;
+    r.edge = edge;
+    r.distance = distance;
+    out[node % out.size()].push_back(r);
+}
+
+void DeltaStepping::applyRelaxations(int member, int teamSize)
+{
+    // every relaxation addressed to this member is for a node only this member writes
+    for (int from = 0; from < teamSize; from++) {
+        vector<Relaxation>& in = m_out[from][member];
+        for (const auto& r : in) {
+            if (r.distance < m_tree.distance[r.node]) {
+                m_tree.distance[r.node] = r.distance;
+                m_tree.parentEdge[r.node] = r.edge;
+                m_improved[member].push_back(r.node);
+            }
+        }
+        in.clear();
+    }
+}
+
+// delta-stepping forwards or in reverse
+static void deltaStepping(const MapSnapshot& snapshot, int source, ShortestPathTree& tree, int numThreads,
+                          double delta, bool reverse)
+{
+    const MapData& graph = snapshot.data();
+    initTree(snapshot, source, tree);
+    if (source < 0 || source >= graph.nodeCount())
+        return;
+
+    if (numThreads <= 0)
+        numThreads = max(1u, thread::hardware_concurrency());
+
+    // by default a bucket is a few average edges wide, so that a bucket holds a good number of nodes
+    // without too many of them having to be relaxed again after they were first reached
+    if (delta <= 0) {
+        double total = 0;
+        for (double length : graph.edgeLength)
+            total += length;
+        delta = graph.edgeLength.empty() ? 1 : 3 * total / graph.edgeLength.size();
+        if (delta <= 0)
+            delta = 1;
+    }
+
+    WorkerTeam team(numThreads);
+    DeltaStepping(snapshot, tree, team, delta, reverse).run(source);
+}
+
+void computeShortestPathTreeParallel(const MapSnapshot& snapshot, int source, ShortestPathTree& tree,
+                                     int numThreads, double delta)
+{
+    deltaStepping(snapshot, source, tree, numThreads, delta, false);
+}
+
+void computeReverseShortestPathTreeParallel(const MapSnapshot& snapshot, int target, ShortestPathTree& tree,
+                                            int numThreads, double delta)
+{
+    deltaStepping(snapshot, target, tree, numThreads, delta, true);
+}
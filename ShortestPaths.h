@@ -0,0 +1,66 @@
+// ShortestPaths.h
+
+//  Shortest paths from one node (or the nearest of several) to every node of the street graph
+//  used for precomputation, when a search has to cover the whole map rather than stop at a destination
+
+#ifndef SHORTESTPATHS_H
+#define SHORTESTPATHS_H
+
+#include "MapSnapshot.h"
+#include <limits>
+#include <vector>
+
+// the shortest paths from one source node, as a tree of parent edges
+struct ShortestPathTree
+{
+    int source = -1;
+    std::vector<double> distance;   // the shortest distance to every node, infinity if it can't be reached
+    std::vector<int> parentEdge;    // the last edge of the shortest path to every node, -1 for the source and unreachable nodes
+
+    bool reached(int node) const
+    {
+        return distance[node] != std::numeric_limits<double>::infinity();
+    }
+};
+
+// the shortest paths from whichever of several source nodes is nearest, as a forest of parent edges
+struct NearestSourceForest
+{
+    std::vector<int> sources;
+    std::vector<double> distance;   // the distance from the nearest source, infinity if no source can reach the node
+    std::vector<int> parentEdge;    // as in ShortestPathTree
+    std::vector<int> nearest;       // the index in sources of the nearest source, -1 if no source can reach the node
+
+    bool reached(int node) const
+    {
+        return nearest[node] >= 0;
+    }
+};
+
+// plain Dijkstra on the calling thread
+void computeShortestPathTree(const MapSnapshot& snapshot, int source, ShortestPathTree& tree);
+
+// the shortest paths from every node to one target, for which tree.source is the target, distance is the
+// distance to it, and parentEdge is the first edge of the path from each node (-1 for the target and for
+// nodes which can't reach it); relies on every segment being stored in both directions, as loading does
+void computeReverseShortestPathTree(const MapSnapshot& snapshot, int target, ShortestPathTree& tree);
+
+// one Dijkstra from all the sources at once, so it costs no more than computeShortestPathTree
+// nodes equally near to two sources go to whichever the search reaches them from first
+// given targets, the search stops once all of them are settled, so only nodes no further than the furthest target are final
+void computeNearestSourceForest(const MapSnapshot& snapshot, const std::vector<int>& sources, NearestSourceForest& forest,
+                                const std::vector<int>& targets = std::vector<int>());
+
+// parallel delta-stepping, which gives exactly the same distances as computeShortestPathTree
+// (when two paths tie, the parent edges of the two may differ, but both are shortest paths)
+// numThreads of 0 means one per core; nodes are kept in buckets of width delta, and a delta of 0
+// picks one from the edge lengths of the map
+void computeShortestPathTreeParallel(const MapSnapshot& snapshot, int source, ShortestPathTree& tree,
+                                     int numThreads = 0, double delta = 0);
+
+// the same in reverse, giving the tree of computeReverseShortestPathTree
+void computeReverseShortestPathTreeParallel(const MapSnapshot& snapshot, int target, ShortestPathTree& tree,
+                                            int numThreads = 0, double delta = 0);
+
+
+#endif // SHORTESTPATHS_H
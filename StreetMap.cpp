@@ -1,16 +1,30 @@
 #include "provided.h"
 #include "ExpandableHashMap.h"
+#include "MapData.h"
+#include "MapSnapshot.h"
+#include "HilbertCurve.h"
+#include "RouteCache.h"
+#include "Trace.h"
 #include <string>
 #include <vector>
 #include <fstream>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
 using namespace std;
 
 unsigned int hasher(const GeoCoord& g)
 {
-    return std::hash<string>()(g.latitudeText + g.longitudeText);
+    // combine the hashes of the two halves rather than hashing their concatenation,
+    // so that looking up a coordinate doesn't have to build a temporary string
+    size_t h = std::hash<string>()(g.latitudeText);
+    return h ^ (std::hash<string>()(g.longitudeText) + 0x9e3779b9 + (h << 6) + (h >> 2));
 }
 
+const unsigned int MAX_CHANGE_LOG = 4096; // how many segment changes a snapshot remembers
+
 class StreetMapImpl
 {
 public:
@@ -18,45 +32,93 @@ public:
     ~StreetMapImpl();
     bool load(string mapFile);
     bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+    bool setSegmentClosed(const GeoCoord& start, const GeoCoord& end, bool closed);
+    bool setSegmentWeight(const GeoCoord& start, const GeoCoord& end, double weight);
+    shared_ptr<const MapSnapshot> snapshot() const;
+    unsigned int version() const;
+    bool saveTiles(string tileFile) const;
+    void setMemoryBudget(size_t bytes);
+    void prefetch(double minLat, double minLon, double maxLat, double maxLon) const;
+    void openRouteCache(string cacheFile, size_t maxBytes);
+    bool saveRouteCache();
     
 private:
     
-    // our map of GeoCoords to the street segments that start with them
-    ExpandableHashMap<GeoCoord, vector<StreetSegment> > m_coordToSegmentMap;
+    // the current view of the map; readers and writers only ever swap this pointer atomically,
+    // so a snapshot someone is still using stays alive and unchanged until they let go of it
+    shared_ptr<const MapSnapshot> m_snapshot;
     
-    // helper function to insert a street segment into the map
-    void insertSegment(StreetSegment* s) {
-        
-        // Declaring a vector pointer to call find
-        vector<StreetSegment> *f = m_coordToSegmentMap.find(s->start);
-        
-         // if coordinate already exists, we add this segment to its vector of segments
-        if (f != nullptr)
-            f->push_back(*s);
-        
-        // otherwise we create a new vector and add the coordinate and this vector into the hashmap
-        else {
-            vector<StreetSegment> temp;
-            temp.push_back(*s);
-            m_coordToSegmentMap.associate(s->start, temp);
-        }
-        
-        delete s; // delete the dynamically allocated street segment to prevent a memory leak
+    // writers copy the current snapshot, so they have to take turns
+    mutex m_updateMutex;
+    
+    // the memory budget for the tiles of tiled maps, kept for maps loaded later
+    atomic<size_t> m_memoryBudget;
+    size_t memoryBudget() const
+    {
+        return m_memoryBudget.load();
+    }
+    
+    // the route cache in use, if any, which is handed to every map loaded (guarded by m_updateMutex)
+    shared_ptr<RouteCache> m_routeCache;
+    
+    // publishes a snapshot of a newly loaded map
+    void publishMap(shared_ptr<const MapData> data);
+    
+    // helper function to publish a snapshot in which one segment has been changed
+    bool publishChange(const GeoCoord& start, const GeoCoord& end, bool closed, double weight, bool changesClosed);
+    
+    // renumbers the nodes in the order a Hilbert curve over the map visits them
+    static void reorderNodes(MapArrays& data, vector<int>& sources, vector<int>& targets);
+    
+    // numbers the connected pieces of the map, and records which piece every node is in
+    static void labelComponents(MapArrays& data);
+    
+    // builds the graph of chains the router searches
+    static void contractChains(MapArrays& data);
+    
+    // returns the node at gc, numbering it if this is the first time we have seen it
+    static int internNode(MapArrays& data, const GeoCoord& gc) {
+        const int* n = data.coordToNode.find(gc);
+        if (n != nullptr)
+            return *n;
+        data.coordToNode.associate(gc, data.nodes.size());
+        data.nodes.push_back(gc);
+        return data.nodes.size() - 1;
     }
 };
 
 StreetMapImpl::StreetMapImpl()
 {
-    // empty constructor, there is nothing to initialize
+    // until a map is loaded, the snapshot is of an empty map
+    unique_ptr<MapArrays> empty(new MapArrays);
+    empty->firstEdge.push_back(0);
+    empty->firstChain.push_back(0);
+    empty->chainFirstEdge.push_back(0);
+    m_snapshot = make_shared<const MapSnapshot>(make_shared<const MapData>(move(empty)), 0);
+    m_memoryBudget = DEFAULT_MEMORY_BUDGET;
 }
 
 StreetMapImpl::~StreetMapImpl()
 {
-    // empty destructor, there is nothing to deallocate
+    // the snapshots are reference counted and clean up after themselves, but the routes found
+    // since the route cache was last saved would be lost
+    saveRouteCache();
 }
 
 bool StreetMapImpl::load(string mapFile)
 {
+    TraceSpan span("map", "load");
+    span.arg("file", mapFile);
+    
+    // a tiled map is opened where it is, and its tiles are only read when they are needed
+    if (MapData::isTileFile(mapFile)) {
+        shared_ptr<const MapData> tiles = MapData::openTiles(mapFile, memoryBudget());
+        if (tiles == nullptr)
+            return false;
+        publishMap(tiles);
+        return true;
+    }
+    
     // initialize the input file stream
     ifstream mapDataFile(mapFile);
     
@@ -64,6 +126,15 @@ bool StreetMapImpl::load(string mapFile)
     if (!mapDataFile)
         return false;
     
+    // the segments are read into fresh map data, so that a map being reloaded stays usable until we are done
+    unique_ptr<MapArrays> data(new MapArrays);
+    
+    // the edges in the order we read them, as (source, target, street) triples
+    // they are grouped by source node once we know how many nodes there are
+    vector<int> sources, targets, streets;
+    
+    TraceSpan readSpan("map", "read segments");
+    
     // variables required to collect input
     string streetName;
     int numberOfSegments;
@@ -75,6 +146,8 @@ bool StreetMapImpl::load(string mapFile)
         
         // read number of street segments for the current street being processed
         mapDataFile >> numberOfSegments;
+        int street = data->streetNames.size();
+        data->streetNames.push_back(streetName);
         
          // after reading an integer, discard the rest of the input on the line
         mapDataFile.ignore(1000, '\n');
@@ -89,37 +162,451 @@ bool StreetMapImpl::load(string mapFile)
             // discard remaining line input
             mapDataFile.ignore(1000, '\n');
             
-            // create two temporary GeoCoord variables needed to construct the street segments
-            GeoCoord new1(start1, start2);
-            GeoCoord new2(end1, end2);
+            // find (or number) the nodes at both ends of the segment
+            int node1 = internNode(*data, GeoCoord(start1, start2));
+            int node2 = internNode(*data, GeoCoord(end1, end2));
             
-            // call insertSegment() to insert the segments into our map
-            // these dynamically allocated segments are deallocated by insertSegment
-            insertSegment(new StreetSegment(new1, new2, streetName));
-            insertSegment(new StreetSegment(new2, new1, streetName));
+            // streets can be travelled both ways, so every segment is an edge in each direction
+            sources.push_back(node1);
+            targets.push_back(node2);
+            streets.push_back(street);
+            sources.push_back(node2);
+            targets.push_back(node1);
+            streets.push_back(street);
         }
     }
     
+    readSpan.arg("segments", sources.size() / 2);
+    readSpan.end();
+    
+    // renumber the nodes so that nodes close together on the map are close together in memory
+    reorderNodes(*data, sources, targets);
+    
+    // count the edges leaving each node, and turn the counts into the first edge of every node
+    TraceSpan edgeSpan("map", "build edges");
+    int numNodes = data->nodes.size();
+    int numEdges = sources.size();
+    data->firstEdge.assign(numNodes + 1, 0);
+    for (int e = 0; e < numEdges; e++)
+        data->firstEdge[sources[e] + 1]++;
+    for (int n = 0; n < numNodes; n++)
+        data->firstEdge[n + 1] += data->firstEdge[n];
+    
+    // place every edge after the earlier edges of its source node, keeping the order they were read in
+    data->edgeSource.resize(numEdges);
+    data->edgeTarget.resize(numEdges);
+    data->edgeStreet.resize(numEdges);
+    data->edgeLength.resize(numEdges);
+    vector<int> nextSlot(data->firstEdge.begin(), data->firstEdge.end() - 1);
+    for (int e = 0; e < numEdges; e++) {
+        int slot = nextSlot[sources[e]]++;
+        data->edgeSource[slot] = sources[e];
+        data->edgeTarget[slot] = targets[e];
+        data->edgeStreet[slot] = streets[e];
+        data->edgeLength[slot] = distanceEarthMiles(data->nodes[sources[e]], data->nodes[targets[e]]);
+    }
+    
+    edgeSpan.end();
+    
+    // find out which parts of the map can be reached from which
+    labelComponents(*data);
+    
+    // collapse the middles of streets, which most nodes are, so that searches skip over them
+    contractChains(*data);
+    
+    publishMap(make_shared<const MapData>(move(data)));
+    
     // Street map successfully loaded
     return true;
 }
 
+void StreetMapImpl::reorderNodes(MapArrays& data, vector<int>& sources, vector<int>& targets)
+{
+    TraceSpan span("map", "reorder nodes");
+    
+    /*
+     Nodes are first numbered in the order the map file mentions them, which scatters the neighbours
+     of a node all over memory. Numbering them along a Hilbert curve instead means that a search,
+     which spreads outwards over the map, mostly touches array entries that are near each other.
+     The nodes array keeps the coordinate of every node, so output is unaffected by the new numbers.
+     */
+    int numNodes = data.nodes.size();
+    if (numNodes == 0)
+        return;
+    
+    // the curve is laid over the bounding box of the map
+    double minLat = data.nodes[0].latitude, maxLat = minLat;
+    double minLon = data.nodes[0].longitude, maxLon = minLon;
+    for (const auto& gc : data.nodes) {
+        minLat = min(minLat, gc.latitude);
+        maxLat = max(maxLat, gc.latitude);
+        minLon = min(minLon, gc.longitude);
+        maxLon = max(maxLon, gc.longitude);
+    }
+    HilbertGrid grid(minLat, minLon, maxLat, maxLon);
+    
+    // sort the old node numbers by their position on the curve; ties keep the order of the map file
+    vector<pair<unsigned long long, int> > order(numNodes);
+    for (int n = 0; n < numNodes; n++)
+        order[n] = make_pair(grid.index(data.nodes[n]), n);
+    sort(order.begin(), order.end());
+    
+    // node order[i].second becomes node i
+    vector<int> newNumber(numNodes);
+    vector<GeoCoord> reordered(numNodes);
+    for (int i = 0; i < numNodes; i++) {
+        newNumber[order[i].second] = i;
+        reordered[i] = data.nodes[order[i].second];
+        data.coordToNode.associate(reordered[i], i);
+    }
+    data.nodes.swap(reordered);
+    
+    for (auto& n : sources)
+        n = newNumber[n];
+    for (auto& n : targets)
+        n = newNumber[n];
+}
+
+void StreetMapImpl::labelComponents(MapArrays& data)
+{
+    TraceSpan span("map", "label components");
+    
+    /*
+     Every segment is an edge in both directions, so two nodes are connected exactly when they
+     are in the same connected component, and a breadth first search from any node finds its
+     whole component. Closures made at runtime only ever remove edges, so nodes in different
+     components stay unreachable from each other whatever happens to the map afterwards.
+     */
+    int numNodes = data.nodes.size();
+    data.nodeComponent.assign(numNodes, -1);
+    vector<int> queue;
+    queue.reserve(numNodes);
+    
+    int components = 0;
+    for (int first = 0; first < numNodes; first++) {
+        if (data.nodeComponent[first] >= 0)
+            continue;
+        
+        // everything reachable from here belongs to a new component
+        queue.clear();
+        queue.push_back(first);
+        data.nodeComponent[first] = components;
+        for (size_t i = 0; i < queue.size(); i++) {
+            int node = queue[i];
+            for (int e = data.firstEdge[node]; e < data.firstEdge[node + 1]; e++) {
+                int neighbor = data.edgeTarget[e];
+                if (data.nodeComponent[neighbor] < 0) {
+                    data.nodeComponent[neighbor] = components;
+                    queue.push_back(neighbor);
+                }
+            }
+        }
+        components++;
+    }
+}
+
+void StreetMapImpl::contractChains(MapArrays& data)
+{
+    TraceSpan span("map", "contract chains");
+    
+    /*
+     Most nodes are part way along a street and only lead from the node before them to the node after.
+     The router gains nothing by settling those one at a time, so it searches chains instead: a chain
+     starts at a chain end (an intersection, a dead end, or a node of any other kind), follows edges
+     through the nodes in the middle of the street, and stops at the next chain end. Every edge is in
+     exactly one chain, and the edges of a chain are kept so that routes can be put back together.
+     */
+    int numNodes = data.nodes.size();
+    int numEdges = data.edgeTarget.size();
+    
+    // a node is in the middle of a chain when its two edges lead to two different nodes
+    // every edge has a twin going the other way, so a chain arriving at such a node leaves by the other edge
+    vector<bool> isEnd(numNodes, true);
+    for (int n = 0; n < numNodes; n++) {
+        int e = data.firstEdge[n];
+        if (data.firstEdge[n + 1] - e == 2) {
+            int a = data.edgeTarget[e];
+            int b = data.edgeTarget[e + 1];
+            isEnd[n] = (a == b || a == n || b == n);
+        }
+    }
+    
+    // the edge by which a chain leaves the middle node it arrived at from prev
+    auto onwardEdge = [&](int node, int prev) {
+        int e = data.firstEdge[node];
+        return data.edgeTarget[e] == prev ? e + 1 : e;
+    };
+    
+    // a loop made only of middle nodes has no end to start from, so one of its nodes is made an end
+    vector<bool> onChain(numNodes, false);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int n = 0; n < numNodes; n++) {
+            if (pass == 0 ? !isEnd[n] : onChain[n])
+                continue;
+            isEnd[n] = true;
+            onChain[n] = true;
+            for (int e = data.firstEdge[n]; e < data.firstEdge[n + 1]; e++) {
+                int prev = n;
+                for (int node = data.edgeTarget[e]; !isEnd[node]; ) {
+                    onChain[node] = true;
+                    int next = data.edgeTarget[onwardEdge(node, prev)];
+                    prev = node;
+                    node = next;
+                }
+            }
+        }
+    }
+    
+    // follow every edge leaving every chain end, so the chains come out grouped by where they start
+    data.firstChain.assign(numNodes + 1, 0);
+    data.chainFirstEdge.assign(1, 0);
+    data.edgeChain.assign(numEdges, -1);
+    data.midChain.assign(2 * numNodes, -1);
+    data.midChainOffset.assign(2 * numNodes, -1);
+    for (int n = 0; n < numNodes; n++) {
+        data.firstChain[n] = data.chainSource.size();
+        if (!isEnd[n])
+            continue;
+        for (int e = data.firstEdge[n]; e < data.firstEdge[n + 1]; e++) {
+            int chain = data.chainSource.size();
+            double length = 0;
+            int prev = n;
+            int edge = e;
+            for (;;) {
+                data.chainEdges.push_back(edge);
+                data.edgeChain[edge] = chain;
+                length += data.edgeLength[edge];
+                int node = data.edgeTarget[edge];
+                if (isEnd[node])
+                    break;
+                
+                // record the chain in whichever of the node's two slots is still free
+                int slot = data.midChain[2 * node] < 0 ? 2 * node : 2 * node + 1;
+                data.midChain[slot] = chain;
+                data.midChainOffset[slot] = data.chainEdges.size() - data.chainFirstEdge[chain];
+                
+                edge = onwardEdge(node, prev);
+                prev = node;
+            }
+            data.chainSource.push_back(n);
+            data.chainTarget.push_back(data.edgeTarget[edge]);
+            data.chainLength.push_back(length);
+            data.chainFirstEdge.push_back(data.chainEdges.size());
+        }
+    }
+    data.firstChain[numNodes] = data.chainSource.size();
+}
+
+void StreetMapImpl::publishMap(shared_ptr<const MapData> data)
+{
+    // runtime changes made to a previously loaded map do not carry over
+    lock_guard<mutex> lock(m_updateMutex);
+    
+    // node and edge numbers only mean the same thing on the same map, so a different map needs the routes cached for it
+    if (m_routeCache != nullptr) {
+        if (m_routeCache->fingerprint() != data->fingerprint()) {
+            m_routeCache->save();
+            m_routeCache = RouteCache::open(m_routeCache->file(), m_routeCache->maxBytes(), data->fingerprint());
+        }
+        data->setRouteCache(m_routeCache);
+    }
+    atomic_store(&m_snapshot, make_shared<const MapSnapshot>(data, version() + 1));
+}
+
+bool StreetMapImpl::saveTiles(string tileFile) const
+{
+    return snapshot()->data().saveTiles(tileFile);
+}
+
+void StreetMapImpl::setMemoryBudget(size_t bytes)
+{
+    m_memoryBudget = bytes;
+    snapshot()->data().setMemoryBudget(bytes);
+}
+
+void StreetMapImpl::prefetch(double minLat, double minLon, double maxLat, double maxLon) const
+{
+    snapshot()->data().prefetch(minLat, minLon, maxLat, maxLon);
+}
+
+void StreetMapImpl::openRouteCache(string cacheFile, size_t maxBytes)
+{
+    lock_guard<mutex> lock(m_updateMutex);
+    if (m_routeCache != nullptr)
+        m_routeCache->save();
+    const MapData& data = snapshot()->data();
+    m_routeCache = RouteCache::open(cacheFile, maxBytes, data.fingerprint());
+    data.setRouteCache(m_routeCache);
+}
+
+bool StreetMapImpl::saveRouteCache()
+{
+    lock_guard<mutex> lock(m_updateMutex);
+    return m_routeCache == nullptr || m_routeCache->save();
+}
+
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
-    // call the find function of the ExpandableHashMap to get a pointer to the vector of street segments
-    const vector<StreetSegment> *f = m_coordToSegmentMap.find(gc);
+    // the current snapshot knows which segments are closed
+    return snapshot()->getSegmentsThatStartWith(gc, segs);
+}
+
+bool StreetMapImpl::setSegmentClosed(const GeoCoord& start, const GeoCoord& end, bool closed)
+{
+    return publishChange(start, end, closed, 0, true);
+}
+
+bool StreetMapImpl::setSegmentWeight(const GeoCoord& start, const GeoCoord& end, double weight)
+{
+    return publishChange(start, end, false, weight, false);
+}
+
+bool StreetMapImpl::publishChange(const GeoCoord& start, const GeoCoord& end, bool closed, double weight, bool changesClosed)
+{
+    lock_guard<mutex> lock(m_updateMutex);
+    shared_ptr<const MapSnapshot> current = snapshot();
+    
+    // we can only change segments which are actually on the map
+    int edge = current->findEdge(start, end);
+    if (edge < 0)
+        return false;
+    
+    // start from whatever was already overridden for this segment, and change one field of it
+    SegmentOverride o = current->edgeOverride(edge);
+    if (changesClosed)
+        o.closed = closed;
+    else
+        o.weight = weight < 0 ? -1 : weight;
+    
+    // the new snapshot copies the previous one's (small) set of changes, never the map data itself
+    atomic_store(&m_snapshot, make_shared<const MapSnapshot>(*current, edge, o));
+    return true;
+}
+
+shared_ptr<const MapSnapshot> StreetMapImpl::snapshot() const
+{
+    return atomic_load(&m_snapshot);
+}
+
+unsigned int StreetMapImpl::version() const
+{
+    return snapshot()->version();
+}
+
+//******************** MapSnapshot functions **********************************
+
+MapSnapshot::MapSnapshot(shared_ptr<const MapData> data, unsigned int version)
+    : m_data(data), m_logStart(version), m_version(version)
+{
+}
+
+MapSnapshot::MapSnapshot(const MapSnapshot& prev, int edge, const SegmentOverride& o)
+    : m_data(prev.m_data), m_overrides(prev.m_overrides), m_chainWeights(prev.m_chainWeights), m_changes(prev.m_changes),
+      m_logStart(prev.m_logStart), m_version(prev.m_version + 1)
+{
+    // a segment which is back to normal doesn't need to be remembered
+    if (!o.closed && o.weight < 0)
+        m_overrides.erase(edge);
+    else
+        m_overrides[edge] = o;
+    
+    // the router follows whole chains, so the cost of the chain this edge is in has to be worked out again
+    int chain = m_data->edgeChain[edge];
+    double weight = 0;
+    bool changed = false;
+    for (int i = m_data->chainFirstEdge[chain]; i < m_data->chainFirstEdge[chain + 1]; i++) {
+        int e = m_data->chainEdges[i];
+        if (m_overrides.count(e) > 0)
+            changed = true;
+        if (!edgeOpen(e)) {
+            weight = CHAIN_CLOSED;
+            break;
+        }
+        weight += edgeWeight(e);
+    }
+    if (changed)
+        m_chainWeights[chain] = weight;
+    else
+        m_chainWeights.erase(chain);
+    
+    // log the change, forgetting the oldest one if the log is full
+    MapChange change;
+    change.version = m_version;
+    change.edge = edge;
+    change.start = m_data->node(m_data->edgeSource[edge]);
+    change.end = m_data->node(m_data->edgeTarget[edge]);
+    m_changes.push_back(change);
+    if (m_changes.size() > MAX_CHANGE_LOG) {
+        m_logStart = m_changes.front().version;
+        m_changes.erase(m_changes.begin());
+    }
+}
+
+bool MapSnapshot::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
+{
+    // find the node at this coordinate
+    int node = m_data->nodeOf(gc);
     
     // if there are no segments which begin with the given coordinate, convey that to the caller
-    if(f == nullptr)
+    if (node < 0)
         return false;
     
-    // update the value of the argument appropriately
-    // if the segs vector already had some contents, they are automatically erased by the assignment operator
-    segs = *f;
+    // rebuild the open segments leaving the node
+    // if the segs vector already had some contents, they are erased first
+    segs.clear();
+    for (int e = m_data->firstEdge[node]; e < m_data->firstEdge[node + 1]; e++)
+        if (edgeOpen(e))
+            segs.push_back(m_data->segment(e));
     
     return true;
 }
 
+int MapSnapshot::findEdge(const GeoCoord& start, const GeoCoord& end) const
+{
+    int node = m_data->nodeOf(start);
+    if (node < 0)
+        return -1;
+    for (int e = m_data->firstEdge[node]; e < m_data->firstEdge[node + 1]; e++)
+        if (m_data->node(m_data->edgeTarget[e]) == end)
+            return e;
+    return -1;
+}
+
+SegmentOverride MapSnapshot::edgeOverride(int edge) const
+{
+    auto o = m_overrides.find(edge);
+    if (o == m_overrides.end())
+        return SegmentOverride();
+    return o->second;
+}
+
+bool MapSnapshot::chainPartWeight(int chain, int from, int to, double& weight) const
+{
+    weight = 0;
+    int first = m_data->chainFirstEdge[chain];
+    for (int i = first + from; i < first + to; i++) {
+        int e = m_data->chainEdges[i];
+        if (!edgeOpen(e))
+            return false;
+        weight += edgeWeight(e);
+    }
+    return true;
+}
+
+bool MapSnapshot::changesSince(unsigned int version, vector<MapChange>& changes) const
+{
+    changes.clear();
+    
+    // the log doesn't go back that far (or the map was reloaded since), so everything must be assumed changed
+    if (version < m_logStart)
+        return false;
+    
+    for (const auto& c : m_changes)
+        if (c.version > version)
+            changes.push_back(c);
+    return true;
+}
+
 //******************** StreetMap functions ************************************
 
 // These functions simply delegate to StreetMapImpl's functions.
@@ -144,3 +631,48 @@ bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegmen
 {
    return m_impl->getSegmentsThatStartWith(gc, segs);
 }
+
+bool StreetMap::setSegmentClosed(const GeoCoord& start, const GeoCoord& end, bool closed)
+{
+    return m_impl->setSegmentClosed(start, end, closed);
+}
+
+bool StreetMap::setSegmentWeight(const GeoCoord& start, const GeoCoord& end, double weight)
+{
+    return m_impl->setSegmentWeight(start, end, weight);
+}
+
+shared_ptr<const MapSnapshot> StreetMap::snapshot() const
+{
+    return m_impl->snapshot();
+}
+
+unsigned int StreetMap::version() const
+{
+    return m_impl->version();
+}
+
+bool StreetMap::saveTiles(string tileFile) const
+{
+    return m_impl->saveTiles(tileFile);
+}
+
+void StreetMap::setMemoryBudget(size_t bytes)
+{
+    m_impl->setMemoryBudget(bytes);
+}
+
+void StreetMap::prefetch(double minLat, double minLon, double maxLat, double maxLon) const
+{
+    m_impl->prefetch(minLat, minLon, maxLat, maxLon);
+}
+
+void StreetMap::openRouteCache(string cacheFile, size_t maxBytes)
+{
+    m_impl->openRouteCache(cacheFile, maxBytes);
+}
+
+bool StreetMap::saveRouteCache()
+{
+    return m_impl->saveRouteCache();
+}
@@ -0,0 +1,73 @@
+// ThreadPool.h
+
+//  A fixed number of worker threads running tasks in the order they were submitted
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "BoundedQueue.h"
+#include "Trace.h"
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // numThreads of 0 means one thread per core; the threads are called name in traces
+    ThreadPool(int numThreads = 0, const std::string& name = "pool");
+
+    // finishes every task already submitted before returning
+    ~ThreadPool();
+
+    // queues a task for the next free worker; blocks only if an enormous number of tasks are waiting
+    void submit(const std::function<void()>& task);
+
+    int size() const
+    {
+        return m_workers.size();
+    }
+
+    // C++11 syntax for preventing copying and assignment
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+private:
+    BoundedQueue<std::function<void()> > m_tasks;
+    std::vector<std::thread> m_workers;
+};
+
+
+inline ThreadPool::ThreadPool(int numThreads, const std::string& name)
+        : m_tasks(1 << 16)
+{
+    if (numThreads <= 0)
+        numThreads = std::thread::hardware_concurrency();
+    if (numThreads <= 0)
+        numThreads = 4;
+
+    for (int i = 0; i < numThreads; i++) {
+        m_workers.push_back(std::thread([this, name, i] {
+            nameTraceThread(name + " " + std::to_string(i));
+            std::function<void()> task;
+            while (m_tasks.pop(task))
+                task();
+        }));
+    }
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    m_tasks.close();
+    for (auto& w : m_workers)
+        w.join();
+}
+
+inline void ThreadPool::submit(const std::function<void()>& task)
+{
+    m_tasks.push(task);
+}
+
+
+#endif // THREADPOOL_H
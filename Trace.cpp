@@ -0,0 +1,183 @@
+#include "Trace.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+using namespace std;
+
+/*
+ Every thread records its spans into a ring buffer of its own, so recording a span takes no lock and
+ touches no memory shared with other threads. The buffers are registered in a list the first time a
+ thread records anything (or is named), and stay in it after the thread exits, so stopTracing can still write out
+ the spans of pool threads which have since gone away.
+
+ Tracing is meant to be started and stopped while the traced work is idle; spans recorded while the
+ trace is being written may or may not make it into the file.
+ */
+
+atomic<bool> g_tracing(false);
+
+struct TraceEvent
+{
+    const char* category;
+    const char* name;
+    unsigned long long start;       // in nanoseconds since tracing started
+    unsigned long long duration;
+    size_t argsLength;
+    char args[TRACE_ARGS_BYTES];
+};
+
+struct TraceBuffer
+{
+    int tid;
+    string name;
+    vector<TraceEvent> events;              // empty until the thread records its first span
+    atomic<unsigned long long> recorded;    // how many spans have ever been recorded; the last ones are in events
+};
+
+static mutex s_buffersMutex;
+static vector<shared_ptr<TraceBuffer> > s_buffers;
+static atomic<long long> s_origin(0);      // steady clock nanoseconds at which tracing started
+
+static thread_local shared_ptr<TraceBuffer> t_buffer;
+
+static TraceBuffer& threadBuffer()
+{
+    if (t_buffer == nullptr) {
+        t_buffer = make_shared<TraceBuffer>();
+        t_buffer->recorded = 0;
+        lock_guard<mutex> lock(s_buffersMutex);
+        t_buffer->tid = s_buffers.size() + 1;
+        s_buffers.push_back(t_buffer);
+    }
+    return *t_buffer;
+}
+
+static long long steadyNanoseconds()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the string as a JSON string literal
+static string jsonString(const string& s)
+{
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if ((unsigned char) c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+void startTracing()
+{
+    lock_guard<mutex> lock(s_buffersMutex);
+    for (auto& b : s_buffers)
+        b->recorded = 0;
+    s_origin = steadyNanoseconds();
+    g_tracing = true;
+}
+
+bool stopTracing(const string& traceFile)
+{
+    g_tracing = false;
+
+    ofstream out(traceFile);
+    if (!out)
+        return false;
+
+    // timestamps are in microseconds
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"goober\"}}";
+    char number[64];
+    lock_guard<mutex> lock(s_buffersMutex);
+    for (const auto& b : s_buffers) {
+        string name = b->name.empty() ? "thread " + to_string(b->tid) : b->name;
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+            << ",\"args\":{\"name\":" << jsonString(name) << "}}";
+
+        unsigned long long recorded = b->recorded.load(memory_order_acquire);
+        unsigned long long first = recorded > TRACE_BUFFER_SPANS ? recorded - TRACE_BUFFER_SPANS : 0;
+        for (unsigned long long i = first; i < recorded; i++) {
+            const TraceEvent& e = b->events[i % TRACE_BUFFER_SPANS];
+            out << ",\n{\"name\":" << jsonString(e.name) << ",\"cat\":" << jsonString(e.category)
+                << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid;
+            snprintf(number, sizeof(number), "%.3f", e.start / 1000.0);
+            out << ",\"ts\":" << number;
+            snprintf(number, sizeof(number), "%.3f", e.duration / 1000.0);
+            out << ",\"dur\":" << number;
+            out << ",\"args\":{" << string(e.args, e.argsLength) << "}}";
+        }
+    }
+    out << "\n]}\n";
+    return bool(out);
+}
+
+void nameTraceThread(const string& name)
+{
+    TraceBuffer& b = threadBuffer();
+    lock_guard<mutex> lock(s_buffersMutex);
+    b.name = name;
+}
+
+unsigned long long TraceSpan::now()
+{
+    // never 0, which marks a span started while tracing was off
+    return steadyNanoseconds() - s_origin.load(memory_order_relaxed) + 1;
+}
+
+void TraceSpan::arg(const char* key, double value)
+{
+    if (m_start == 0)
+        return;
+    char number[32];
+    snprintf(number, sizeof(number), "%.10g", value);
+    appendArg(key, number);
+}
+
+void TraceSpan::arg(const char* key, const string& value)
+{
+    if (m_start == 0)
+        return;
+    appendArg(key, jsonString(value));
+}
+
+void TraceSpan::appendArg(const char* key, const string& json)
+{
+    // arguments which don't fit are left out, rather than cut off into invalid JSON
+    string member = (m_argsLength > 0 ? "," : "") + jsonString(key) + ":" + json;
+    if (m_argsLength + member.size() > TRACE_ARGS_BYTES)
+        return;
+    memcpy(m_args + m_argsLength, member.data(), member.size());
+    m_argsLength += member.size();
+}
+
+void TraceSpan::record()
+{
+    unsigned long long end = now();
+    TraceBuffer& b = threadBuffer();
+    if (b.events.empty())
+        b.events.resize(TRACE_BUFFER_SPANS);
+    unsigned long long i = b.recorded.load(memory_order_relaxed);
+    TraceEvent& e = b.events[i % TRACE_BUFFER_SPANS];
+    e.category = m_category;
+    e.name = m_name;
+    e.start = m_start;
+    e.duration = end - m_start;
+    e.argsLength = m_argsLength;
+    memcpy(e.args, m_args, m_argsLength);
+
+    // publishes the span to stopTracing, which may be running on another thread
+    b.recorded.store(i + 1, memory_order_release);
+}
@@ -0,0 +1,78 @@
+// Trace.h
+
+//  Opt-in timeline tracing: spans of time, recorded per thread, written out as Chrome trace-event JSON
+//  which Perfetto (ui.perfetto.dev) or chrome://tracing can display
+//  while tracing is off, a span costs one relaxed atomic load
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <string>
+
+// every thread keeps this many of its most recent spans; older ones are overwritten
+const size_t TRACE_BUFFER_SPANS = 1 << 14;
+
+// room for a span's arguments, already formatted as JSON members
+const size_t TRACE_ARGS_BYTES = 160;
+
+extern std::atomic<bool> g_tracing;
+
+inline bool tracing()
+{
+    return g_tracing.load(std::memory_order_relaxed);
+}
+
+// forgets any spans recorded so far and starts recording
+void startTracing();
+
+// stops recording and writes every thread's spans to file
+bool stopTracing(const std::string& traceFile);
+
+// names the calling thread in the trace
+void nameTraceThread(const std::string& name);
+
+// records the time from its construction to its destruction as a span on the calling thread's timeline
+// category and name must be string literals (or otherwise outlive the trace), since only the pointers are kept
+class TraceSpan
+{
+public:
+    TraceSpan(const char* category, const char* name)
+        : m_category(category), m_name(name), m_start(tracing() ? now() : 0), m_argsLength(0)
+    {}
+
+    ~TraceSpan()
+    {
+        end();
+    }
+
+    // ends the span before it goes out of scope
+    void end()
+    {
+        if (m_start != 0)
+            record();
+        m_start = 0;
+    }
+
+    // adds an argument shown with the span; ignored while tracing is off
+    void arg(const char* key, double value);
+    void arg(const char* key, const std::string& value);
+
+    // C++11 syntax for preventing copying and assignment
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* m_category;
+    const char* m_name;
+    unsigned long long m_start;     // nanoseconds since tracing started, or 0 if tracing was off
+    size_t m_argsLength;
+    char m_args[TRACE_ARGS_BYTES];
+
+    static unsigned long long now();
+    void record();
+    void appendArg(const char* key, const std::string& json);
+};
+
+
+#endif // TRACE_H
@@ -0,0 +1,1760 @@
+#include "provided.h"
+#include "MapSnapshot.h"
+#include "ShortestPaths.h"
+#include "RouteCache.h"
+#include "ExpandableHashMap.h"
+#include "ConcurrentHashMap.h"
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <list>
+#include <queue>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+using namespace std;
+
+/*
+ Benchmarks for goober, built with "make bench"
+
+   goober-bench scaling mapdata.txt [maxThreads] [queries]
+   goober-bench sssp mapdata.txt [threads] [delta]
+   goober-bench tour mapdata.txt [stops]
+   goober-bench cache mapdata.txt routes.cache [queries]
+   goober-bench hashmap mapdata.txt [maxThreads]
+   goober-bench area mapdata.txt [miles]
+   goober-bench depots mapdata.txt [depots] [deliveries]
+   goober-bench labels mapdata.txt labels.file [queries]
+   goober-bench replan mapdata.txt [stops]
+   goober-bench crosscheck mapdata.txt [cases] [seed]
+   goober-bench overlay mapdata.txt [cellSize] [queries]
+   goober-bench incremental mapdata.txt [stops] [changes]
+   goober-bench paths mapdata.txt [queries]
+   goober-bench trees mapdata.txt [tours] [stops]
+   goober-bench stream mapdata.txt [stops]
+
+ scaling routes the same random queries on 1, 2, 4, ... maxThreads threads sharing one StreetMap,
+ checks every answer against a single-threaded reference run, and reports the throughput
+ while it runs, another thread keeps closing and reopening a street, so that readers constantly
+ race with published map changes; the closed street is picked so that it isn't on any
+ reference route, which means the answers must not change
+
+ sssp computes shortest paths from a few nodes to the whole map, once with Dijkstra and once
+ with parallel delta-stepping, checks that the distances are identical, and compares the times;
+ it checks the reverse trees, of paths to those nodes, the same way
+
+ cache routes random queries with an empty route cache, then again in a fresh StreetMap which reads
+ the routes the first run saved, checks that both runs agree, and compares the times; finally it
+ appends half a record to the file, as a run killed while saving would, and checks nothing is lost
+
+ hashmap interns the coordinates at both ends of every segment of the map, the way loading a map
+ does, on 1, 2, 4, ... maxThreads threads which split the segments between them, and then looks every
+ coordinate up again from all threads; once into a ConcurrentHashMap, and once into an
+ ExpandableHashMap behind a mutex. It checks that all threads agreed on the number of every coordinate
+
+ area finds the service area of a few depots, checks it against shortest paths to the whole map, and
+ compares the time of the bounded search with the whole-map one and with admission lookups once the
+ area is cached
+
+ depots assigns random deliveries to the nearest of a few random depots, once by routing from every
+ depot to every delivery and once with DepotAssigner's single search, checks that every delivery went
+ to a depot at the same distance, and compares the times
+
+ labels builds the hub labels of the map and saves them, loads them again in a fresh DistanceOracle,
+ checks the distances it gives for random queries against the router's, and compares the times; then it
+ fills a distance matrix between the starts of the queries, with the labels and with one search per row
+
+ replan plans a random tour, then re-plans it from halfway along every leg, as if the robot had been
+ held up there, closing a street on the rest of the tour halfway through; it checks every re-plan against
+ one which reuses no legs, and compares the times
+
+ crosscheck asks every routing engine (the router, the overlay router, the depot trees, the shortest path
+ trees, delta-stepping, the nearest source forest, the distance oracle and service areas) for the distance
+ of random queries, on the map
+ and on small synthetic maps built to be awkward, and compares each against a plain Dijkstra of its own.
+ Some queries start and end at the same node or within one chain, and some close segments of the shortest
+ path or give them weights which make paths tie. Routes must be valid walks along open segments. It also
+ checks that the optimizer only reorders deliveries and that planned tours travel the shortest legs.
+ The first failing case of each map is shrunk, by dropping changes and moving the ends of the query
+ together for as long as it still fails, and printed
+
+ overlay cuts the map into cells and builds the overlay, routes random queries with it and with the
+ router and checks the routes cost the same, then closes streets on some of the routes, customizes the
+ overlay again and checks again; it reports the times of building, customizing and routing
+
+ incremental optimizes a random tour, then adds and cancels deliveries one at a time with an
+ IncrementalOptimizer, checks that the tour holds exactly the deliveries left and that the length it
+ reports is the tour's, and compares that length and the time of each change with optimizing the final
+ deliveries from scratch
+
+ paths routes random queries as lists of segments and as StreetPaths, checks that each path gives back
+ the segments of the list, and compares the times; every route is in the route cache before it is timed,
+ so the times are mostly those of building the result
+
+ trees finds the shortest path trees from and to a random depot, then plans random tours from it with
+ and without them, checking that both plans travel as far, and compares the times; halfway through it
+ closes a street leaving the depot, so that the trees have to be found again
+
+ stream plans a random tour, then plans it again streamed a leg at a time, checks that the legs add up
+ to the same commands and distance, and compares the time until the first leg arrives with the time of
+ the whole plan
+ */
+
+struct Query
+{
+    GeoCoord start;
+    GeoCoord end;
+    DeliveryResult result;
+    double distance;
+};
+
+static double secondsSince(chrono::steady_clock::time_point t)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - t).count();
+}
+
+// picks random pairs of nodes and routes them once, single-threaded, for reference
+static void makeQueries(const StreetMap& sm, int count, vector<Query>& queries)
+{
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+
+    mt19937 rng(32);
+    uniform_int_distribution<int> pick(0, graph.nodeCount() - 1);
+    PointToPointRouter router(snapshot);
+    for (int i = 0; i < count; i++) {
+        Query q;
+        q.start = graph.node(pick(rng));
+        q.end = graph.node(pick(rng));
+        list<StreetSegment> route;
+        q.distance = 0;
+        q.result = router.generatePointToPointRoute(q.start, q.end, route, q.distance);
+        queries.push_back(q);
+    }
+}
+
+// finds a segment which no reference route uses, for the writer thread to close and reopen
+static bool pickUnusedSegment(const StreetMap& sm, const vector<Query>& queries, StreetSegment& unused)
+{
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+    vector<bool> used(graph.nodeCount(), false);
+
+    PointToPointRouter router(snapshot);
+    for (const auto& q : queries) {
+        list<StreetSegment> route;
+        double distance;
+        if (router.generatePointToPointRoute(q.start, q.end, route, distance) != DELIVERY_SUCCESS)
+            continue;
+        for (const auto& s : route) {
+            used[graph.nodeOf(s.start)] = true;
+            used[graph.nodeOf(s.end)] = true;
+        }
+    }
+
+    for (int e = 0; e < (int) graph.edgeSource.size(); e++) {
+        if (!used[graph.edgeSource[e]] && !used[graph.edgeTarget[e]]) {
+            unused = graph.segment(e);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int scaling(const string& mapFile, int maxThreads, int numQueries)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+
+    vector<Query> queries;
+    auto t = chrono::steady_clock::now();
+    makeQueries(sm, numQueries, queries);
+    double referenceSeconds = secondsSince(t);
+    cout << numQueries << " reference queries in " << referenceSeconds << " s" << endl;
+
+    StreetSegment toggled;
+    bool haveToggle = pickUnusedSegment(sm, queries, toggled);
+
+    cout << "threads  queries/s  speedup  efficiency  mismatches  map versions" << endl;
+    double baseRate = 0;
+    for (int threads = 1; threads <= maxThreads; threads = (threads * 2 > maxThreads && threads < maxThreads) ? maxThreads : threads * 2) {
+        atomic<int> next(0);
+        atomic<int> mismatches(0);
+        atomic<bool> done(false);
+
+        // the writer publishes a new snapshot as often as it can while the readers run
+        unsigned int startVersion = sm.version();
+        thread writer([&] {
+            bool closed = false;
+            while (haveToggle && !done) {
+                closed = !closed;
+                sm.setSegmentClosed(toggled.start, toggled.end, closed);
+                sm.setSegmentClosed(toggled.end, toggled.start, closed);
+                this_thread::yield();
+            }
+            if (closed) {
+                sm.setSegmentClosed(toggled.start, toggled.end, false);
+                sm.setSegmentClosed(toggled.end, toggled.start, false);
+            }
+        });
+
+        // every reader has a router of its own and takes queries from the shared list until it runs out
+        t = chrono::steady_clock::now();
+        vector<thread> readers;
+        for (int i = 0; i < threads; i++) {
+            readers.push_back(thread([&] {
+                PointToPointRouter router(&sm);
+                list<StreetSegment> route;
+                int q;
+                while ((q = next++) < numQueries) {
+                    double distance = 0;
+                    DeliveryResult r = router.generatePointToPointRoute(queries[q].start, queries[q].end, route, distance);
+                    if (r != queries[q].result || (r == DELIVERY_SUCCESS && distance != queries[q].distance))
+                        mismatches++;
+                }
+            }));
+        }
+        for (auto& r : readers)
+            r.join();
+        double seconds = secondsSince(t);
+        done = true;
+        writer.join();
+
+        double rate = numQueries / seconds;
+        if (threads == 1)
+            baseRate = rate;
+        cout.setf(ios::fixed);
+        cout.precision(2);
+        cout << threads << "\t " << rate << "\t    " << rate / baseRate << "x\t" << 100 * rate / baseRate / threads
+             << "%\t     " << mismatches << "\t\t" << sm.version() - startVersion << endl;
+        if (mismatches > 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int sssp(const string& mapFile, int threads, double delta)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    int numNodes = snapshot->data().nodeCount();
+    if (numNodes == 0)
+        return 1;
+
+    cout << "source  dijkstra s  delta-stepping s  speedup  mismatches" << endl;
+    mt19937 rng(31);
+    uniform_int_distribution<int> pick(0, numNodes - 1);
+    int totalMismatches = 0;
+    for (int i = 0; i < 5; i++) {
+        int source = pick(rng);
+        ShortestPathTree reference, parallel;
+
+        auto t = chrono::steady_clock::now();
+        computeShortestPathTree(*snapshot, source, reference);
+        double dijkstraSeconds = secondsSince(t);
+
+        t = chrono::steady_clock::now();
+        computeShortestPathTreeParallel(*snapshot, source, parallel, threads, delta);
+        double parallelSeconds = secondsSince(t);
+
+        // the distances must agree exactly, and every parent edge must lie on a shortest path
+        int mismatches = 0;
+        for (int n = 0; n < numNodes; n++) {
+            if (parallel.distance[n] != reference.distance[n])
+                mismatches++;
+            else if (n != source && parallel.reached(n)) {
+                int e = parallel.parentEdge[n];
+                if (e < 0 || snapshot->data().edgeTarget[e] != n
+                    || parallel.distance[snapshot->data().edgeSource[e]] + snapshot->edgeWeight(e) != parallel.distance[n])
+                    mismatches++;
+            }
+        }
+
+        // and the same in reverse, where each parent edge leads away from its node
+        computeReverseShortestPathTree(*snapshot, source, reference);
+        computeReverseShortestPathTreeParallel(*snapshot, source, parallel, threads, delta);
+        for (int n = 0; n < numNodes; n++) {
+            if (parallel.distance[n] != reference.distance[n])
+                mismatches++;
+            else if (n != source && parallel.reached(n)) {
+                int e = parallel.parentEdge[n];
+                if (e < 0 || snapshot->data().edgeSource[e] != n
+                    || parallel.distance[snapshot->data().edgeTarget[e]] + snapshot->edgeWeight(e) != parallel.distance[n])
+                    mismatches++;
+            }
+        }
+        totalMismatches += mismatches;
+
+        cout.setf(ios::fixed);
+        cout.precision(4);
+        cout << source << "\t" << dijkstraSeconds << "\t    " << parallelSeconds << "\t      "
+             << dijkstraSeconds / parallelSeconds << "x\t  " << mismatches << endl;
+    }
+    return totalMismatches == 0 ? 0 : 1;
+}
+
+static int tour(const string& mapFile, int numStops)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+    if (graph.nodeCount() == 0)
+        return 1;
+
+    mt19937 rng(33);
+    uniform_int_distribution<int> pick(0, graph.nodeCount() - 1);
+    GeoCoord depot = graph.node(pick(rng));
+    vector<DeliveryRequest> deliveries;
+    for (int i = 0; i < numStops; i++)
+        deliveries.push_back(DeliveryRequest(to_string(i), graph.node(pick(rng))));
+
+    DeliveryOptimizer optimizer(&sm);
+    double oldCrowDistance, newCrowDistance;
+    auto t = chrono::steady_clock::now();
+    optimizer.optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
+    double seconds = secondsSince(t);
+
+    // the items were named by their original position, so each must turn up exactly once
+    vector<bool> seen(numStops, false);
+    bool complete = (int) deliveries.size() == numStops;
+    for (const auto& d : deliveries) {
+        int i = stoi(d.item);
+        complete = complete && !seen[i];
+        seen[i] = true;
+    }
+
+    cout.setf(ios::fixed);
+    cout.precision(4);
+    cout << "stops  old miles  new miles  seconds  complete" << endl;
+    cout << numStops << "\t" << oldCrowDistance << "\t" << newCrowDistance << "\t" << seconds << "\t"
+         << (complete ? "yes" : "NO") << endl;
+    return complete && newCrowDistance <= oldCrowDistance ? 0 : 1;
+}
+
+// routes the queries on a freshly loaded map using the route cache, returning the seconds taken
+static double routeWithCache(const string& mapFile, const string& cacheFile, vector<Query>& queries,
+                             size_t& cached, size_t& hits)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile))
+        return -1;
+    sm.openRouteCache(cacheFile);
+    shared_ptr<RouteCache> cache = sm.snapshot()->data().routeCache();
+    cached = cache->size();
+
+    PointToPointRouter router(&sm);
+    auto t = chrono::steady_clock::now();
+    for (auto& q : queries) {
+        list<StreetSegment> route;
+        q.distance = 0;
+        q.result = router.generatePointToPointRoute(q.start, q.end, route, q.distance);
+    }
+    double seconds = secondsSince(t);
+    hits = cache->hits();
+    return sm.saveRouteCache() ? seconds : -1;
+}
+
+static int cache(const string& mapFile, const string& cacheFile, int numQueries)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    vector<Query> reference;
+    makeQueries(sm, numQueries, reference);
+
+    remove(cacheFile.c_str());
+    vector<Query> cold = reference, warm = reference, afterCrash = reference;
+    size_t coldCached, coldHits, warmCached, warmHits, crashCached, crashHits;
+    double coldSeconds = routeWithCache(mapFile, cacheFile, cold, coldCached, coldHits);
+    double warmSeconds = routeWithCache(mapFile, cacheFile, warm, warmCached, warmHits);
+
+    // the start of a record, with the rest of it missing
+    {
+        ofstream out(cacheFile, ios::binary | ios::app);
+        out.write("\x40\0\0\0\x12\x34", 6);
+    }
+    double crashSeconds = routeWithCache(mapFile, cacheFile, afterCrash, crashCached, crashHits);
+    if (coldSeconds < 0 || warmSeconds < 0 || crashSeconds < 0) {
+        cerr << "Unable to use route cache " << cacheFile << endl;
+        return 1;
+    }
+
+    int mismatches = 0;
+    for (size_t i = 0; i < reference.size(); i++) {
+        for (const auto* run : { &cold, &warm, &afterCrash })
+            if ((*run)[i].result != reference[i].result || (*run)[i].distance != reference[i].distance)
+                mismatches++;
+    }
+
+    cout.setf(ios::fixed);
+    cout.precision(4);
+    cout << "run	    cached  hits   seconds" << endl;
+    cout << "cold	    " << coldCached << "	" << coldHits << "	" << coldSeconds << endl;
+    cout << "warm	    " << warmCached << "	" << warmHits << "	" << warmSeconds << endl;
+    cout << "torn	    " << crashCached << "	" << crashHits << "	" << crashSeconds << endl;
+    cout << mismatches << " mismatches" << endl;
+    return mismatches == 0 && crashCached == warmCached ? 0 : 1;
+}
+
+unsigned int hasher(const GeoCoord& g);
+
+// interns coords split between threads, then looks them all up from every thread; returns the seconds
+// taken by both phases, and counts the coordinates whose number a thread saw differently
+static void internBenchmark(const vector<GeoCoord>& coords, int threads,
+                            const function<int(const GeoCoord&, int)>& intern,
+                            const function<int(const GeoCoord&)>& lookup,
+                            double& internSeconds, double& lookupSeconds, atomic<int>& disagreements)
+{
+    vector<int> seen(coords.size());    // the number coords[c] got when it was interned
+    vector<thread> workers;
+    atomic<int> nextNumber(0);
+    auto t = chrono::steady_clock::now();
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(thread([&, i] {
+            size_t begin = coords.size() * i / threads;
+            size_t end = coords.size() * (i + 1) / threads;
+            for (size_t c = begin; c < end; c++)
+                seen[c] = intern(coords[c], nextNumber++);
+        }));
+    }
+    for (auto& w : workers)
+        w.join();
+    internSeconds = secondsSince(t);
+    workers.clear();
+
+    t = chrono::steady_clock::now();
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(thread([&, i] {
+            size_t begin = coords.size() * i / threads;
+            for (size_t k = 0; k < coords.size(); k++) {
+                size_t c = (begin + k) % coords.size();
+                if (lookup(coords[c]) != seen[c])
+                    disagreements++;
+            }
+        }));
+    }
+    for (auto& w : workers)
+        w.join();
+    lookupSeconds = secondsSince(t);
+}
+
+static int hashmap(const string& mapFile, int maxThreads)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+
+    // both ends of every segment (which is an edge each way), so most coordinates come up several times
+    vector<GeoCoord> coords;
+    for (int e = 0; e < (int) graph.edgeSource.size(); e++) {
+        if (graph.edgeSource[e] < graph.edgeTarget[e]) {
+            coords.push_back(graph.node(graph.edgeSource[e]));
+            coords.push_back(graph.node(graph.edgeTarget[e]));
+        }
+    }
+    shuffle(coords.begin(), coords.end(), mt19937(34));
+
+    cout << coords.size() << " coordinates, " << graph.nodeCount() << " different" << endl;
+    cout << "threads  map            inserts/s    finds/s  size  disagreements" << endl;
+    int failures = 0;
+    for (int threads = 1; threads <= maxThreads; threads = (threads * 2 > maxThreads && threads < maxThreads) ? maxThreads : threads * 2) {
+        for (int kind = 0; kind < 2; kind++) {
+            ConcurrentHashMap<GeoCoord, int> concurrent;
+            ExpandableHashMap<GeoCoord, int> locked;
+            mutex lockedMutex;
+            function<int(const GeoCoord&, int)> intern;
+            function<int(const GeoCoord&)> lookup;
+            if (kind == 0) {
+                intern = [&](const GeoCoord& gc, int number) { return *concurrent.findOrAssociate(gc, number); };
+                lookup = [&](const GeoCoord& gc) { return *concurrent.find(gc); };
+            }
+            else {
+                intern = [&](const GeoCoord& gc, int number) {
+                    lock_guard<mutex> lock(lockedMutex);
+                    const int* n = locked.find(gc);
+                    if (n != nullptr)
+                        return *n;
+                    locked.associate(gc, number);
+                    return number;
+                };
+                lookup = [&](const GeoCoord& gc) {
+                    lock_guard<mutex> lock(lockedMutex);
+                    return *locked.find(gc);
+                };
+            }
+
+            double internSeconds, lookupSeconds;
+            atomic<int> disagreements(0);
+            internBenchmark(coords, threads, intern, lookup, internSeconds, lookupSeconds, disagreements);
+            int size = kind == 0 ? concurrent.size() : locked.size();
+            if (disagreements > 0 || size != graph.nodeCount())
+                failures++;
+
+            cout.setf(ios::fixed);
+            cout.precision(0);
+            cout << threads << "\t " << (kind == 0 ? "concurrent " : "mutex      ") << "\t" << coords.size() / internSeconds
+                 << "\t" << coords.size() * threads / lookupSeconds << "\t" << size << "\t" << disagreements << endl;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+static int area(const string& mapFile, double maxMiles)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+    int numNodes = graph.nodeCount();
+    if (numNodes == 0)
+        return 1;
+
+    cout << "depot   nodes  whole map s  area s    lookup us  mismatches" << endl;
+    ServiceAreaFinder finder(&sm);
+    mt19937 rng(43);
+    uniform_int_distribution<int> pick(0, numNodes - 1);
+    int totalMismatches = 0;
+    for (int i = 0; i < 5; i++) {
+        int depot = pick(rng);
+        ShortestPathTree reference;
+        auto t = chrono::steady_clock::now();
+        computeShortestPathTree(*snapshot, depot, reference);
+        double wholeMapSeconds = secondsSince(t);
+
+        vector<pair<GeoCoord, double> > found;
+        t = chrono::steady_clock::now();
+        finder.findServiceArea(graph.node(depot), maxMiles, found);
+        double areaSeconds = secondsSince(t);
+
+        // every node of the map gets asked about, and must be within the area exactly when its distance is;
+        // the search adds up whole chains, so distances may differ from the reference in their last bits
+        int mismatches = 0;
+        int within = 0;
+        t = chrono::steady_clock::now();
+        for (int n = 0; n < numNodes; n++) {
+            double miles;
+            bool inside = finder.findDistanceFromDepot(graph.node(depot), maxMiles, graph.node(n), miles) == DELIVERY_SUCCESS;
+            within += inside;
+            if (abs(reference.distance[n] - maxMiles) < 1e-9)
+                continue;
+            if (inside != (reference.distance[n] <= maxMiles) || (inside && abs(miles - reference.distance[n]) > 1e-9))
+                mismatches++;
+        }
+        double lookupSeconds = secondsSince(t);
+        if (within != (int) found.size())
+            mismatches++;
+        totalMismatches += mismatches;
+
+        cout.setf(ios::fixed);
+        cout.precision(4);
+        cout << depot << "\t" << found.size() << "\t" << wholeMapSeconds << "\t     " << areaSeconds << "\t"
+             << lookupSeconds / numNodes * 1e6 << "\t  " << mismatches << endl;
+    }
+    return totalMismatches == 0 ? 0 : 1;
+}
+
+static int depots(const string& mapFile, int numDepots, int numDeliveries)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+    if (graph.nodeCount() == 0)
+        return 1;
+
+    mt19937 rng(44);
+    uniform_int_distribution<int> pick(0, graph.nodeCount() - 1);
+    vector<GeoCoord> depotCoords;
+    for (int i = 0; i < numDepots; i++)
+        depotCoords.push_back(graph.node(pick(rng)));
+    vector<DeliveryRequest> deliveries;
+    for (int i = 0; i < numDeliveries; i++)
+        deliveries.push_back(DeliveryRequest("item " + to_string(i), graph.node(pick(rng))));
+
+    // every depot to every delivery, keeping the distances so the two assignments can be compared
+    PointToPointRouter router(&sm);
+    vector<vector<double> > distance(numDeliveries, vector<double>(numDepots, -1));
+    vector<int> pairwise(numDeliveries, -1);
+    auto t = chrono::steady_clock::now();
+    for (int i = 0; i < numDeliveries; i++) {
+        for (int d = 0; d < numDepots; d++) {
+            list<StreetSegment> route;
+            if (router.generatePointToPointRoute(depotCoords[d], deliveries[i].location, route, distance[i][d]) != DELIVERY_SUCCESS)
+                continue;
+            if (pairwise[i] < 0 || distance[i][d] < distance[i][pairwise[i]])
+                pairwise[i] = d;
+        }
+    }
+    double pairwiseSeconds = secondsSince(t);
+
+    DepotAssigner assigner(&sm);
+    vector<int> assignment;
+    t = chrono::steady_clock::now();
+    assigner.assignDeliveries(depotCoords, deliveries, assignment);
+    double assignSeconds = secondsSince(t);
+
+    // ties may go either way, so only the distances have to agree
+    int mismatches = 0;
+    for (int i = 0; i < numDeliveries; i++) {
+        if ((pairwise[i] < 0) != (assignment[i] < 0))
+            mismatches++;
+        else if (pairwise[i] >= 0 && abs(distance[i][pairwise[i]] - distance[i][assignment[i]]) > 1e-9)
+            mismatches++;
+    }
+
+    cout.setf(ios::fixed);
+    cout.precision(4);
+    cout << "depots  deliveries  pairwise s  one search s  speedup  mismatches" << endl;
+    cout << numDepots << "\t" << numDeliveries << "\t    " << pairwiseSeconds << "\t" << assignSeconds << "\t      "
+         << pairwiseSeconds / assignSeconds << "x\t  " << mismatches << endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+static int labels(const string& mapFile, const string& labelFile, int numQueries)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    vector<Query> queries;
+    makeQueries(sm, numQueries, queries);
+
+    auto t = chrono::steady_clock::now();
+    {
+        DistanceOracle builder(&sm);
+        if (!builder.buildLabels() || !builder.saveLabels(labelFile)) {
+            cerr << "Unable to write label file " << labelFile << endl;
+            return 1;
+        }
+    }
+    double buildSeconds = secondsSince(t);
+
+    // the labels are mapped rather than read, so loading them costs next to nothing
+    DistanceOracle oracle(&sm);
+    t = chrono::steady_clock::now();
+    if (!oracle.loadLabels(labelFile)) {
+        cerr << "Unable to load label file " << labelFile << endl;
+        return 1;
+    }
+    double loadSeconds = secondsSince(t);
+
+    // the router adds up its route and the labels add up their hubs, so the last bits may differ
+    int mismatches = 0;
+    vector<double> distances(queries.size());
+    t = chrono::steady_clock::now();
+    for (size_t i = 0; i < queries.size(); i++) {
+        DeliveryResult r = oracle.findDistance(queries[i].start, queries[i].end, distances[i]);
+        if (r != queries[i].result)
+            mismatches++;
+    }
+    double lookupSeconds = secondsSince(t);
+    for (size_t i = 0; i < queries.size(); i++) {
+        if (queries[i].result == DELIVERY_SUCCESS && abs(distances[i] - queries[i].distance) > 1e-9)
+            mismatches++;
+    }
+
+    PointToPointRouter router(&sm);
+    t = chrono::steady_clock::now();
+    for (auto& q : queries) {
+        list<StreetSegment> route;
+        double distance;
+        router.generatePointToPointRoute(q.start, q.end, route, distance);
+    }
+    double routeSeconds = secondsSince(t);
+
+    // a matrix between up to 500 stops, as the optimizer would want it
+    vector<GeoCoord> stops;
+    for (size_t i = 0; i < queries.size() && stops.size() < 500; i++)
+        stops.push_back(queries[i].start);
+    DistanceOracle searcher(&sm);
+    vector<vector<double> > matrix, searchedMatrix;
+    t = chrono::steady_clock::now();
+    oracle.findDistances(stops, stops, matrix);
+    double matrixSeconds = secondsSince(t);
+    t = chrono::steady_clock::now();
+    searcher.findDistances(stops, stops, searchedMatrix);
+    double searchedSeconds = secondsSince(t);
+    for (size_t i = 0; i < stops.size(); i++) {
+        for (size_t j = 0; j < stops.size(); j++) {
+            if (matrix[i][j] != searchedMatrix[i][j] && abs(matrix[i][j] - searchedMatrix[i][j]) > 1e-9)
+                mismatches++;
+        }
+    }
+    double entries = (double) stops.size() * stops.size();
+
+    cout.setf(ios::fixed);
+    cout.precision(4);
+    cout << "build s  load s  queries  route us  label us  mismatches" << endl;
+    cout << buildSeconds << "\t " << loadSeconds << "\t " << queries.size() << "\t  "
+         << routeSeconds / queries.size() * 1e6 << "\t    " << lookupSeconds / queries.size() * 1e6 << "\t    " << mismatches << endl;
+    cout << "matrix of " << stops.size() << " stops: " << searchedSeconds / entries * 1e6 << " us an entry with a search per row, "
+         << matrixSeconds / entries * 1e6 << " us with labels" << endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+// whether two plans give the robot the same commands
+static bool sameCommands(const vector<DeliveryCommand>& a, const vector<DeliveryCommand>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].description() != b[i].description())
+            return false;
+    return true;
+}
+
+static int replan(const string& mapFile, int numStops)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+    if (graph.nodeCount() == 0)
+        return 1;
+
+    // the stops are picked among the nodes the depot can reach, so that the tour can be delivered
+    mt19937 rng(55);
+    uniform_int_distribution<int> pick(0, graph.nodeCount() - 1);
+    int depotNode = pick(rng);
+    NearestSourceForest forest;
+    computeNearestSourceForest(*snapshot, vector<int>(1, depotNode), forest);
+    GeoCoord depot = graph.node(depotNode);
+    vector<DeliveryRequest> deliveries;
+    while ((int) deliveries.size() < numStops) {
+        int node = pick(rng);
+        if (forest.reached(node))
+            deliveries.push_back(DeliveryRequest("item " + to_string(deliveries.size()), graph.node(node)));
+    }
+
+    DeliveryPlanner planner(&sm);
+    DeliveryTour tour;
+    auto t = chrono::steady_clock::now();
+    if (planner.generateDeliveryTour(depot, deliveries, tour) != DELIVERY_SUCCESS) {
+        cerr << "The random tour can't be delivered" << endl;
+        return 1;
+    }
+    double planSeconds = secondsSince(t);
+
+    // the robot is halfway along each leg in turn, having made the deliveries before it; halfway through
+    // the tour, a street on the rest of it is closed. Every re-plan is checked against one which is
+    // given nothing to reuse
+    double replanSeconds = 0, fullSeconds = 0;
+    int replans = 0, mismatches = 0;
+    for (int i = 0; i < numStops; i++) {
+        vector<DeliveryRequest> completed(tour.deliveries.begin(), tour.deliveries.begin() + i);
+        const StreetPath& leg = tour.legs[i];
+        if (leg.size() < 2)
+            continue;
+        GeoCoord position = leg.segment(leg.size() / 2).start;
+
+        if (i == numStops / 2) {
+            for (int j = numStops - 1; j > i; j--) {
+                if (!tour.legs[j].empty()) {
+                    StreetSegment closed = tour.legs[j].segment(0);
+                    sm.setSegmentClosed(closed.start, closed.end, true);
+                    break;
+                }
+            }
+        }
+
+        DeliveryTour replanned, full;
+        DeliveryTour nothingKept = tour;
+        nothingKept.snapshot = nullptr;
+        t = chrono::steady_clock::now();
+        DeliveryResult r1 = planner.replanDeliveryTour(tour, position, completed, replanned);
+        replanSeconds += secondsSince(t);
+        t = chrono::steady_clock::now();
+        DeliveryResult r2 = planner.replanDeliveryTour(nothingKept, position, completed, full);
+        fullSeconds += secondsSince(t);
+        replans++;
+        if (r1 != r2 || (r1 == DELIVERY_SUCCESS && (!sameCommands(replanned.commands, full.commands) ||
+                abs(replanned.totalDistanceTravelled - full.totalDistanceTravelled) > 1e-9)))
+            mismatches++;
+    }
+
+    cout.setf(ios::fixed);
+    cout.precision(4);
+    cout << "stops  plan s  replans  replan ms  routed again ms  mismatches" << endl;
+    cout << numStops << "\t" << planSeconds << "\t" << replans << "\t " << replanSeconds / replans * 1e3 << "\t    "
+         << fullSeconds / replans * 1e3 << "\t\t     " << mismatches << endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+// one case of the cross-check: a query, on the map with some segments changed
+struct CrossCase
+{
+    vector<pair<StreetSegment, SegmentOverride> > changes;
+    int start;
+    int end;
+};
+
+// shortest paths by plain Dijkstra over single edges, sharing no code with any engine; path gets the
+// edges of the shortest path to target, if there is one
+static double referenceDistance(const MapSnapshot& snapshot, int source, int target, vector<int>* path = nullptr)
+{
+    const MapData& graph = snapshot.data();
+    vector<double> distance(graph.nodeCount(), numeric_limits<double>::infinity());
+    vector<int> parentEdge(graph.nodeCount(), -1);
+    priority_queue<pair<double, int>, vector<pair<double, int> >, greater<pair<double, int> > > heap;
+    distance[source] = 0;
+    heap.push(make_pair(0.0, source));
+    while (!heap.empty()) {
+        pair<double, int> top = heap.top();
+        heap.pop();
+        int n = top.second;
+        if (top.first > distance[n])
+            continue;
+        if (n == target)
+            break;
+        graph.useNode(n);
+        for (int e = graph.firstEdge[n]; e < graph.firstEdge[n + 1]; e++) {
+            if (!snapshot.edgeOpen(e))
+                continue;
+            int m = graph.edgeTarget[e];
+            double d = distance[n] + snapshot.edgeWeight(e);
+            if (d < distance[m]) {
+                distance[m] = d;
+                parentEdge[m] = e;
+                heap.push(make_pair(d, m));
+            }
+        }
+    }
+
+    if (path != nullptr) {
+        path->clear();
+        for (int n = target; parentEdge[n] >= 0; n = graph.edgeSource[parentEdge[n]])
+            path->push_back(parentEdge[n]);
+        reverse(path->begin(), path->end());
+    }
+    return distance[target];
+}
+
+static bool sameDistance(double a, double b)
+{
+    if (a == numeric_limits<double>::infinity() || b == numeric_limits<double>::infinity())
+        return a == b;
+    return abs(a - b) <= 1e-9 * max(1.0, abs(a));
+}
+
+// makes (or, with undo, takes back) the changes of a case
+static void applyChanges(StreetMap& sm, const CrossCase& c, bool undo)
+{
+    for (const auto& change : c.changes) {
+        const StreetSegment& s = change.first;
+        sm.setSegmentClosed(s.start, s.end, undo ? false : change.second.closed);
+        sm.setSegmentWeight(s.start, s.end, undo ? -1 : change.second.weight);
+    }
+}
+
+// whether route is a walk along open segments from start to end, and if so what it costs
+static bool validRoute(const MapSnapshot& snapshot, const list<StreetSegment>& route,
+                       const GeoCoord& start, const GeoCoord& end, double& weight)
+{
+    weight = 0;
+    GeoCoord at = start;
+    for (const auto& s : route) {
+        int e = snapshot.findEdge(s.start, s.end);
+        if (s.start != at || e < 0 || !snapshot.edgeOpen(e) || s.name != snapshot.data().segment(e).name)
+            return false;
+        weight += snapshot.edgeWeight(e);
+        at = s.end;
+    }
+    return at == end;
+}
+
+// the router minimizes the weights of the segments, but reports the actual length of its route
+static double routeLength(const list<StreetSegment>& route)
+{
+    double miles = 0;
+    for (const auto& s : route)
+        miles += distanceEarthMiles(s.start, s.end);
+    return miles;
+}
+
+// the engines which answer queries on a map, and the labels built for it as loaded
+struct Engines
+{
+    Engines(StreetMap* sm)
+     : map(sm), oracle(sm), areas(sm), overlay(sm)
+    {
+        oracle.buildLabels();
+        overlay.buildOverlay(max(4, sm->snapshot()->data().nodeCount() / 6));
+    }
+    StreetMap* map;
+    DistanceOracle oracle;
+    ServiceAreaFinder areas;
+    OverlayRouter overlay;
+};
+
+// asks every engine for the distance of the case; returns what disagreed with the reference, or ""
+static string checkCase(Engines& engines, const CrossCase& c)
+{
+    // the depot trees are found before the changes, so that they have to be brought up to date for them
+    DepotTrees depotTrees(engines.map);
+    depotTrees.addDepot(engines.map->snapshot()->data().node(c.start));
+    depotTrees.addDepot(engines.map->snapshot()->data().node(c.end));
+    shared_ptr<const MapSnapshot> before = engines.map->snapshot();
+
+    applyChanges(*engines.map, c, false);
+    shared_ptr<const MapSnapshot> snapshot = engines.map->snapshot();
+    const MapData& graph = snapshot->data();
+    const GeoCoord start = graph.node(c.start);
+    const GeoCoord end = graph.node(c.end);
+    double expected = referenceDistance(*snapshot, c.start, c.end);
+    bool reachable = expected != numeric_limits<double>::infinity();
+    ostringstream failure;
+    failure.precision(12);
+
+    list<StreetSegment> route;
+    double miles = 0, weight = 0;
+    DeliveryResult r = PointToPointRouter(snapshot).generatePointToPointRoute(start, end, route, miles);
+    if ((r == DELIVERY_SUCCESS) != reachable)
+        failure << "router returned " << r << "; ";
+    else if (reachable && !validRoute(*snapshot, route, start, end, weight))
+        failure << "router gave an invalid route of " << route.size() << " segments; ";
+    else if (reachable && (!sameDistance(weight, expected) || !sameDistance(miles, routeLength(route))))
+        failure << "router gave a route costing " << weight << " and " << miles << " miles long; ";
+
+    route.clear();
+    engines.overlay.customize();
+    r = engines.overlay.generatePointToPointRoute(start, end, route, miles);
+    if ((r == DELIVERY_SUCCESS) != reachable)
+        failure << "overlay router returned " << r << "; ";
+    else if (reachable && !validRoute(*snapshot, route, start, end, weight))
+        failure << "overlay router gave an invalid route of " << route.size() << " segments; ";
+    else if (reachable && (!sameDistance(weight, expected) || !sameDistance(miles, routeLength(route))))
+        failure << "overlay router gave a route costing " << weight << " and " << miles << " miles long; ";
+
+    for (int toDepot = 0; toDepot < 2; toDepot++) {
+        StreetPath path;
+        miles = 0;
+        r = toDepot ? depotTrees.routeToDepot(start, end, path, miles) : depotTrees.routeFromDepot(start, end, path, miles);
+        path.toList(route);
+        if ((r == DELIVERY_SUCCESS) != reachable)
+            failure << "depot trees returned " << r << "; ";
+        else if (reachable && !validRoute(*snapshot, route, start, end, weight))
+            failure << "depot trees gave an invalid route of " << route.size() << " segments; ";
+        else if (reachable && (!sameDistance(weight, expected) || !sameDistance(miles, routeLength(route))))
+            failure << "depot trees gave a route costing " << weight << " and " << miles << " miles long; ";
+    }
+
+    // a plan started before the changes still routes on the map as it was, after the trees moved on
+    double expectedBefore = referenceDistance(*before, c.start, c.end);
+    bool reachableBefore = expectedBefore != numeric_limits<double>::infinity();
+    for (int toDepot = 0; toDepot < 2; toDepot++) {
+        StreetPath path;
+        miles = 0;
+        r = toDepot ? depotTrees.routeToDepot(start, end, path, miles, before)
+                    : depotTrees.routeFromDepot(start, end, path, miles, before);
+        path.toList(route);
+        if ((r == DELIVERY_SUCCESS) != reachableBefore)
+            failure << "depot trees returned " << r << " before the changes; ";
+        else if (reachableBefore && !validRoute(*before, route, start, end, weight))
+            failure << "depot trees gave an invalid route of " << route.size() << " segments before the changes; ";
+        else if (reachableBefore && (!sameDistance(weight, expectedBefore) || !sameDistance(miles, routeLength(route))))
+            failure << "depot trees gave a route costing " << weight << " before the changes; ";
+    }
+
+    ShortestPathTree tree;
+    computeShortestPathTree(*snapshot, c.start, tree);
+    if (!sameDistance(tree.distance[c.end], expected))
+        failure << "shortest path tree gave " << tree.distance[c.end] << "; ";
+    computeShortestPathTreeParallel(*snapshot, c.start, tree, 2);
+    if (!sameDistance(tree.distance[c.end], expected))
+        failure << "delta-stepping gave " << tree.distance[c.end] << "; ";
+    computeReverseShortestPathTreeParallel(*snapshot, c.end, tree, 2);
+    if (!sameDistance(tree.distance[c.start], expected))
+        failure << "reverse delta-stepping gave " << tree.distance[c.start] << "; ";
+
+    NearestSourceForest forest;
+    computeNearestSourceForest(*snapshot, vector<int>(1, c.start), forest, vector<int>(1, c.end));
+    if (!sameDistance(forest.distance[c.end], expected))
+        failure << "nearest source forest gave " << forest.distance[c.end] << "; ";
+
+    miles = numeric_limits<double>::infinity();
+    r = engines.oracle.findDistance(start, end, miles);
+    if ((r == DELIVERY_SUCCESS) != reachable || (reachable && !sameDistance(miles, expected)))
+        failure << "distance oracle returned " << r << " and " << miles << "; ";
+
+    miles = numeric_limits<double>::infinity();
+    r = engines.areas.findDistanceFromDepot(start, reachable ? expected + 1 : 1e9, end, miles);
+    if ((r == DELIVERY_SUCCESS) != reachable || (reachable && !sameDistance(miles, expected)))
+        failure << "service area returned " << r << " and " << miles << "; ";
+
+    applyChanges(*engines.map, c, true);
+    return failure.str();
+}
+
+// makes a failing case smaller while it still fails: drops the changes it doesn't need, then moves
+// each end of the query along the reference path towards the other
+static void shrinkCase(Engines& engines, CrossCase& c)
+{
+    for (size_t i = c.changes.size(); i-- > 0; ) {
+        CrossCase smaller = c;
+        smaller.changes.erase(smaller.changes.begin() + i);
+        if (!checkCase(engines, smaller).empty())
+            c = smaller;
+    }
+
+    for (int side = 0; side < 2; side++) {
+        applyChanges(*engines.map, c, false);
+        shared_ptr<const MapSnapshot> snapshot = engines.map->snapshot();
+        vector<int> path;
+        referenceDistance(*snapshot, c.start, c.end, &path);
+        applyChanges(*engines.map, c, true);
+
+        // the nodes of the path, in order from the end which stays
+        vector<int> nodes(1, c.start);
+        for (int e : path)
+            nodes.push_back(snapshot->data().edgeTarget[e]);
+        if (side == 1)
+            reverse(nodes.begin(), nodes.end());
+        for (size_t i = 0; i + 1 < nodes.size(); i++) {
+            CrossCase smaller = c;
+            (side == 0 ? smaller.end : smaller.start) = nodes[i];
+            if (!checkCase(engines, smaller).empty()) {
+                c = smaller;
+                break;
+            }
+        }
+    }
+}
+
+static void printCase(const MapData& graph, const CrossCase& c, const string& failure)
+{
+    for (const auto& change : c.changes) {
+        cout << "  segment " << change.first.start.latitudeText << " " << change.first.start.longitudeText << " to "
+             << change.first.end.latitudeText << " " << change.first.end.longitudeText;
+        if (change.second.closed)
+            cout << " closed";
+        if (change.second.weight >= 0)
+            cout << " weight " << change.second.weight;
+        cout << endl;
+    }
+    cout << "  from " << graph.node(c.start).latitudeText << " " << graph.node(c.start).longitudeText
+         << " to " << graph.node(c.end).latitudeText << " " << graph.node(c.end).longitudeText << endl;
+    cout << "  " << failure << endl;
+}
+
+// a node in the middle of a chain and one of its neighbours, which is on the same chain
+static bool pickWithinChain(const MapData& graph, mt19937& rng, int& a, int& b)
+{
+    uniform_int_distribution<int> pick(0, graph.nodeCount() - 1);
+    for (int tries = 0; tries < 1000; tries++) {
+        int n = pick(rng);
+        graph.useNode(n);
+        if (graph.isChainEnd(n))
+            continue;
+        a = n;
+        b = graph.edgeTarget[graph.firstEdge[n] + rng() % (graph.firstEdge[n + 1] - graph.firstEdge[n])];
+        return true;
+    }
+    return false;
+}
+
+// a random case; most are plain queries, the rest are built to trip up the engines
+static CrossCase makeCase(const StreetMap& sm, mt19937& rng)
+{
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+    uniform_int_distribution<int> pick(0, graph.nodeCount() - 1);
+    CrossCase c;
+    c.start = pick(rng);
+    c.end = pick(rng);
+
+    int kind = rng() % 6;
+    if (kind == 1)
+        c.end = c.start;
+    else if (kind == 2)
+        pickWithinChain(graph, rng, c.start, c.end);
+
+    // close or reweight segments of the shortest path, so the engines must find the way around them,
+    // or give parts of it a weight of zero or the same weight, so that paths tie
+    if (kind >= 3) {
+        vector<int> path;
+        referenceDistance(*snapshot, c.start, c.end, &path);
+        int changes = 1 + rng() % 3;
+        for (int i = 0; i < changes && !path.empty(); i++) {
+            int e = path[rng() % path.size()];
+            SegmentOverride o;
+            if (kind == 3)
+                o.closed = true;
+            else
+                o.weight = (kind == 4) ? 0 : 0.01;
+            c.changes.push_back(make_pair(graph.segment(e), o));
+            if (rng() % 2) {
+                StreetSegment back = graph.segment(e);
+                swap(back.start, back.end);
+                c.changes.push_back(make_pair(back, o));
+            }
+        }
+    }
+    return c;
+}
+
+// writes a small street map built to be awkward: a grid with holes, so that many paths tie and
+// many nodes sit in the middle of chains, a diagonal, a dead end, and two pieces the grid isn't
+// connected to, a ring with no junctions on it and a single segment
+static void writeSyntheticMap(const string& mapFile, int size, mt19937& rng)
+{
+    auto coord = [](double lat, double lon) {
+        char text[64];
+        snprintf(text, sizeof text, "%.7f %.7f", lat, lon);
+        return string(text);
+    };
+    auto point = [&](int i, int j) { return coord(34 + i * 0.001, -118 + j * 0.001); };
+    auto street = [](ofstream& out, const string& name, const vector<string>& points) {
+        out << name << endl << points.size() - 1 << endl;
+        for (size_t i = 0; i + 1 < points.size(); i++)
+            out << points[i] << " " << points[i + 1] << endl;
+    };
+
+    ofstream out(mapFile);
+    for (int i = 0; i < size; i++) {
+        for (int vertical = 0; vertical < 2; vertical++) {
+            // each row and column is cut into streets where a segment is missing
+            vector<string> points(1, vertical ? point(0, i) : point(i, 0));
+            int piece = 0;
+            for (int j = 1; j < size; j++) {
+                string next = vertical ? point(j, i) : point(i, j);
+                if (rng() % 5 == 0) {
+                    if (points.size() > 1)
+                        street(out, (vertical ? "Column " : "Row ") + to_string(i) + " part " + to_string(piece++), points);
+                    points.assign(1, next);
+                    continue;
+                }
+                points.push_back(next);
+            }
+            if (points.size() > 1)
+                street(out, (vertical ? "Column " : "Row ") + to_string(i) + " part " + to_string(piece), points);
+        }
+    }
+
+    vector<string> diagonal, deadEnd, ring;
+    for (int i = 0; i < size; i++)
+        diagonal.push_back(point(i, i));
+    street(out, "Diagonal Avenue", diagonal);
+    for (int i = 0; i <= 4; i++)
+        deadEnd.push_back(point(size / 2, size - 1 + i));
+    street(out, "Dead End Lane", deadEnd);
+    for (int i = 0; i <= 6; i++)
+        ring.push_back(coord(35 + 0.001 * cos(i % 6 * M_PI / 3), -117 + 0.001 * sin(i % 6 * M_PI / 3)));
+    street(out, "Ring Road", ring);
+    street(out, "Lonely Street", vector<string>{coord(36, -116), coord(36.001, -116)});
+}
+
+// checks the optimizer and the planner on random deliveries: the optimizer must only reorder the
+// deliveries, and report crow distances which match the orders; the planner must travel the sum of
+// the shortest paths of its legs, along valid routes
+static string checkTours(StreetMap& sm, mt19937& rng)
+{
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+    uniform_int_distribution<int> pick(0, graph.nodeCount() - 1);
+    DeliveryOptimizer optimizer(&sm);
+    DeliveryPlanner planner(&sm);
+    ostringstream failure;
+
+    auto crowDistance = [](const GeoCoord& depot, const vector<DeliveryRequest>& deliveries) {
+        double miles = 0;
+        GeoCoord at = depot;
+        for (const auto& d : deliveries) {
+            miles += distanceEarthMiles(at, d.location);
+            at = d.location;
+        }
+        return miles + distanceEarthMiles(at, depot);
+    };
+
+    // both the small and the large instance strategies of the optimizer
+    for (int stops : { 0, 1, 2, 8, 1200 }) {
+        int depotNode = pick(rng);
+        GeoCoord depot = graph.node(depotNode);
+        vector<DeliveryRequest> deliveries;
+        for (int i = 0; i < stops; i++)
+            deliveries.push_back(DeliveryRequest(to_string(i), graph.node(pick(rng))));
+        vector<DeliveryRequest> optimized = deliveries;
+        double oldCrowDistance, newCrowDistance;
+        optimizer.optimizeDeliveryOrder(depot, optimized, oldCrowDistance, newCrowDistance);
+
+        vector<int> seen(stops, 0);
+        bool permutation = (int) optimized.size() == stops;
+        for (const auto& d : optimized)
+            permutation = permutation && ++seen[stoi(d.item)] == 1 && d.location == deliveries[stoi(d.item)].location;
+        if (!permutation)
+            failure << "the optimizer lost or changed deliveries of " << stops << "; ";
+        if (!sameDistance(oldCrowDistance, crowDistance(depot, deliveries)) ||
+            !sameDistance(newCrowDistance, crowDistance(depot, optimized)) || newCrowDistance > oldCrowDistance + 1e-9)
+            failure << "the optimizer reported " << oldCrowDistance << " to " << newCrowDistance << " for " << stops << "; ";
+        if (stops > 8)
+            continue;
+
+        // the tour is planned with only the stops the depot can reach, so that it can be delivered
+        vector<DeliveryRequest> reachable;
+        double expected = 0;
+        GeoCoord at = depot;
+        for (const auto& d : optimized) {
+            double leg = referenceDistance(*snapshot, graph.nodeOf(at), graph.nodeOf(d.location));
+            if (leg == numeric_limits<double>::infinity())
+                continue;
+            reachable.push_back(d);
+            expected += leg;
+            at = d.location;
+        }
+        expected += referenceDistance(*snapshot, graph.nodeOf(at), depotNode);
+
+        DeliveryTour tour;
+        if (planner.generateDeliveryTour(depot, reachable, tour) != DELIVERY_SUCCESS ||
+            !sameDistance(tour.totalDistanceTravelled, expected)) {
+            failure << "the planner travelled " << tour.totalDistanceTravelled << " rather than " << expected << "; ";
+            continue;
+        }
+        for (size_t i = 0; i < tour.legs.size(); i++) {
+            const GeoCoord& from = (i == 0) ? depot : reachable[i - 1].location;
+            const GeoCoord& to = (i < reachable.size()) ? reachable[i].location : depot;
+            list<StreetSegment> route;
+            tour.legs[i].toList(route);
+            double weight;
+            if (!validRoute(*snapshot, route, from, to, weight) || !sameDistance(weight, tour.legDistances[i]))
+                failure << "the planner gave an invalid route for leg " << i << "; ";
+        }
+    }
+    return failure.str();
+}
+
+// runs the cases on one map, shrinking and printing the first failure; returns the number of failures
+static int crosscheckMap(const string& mapFile, const string& label, int numCases, mt19937& rng)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile) || sm.snapshot()->data().nodeCount() == 0) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    Engines engines(&sm);
+    const MapData& graph = sm.snapshot()->data();
+
+    int failures = 0;
+    auto t = chrono::steady_clock::now();
+    for (int i = 0; i < numCases; i++) {
+        CrossCase c = makeCase(sm, rng);
+        string failure = checkCase(engines, c);
+        if (failure.empty())
+            continue;
+        if (failures++ == 0) {
+            shrinkCase(engines, c);
+            cout << label << ": case " << i << " fails, which shrinks to" << endl;
+            printCase(graph, c, checkCase(engines, c));
+        }
+    }
+    string tourFailure = checkTours(sm, rng);
+    if (!tourFailure.empty()) {
+        cout << label << ": " << tourFailure << endl;
+        failures++;
+    }
+    cout << label << "\t" << graph.nodeCount() << "\t" << numCases << "\t" << secondsSince(t) << "\t" << failures << endl;
+    return failures;
+}
+
+static int crosscheck(const string& mapFile, int numCases, unsigned int seed)
+{
+    mt19937 rng(seed);
+    cout.setf(ios::fixed);
+    cout.precision(4);
+    cout << "map\t\tnodes\tcases\tseconds\tfailures" << endl;
+    int failures = crosscheckMap(mapFile, mapFile, numCases, rng);
+
+    // the synthetic maps are written next to the real one, and removed once checked
+    const string syntheticFile = mapFile + ".crosscheck";
+    for (int size : { 3, 8, 20, 60 }) {
+        writeSyntheticMap(syntheticFile, size, rng);
+        failures += crosscheckMap(syntheticFile, "grid " + to_string(size), numCases, rng);
+    }
+    remove(syntheticFile.c_str());
+    return failures == 0 ? 0 : 1;
+}
+
+static int overlay(const string& mapFile, int maxCellSize, int numQueries)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    vector<Query> queries;
+    makeQueries(sm, numQueries, queries);
+
+    OverlayRouter overlayRouter(&sm);
+    auto t = chrono::steady_clock::now();
+    overlayRouter.buildOverlay(maxCellSize);
+    double buildSeconds = secondsSince(t);
+
+    // routes every query with both routers, checking the overlay's routes cost what the router's do
+    PointToPointRouter router(&sm);
+    double routeSeconds = 0, overlaySeconds = 0;
+    int mismatches = 0;
+    auto compare = [&]() {
+        shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+        for (const auto& q : queries) {
+            list<StreetSegment> route, overlayRoute;
+            double miles, overlayMiles, weight = 0, overlayWeight = 0;
+            t = chrono::steady_clock::now();
+            DeliveryResult r = router.generatePointToPointRoute(q.start, q.end, route, miles);
+            routeSeconds += secondsSince(t);
+            t = chrono::steady_clock::now();
+            DeliveryResult o = overlayRouter.generatePointToPointRoute(q.start, q.end, overlayRoute, overlayMiles);
+            overlaySeconds += secondsSince(t);
+            if (r != o || (r == DELIVERY_SUCCESS && (!validRoute(*snapshot, route, q.start, q.end, weight) ||
+                    !validRoute(*snapshot, overlayRoute, q.start, q.end, overlayWeight) || !sameDistance(weight, overlayWeight))))
+                mismatches++;
+        }
+    };
+    compare();
+
+    // close a few streets on the routes (both ways), customize again and check the new routes too
+    int closed = 0;
+    for (size_t i = 0; i < queries.size() && closed < 20; i += queries.size() / 20 + 1) {
+        list<StreetSegment> route;
+        double miles;
+        if (router.generatePointToPointRoute(queries[i].start, queries[i].end, route, miles) != DELIVERY_SUCCESS || route.empty())
+            continue;
+        sm.setSegmentClosed(route.front().start, route.front().end, true);
+        sm.setSegmentClosed(route.front().end, route.front().start, true);
+        closed++;
+    }
+    t = chrono::steady_clock::now();
+    overlayRouter.customize();
+    double customizeSeconds = secondsSince(t);
+    compare();
+
+    // a cell written out and read back in must be taken
+    bool cellKept = overlayRouter.saveCell(0, mapFile + ".cell") && overlayRouter.loadCell(mapFile + ".cell");
+    remove((mapFile + ".cell").c_str());
+
+    cout.setf(ios::fixed);
+    cout.precision(4);
+    cout << "cells  build s  customize s  route us  overlay us  mismatches" << endl;
+    cout << overlayRouter.cellCount() << "\t" << buildSeconds << "\t " << customizeSeconds << "\t      "
+         << routeSeconds / (2 * queries.size()) * 1e6 << "\t" << overlaySeconds / (2 * queries.size()) * 1e6
+         << "\t    " << mismatches << endl;
+    cout << closed << " streets closed before customizing; cell file " << (cellKept ? "read back" : "NOT READ BACK") << endl;
+    return mismatches == 0 && cellKept ? 0 : 1;
+}
+
+static int incremental(const string& mapFile, int numStops, int numChanges)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+    if (graph.nodeCount() == 0)
+        return 1;
+
+    mt19937 rng(66);
+    uniform_int_distribution<int> pick(0, graph.nodeCount() - 1);
+    GeoCoord depot = graph.node(pick(rng));
+    vector<DeliveryRequest> deliveries;
+    int nextItem = 0;
+    for (int i = 0; i < numStops; i++)
+        deliveries.push_back(DeliveryRequest("item " + to_string(nextItem++), graph.node(pick(rng))));
+
+    IncrementalOptimizer optimizer(&sm);
+    optimizer.setTour(depot, deliveries);
+    optimizer.optimize();
+
+    // orders come and go, half of them new and half cancelled, keeping the tour about the same size
+    double addSeconds = 0, cancelSeconds = 0;
+    int adds = 0, cancels = 0;
+    for (int i = 0; i < numChanges; i++) {
+        if (i % 2 == 0) {
+            DeliveryRequest d("item " + to_string(nextItem++), graph.node(pick(rng)));
+            deliveries.push_back(d);
+            auto t = chrono::steady_clock::now();
+            optimizer.addDelivery(d);
+            addSeconds += secondsSince(t);
+            adds++;
+        }
+        else {
+            size_t k = rng() % deliveries.size();
+            DeliveryRequest d = deliveries[k];
+            deliveries.erase(deliveries.begin() + k);
+            auto t = chrono::steady_clock::now();
+            optimizer.cancelDelivery(d);
+            cancelSeconds += secondsSince(t);
+            cancels++;
+        }
+    }
+
+    // the tour must hold exactly the deliveries still ordered; it is compared with optimizing them from scratch
+    vector<DeliveryRequest> kept;
+    optimizer.getDeliveries(kept);
+    vector<string> expectedItems, keptItems;
+    for (const auto& d : deliveries)
+        expectedItems.push_back(d.item);
+    for (const auto& d : kept)
+        keptItems.push_back(d.item);
+    sort(expectedItems.begin(), expectedItems.end());
+    sort(keptItems.begin(), keptItems.end());
+    bool complete = expectedItems == keptItems;
+
+    // the length the optimizer kept up to date as it went must be that of the tour it ended with
+    double miles = 0;
+    GeoCoord at = depot;
+    for (const auto& d : kept) {
+        miles += distanceEarthMiles(at, d.location);
+        at = d.location;
+    }
+    miles += distanceEarthMiles(at, depot);
+    complete = complete && sameDistance(miles, optimizer.crowDistance());
+
+    IncrementalOptimizer fresh(&sm);
+    fresh.setTour(depot, deliveries);
+    auto t = chrono::steady_clock::now();
+    fresh.optimize();
+    double solveSeconds = secondsSince(t);
+
+    cout.setf(ios::fixed);
+    cout.precision(4);
+    cout << "stops  changes  add ms  cancel ms  re-solve ms  miles  re-solved miles  complete" << endl;
+    cout << numStops << "\t" << numChanges << "\t " << addSeconds / max(1, adds) * 1e3 << "\t " << cancelSeconds / max(1, cancels) * 1e3
+         << "\t    " << solveSeconds * 1e3 << "\t " << optimizer.crowDistance() << "\t" << fresh.crowDistance() << "\t\t  "
+         << (complete ? "yes" : "NO") << endl;
+    return complete ? 0 : 1;
+}
+
+// a random depot which reaches most of the map, rather than one on some small piece of it, along with
+// the forest of its shortest paths; the map must have a piece of at least half its nodes
+static int pickDepot(const MapSnapshot& snapshot, mt19937& rng, NearestSourceForest& forest)
+{
+    int numNodes = snapshot.data().nodeCount();
+    uniform_int_distribution<int> pick(0, numNodes - 1);
+    int depotNode, reached;
+    do {
+        depotNode = pick(rng);
+        computeNearestSourceForest(snapshot, vector<int>(1, depotNode), forest);
+        reached = count_if(forest.nearest.begin(), forest.nearest.end(), [](int n) { return n >= 0; });
+    } while (reached < numNodes / 2);
+    return depotNode;
+}
+
+static int trees(const string& mapFile, int numTours, int numStops)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+    if (graph.nodeCount() == 0)
+        return 1;
+
+    // the stops are picked among the nodes the depot can reach, so that the tours can be delivered
+    mt19937 rng(48);
+    uniform_int_distribution<int> pick(0, graph.nodeCount() - 1);
+    NearestSourceForest forest;
+    GeoCoord depot = graph.node(pickDepot(*snapshot, rng, forest));
+
+    DepotTrees depotTrees(&sm);
+    auto t = chrono::steady_clock::now();
+    depotTrees.addDepot(depot);
+    double buildSeconds = secondsSince(t);
+
+    // every tour is planned by searching every leg and with the depot legs read off the trees; halfway
+    // through, a street on the way out of the depot is closed, so the trees must be searched again
+    DeliveryPlanner planner(&sm);
+    DeliveryPlanner treePlanner(&sm, &depotTrees);
+    double planSeconds = 0, treeSeconds = 0;
+    int mismatches = 0, differentCommands = 0;
+    for (int i = 0; i < numTours; i++) {
+        vector<DeliveryRequest> deliveries;
+        while ((int) deliveries.size() < numStops) {
+            int node = pick(rng);
+            if (forest.reached(node))
+                deliveries.push_back(DeliveryRequest("item " + to_string(deliveries.size()), graph.node(node)));
+        }
+
+        DeliveryTour tour, treeTour;
+        t = chrono::steady_clock::now();
+        DeliveryResult r = planner.generateDeliveryTour(depot, deliveries, tour);
+        planSeconds += secondsSince(t);
+        t = chrono::steady_clock::now();
+        DeliveryResult tr = treePlanner.generateDeliveryTour(depot, deliveries, treeTour);
+        treeSeconds += secondsSince(t);
+
+        // where two routes are equally short, the trees may take the other one
+        if (r != tr || (r == DELIVERY_SUCCESS && !sameDistance(tour.totalDistanceTravelled, treeTour.totalDistanceTravelled)))
+            mismatches++;
+        else if (r == DELIVERY_SUCCESS && !sameCommands(tour.commands, treeTour.commands))
+            differentCommands++;
+
+        if (i == numTours / 2 && r == DELIVERY_SUCCESS && !tour.legs[0].empty()) {
+            StreetSegment closed = tour.legs[0].segment(0);
+            sm.setSegmentClosed(closed.start, closed.end, true);
+        }
+    }
+
+    cout.setf(ios::fixed);
+    cout.precision(4);
+    cout << "tours  stops  trees s  plan ms  with trees ms  mismatches  other commands" << endl;
+    cout << numTours << "\t" << numStops << "\t" << buildSeconds << "\t " << planSeconds / numTours * 1e3 << "\t "
+         << treeSeconds / numTours * 1e3 << "\t\t" << mismatches << "\t    " << differentCommands << endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+static int stream(const string& mapFile, int numStops)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile)) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    shared_ptr<const MapSnapshot> snapshot = sm.snapshot();
+    const MapData& graph = snapshot->data();
+    if (graph.nodeCount() == 0)
+        return 1;
+
+    mt19937 rng(49);
+    uniform_int_distribution<int> pick(0, graph.nodeCount() - 1);
+    NearestSourceForest forest;
+    GeoCoord depot = graph.node(pickDepot(*snapshot, rng, forest));
+    vector<DeliveryRequest> deliveries;
+    while ((int) deliveries.size() < numStops) {
+        int node = pick(rng);
+        if (forest.reached(node))
+            deliveries.push_back(DeliveryRequest("item " + to_string(deliveries.size()), graph.node(node)));
+    }
+
+    // the whole plan first, and then the same plan streamed, noting when its first leg arrives
+    DeliveryPlanner planner(&sm);
+    vector<DeliveryCommand> commands, streamed;
+    double miles, streamedMiles;
+    auto t = chrono::steady_clock::now();
+    DeliveryResult r = planner.generateDeliveryPlan(depot, deliveries, commands, miles);
+    double planSeconds = secondsSince(t);
+
+    double firstLegSeconds = -1;
+    size_t legs = 0;
+    t = chrono::steady_clock::now();
+    DeliveryResult sr = planner.streamDeliveryPlan(depot, deliveries, [&](const vector<DeliveryCommand>& leg) {
+        if (legs++ == 0)
+            firstLegSeconds = secondsSince(t);
+        streamed.insert(streamed.end(), leg.begin(), leg.end());
+    }, streamedMiles);
+    double streamSeconds = secondsSince(t);
+
+    bool same = r == sr && (r != DELIVERY_SUCCESS || (sameCommands(commands, streamed) && miles == streamedMiles &&
+                                                      legs == deliveries.size() + 1));
+    cout.setf(ios::fixed);
+    cout.precision(4);
+    cout << "stops  plan s  streamed s  first leg s  same" << endl;
+    cout << numStops << "\t" << planSeconds << "\t" << streamSeconds << "\t    " << firstLegSeconds << "\t "
+         << (same ? "yes" : "NO") << endl;
+    return same ? 0 : 1;
+}
+
+// routes the queries as lists and as paths, adding up the times; returns false if the map won't load
+static bool timePaths(const string& mapFile, const string& cacheFile, int numQueries, size_t& routed,
+                      long& segments, double& listSeconds, double& pathSeconds, int& mismatches)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile))
+        return false;
+    sm.openRouteCache(cacheFile);
+    vector<Query> queries;
+    makeQueries(sm, numQueries, queries);
+    routed = queries.size();
+
+    // each query is routed once beforehand, so that both kinds of result find the search already done
+    // in the route cache, and what is timed is mostly building the result
+    PointToPointRouter router(&sm);
+    for (const auto& q : queries) {
+        StreetPath path;
+        double miles;
+        router.generatePointToPointRoute(q.start, q.end, path, miles);
+    }
+
+    for (const auto& q : queries) {
+        list<StreetSegment> route;
+        StreetPath path;
+        double listMiles = 0, pathMiles = 0;
+        auto t = chrono::steady_clock::now();
+        DeliveryResult r = router.generatePointToPointRoute(q.start, q.end, route, listMiles);
+        listSeconds += secondsSince(t);
+        t = chrono::steady_clock::now();
+        DeliveryResult p = router.generatePointToPointRoute(q.start, q.end, path, pathMiles);
+        pathSeconds += secondsSince(t);
+
+        // the path must give back exactly the segments of the list, and the same distance
+        list<StreetSegment> fromPath;
+        path.toList(fromPath);
+        segments += route.size();
+        if (r != p || listMiles != pathMiles || fromPath.size() != route.size() ||
+                !equal(route.begin(), route.end(), fromPath.begin(), [](const StreetSegment& a, const StreetSegment& b) {
+                    return a.start == b.start && a.end == b.end && a.name == b.name;
+                }))
+            mismatches++;
+    }
+    return true;
+}
+
+static int paths(const string& mapFile, int numQueries)
+{
+    // the map saves its route cache as it goes away, so the file is only removed after that
+    string cacheFile = mapFile + ".paths";
+    remove(cacheFile.c_str());
+    size_t routed = 0;
+    long segments = 0;
+    double listSeconds = 0, pathSeconds = 0;
+    int mismatches = 0;
+    bool loaded = timePaths(mapFile, cacheFile, numQueries, routed, segments, listSeconds, pathSeconds, mismatches);
+    remove(cacheFile.c_str());
+    if (!loaded) {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+
+    cout.setf(ios::fixed);
+    cout.precision(2);
+    cout << "queries  segments  list us  path us  mismatches" << endl;
+    cout << routed << "\t " << segments << "\t   " << listSeconds / routed * 1e6 << "\t    "
+         << pathSeconds / routed * 1e6 << "\t\t" << mismatches << endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && string(argv[1]) == "scaling") {
+        int maxThreads = argc > 3 ? atoi(argv[3]) : thread::hardware_concurrency();
+        int numQueries = argc > 4 ? atoi(argv[4]) : 2000;
+        return scaling(argv[2], maxThreads > 0 ? maxThreads : 1, numQueries > 0 ? numQueries : 1);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "sssp")
+        return sssp(argv[2], argc > 3 ? atoi(argv[3]) : 0, argc > 4 ? atof(argv[4]) : 0);
+
+    if (argc >= 3 && string(argv[1]) == "tour") {
+        int numStops = argc > 3 ? atoi(argv[3]) : 10000;
+        return tour(argv[2], numStops > 0 ? numStops : 1);
+    }
+
+    if (argc >= 4 && string(argv[1]) == "cache") {
+        int numQueries = argc > 4 ? atoi(argv[4]) : 2000;
+        return cache(argv[2], argv[3], numQueries > 0 ? numQueries : 1);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "hashmap") {
+        int maxThreads = argc > 3 ? atoi(argv[3]) : thread::hardware_concurrency();
+        return hashmap(argv[2], maxThreads > 0 ? maxThreads : 1);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "area") {
+        double maxMiles = argc > 3 ? atof(argv[3]) : 1;
+        return area(argv[2], maxMiles > 0 ? maxMiles : 1);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "depots") {
+        int numDepots = argc > 3 ? atoi(argv[3]) : 5;
+        int numDeliveries = argc > 4 ? atoi(argv[4]) : 1000;
+        return depots(argv[2], numDepots > 0 ? numDepots : 1, numDeliveries > 0 ? numDeliveries : 1);
+    }
+
+    if (argc >= 4 && string(argv[1]) == "labels") {
+        int numQueries = argc > 4 ? atoi(argv[4]) : 2000;
+        return labels(argv[2], argv[3], numQueries > 0 ? numQueries : 1);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "replan") {
+        int numStops = argc > 3 ? atoi(argv[3]) : 100;
+        return replan(argv[2], numStops > 0 ? numStops : 1);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "crosscheck") {
+        int numCases = argc > 3 ? atoi(argv[3]) : 300;
+        unsigned int seed = argc > 4 ? atoi(argv[4]) : 1;
+        return crosscheck(argv[2], numCases > 0 ? numCases : 1, seed);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "overlay") {
+        int maxCellSize = argc > 3 ? atoi(argv[3]) : 1024;
+        int numQueries = argc > 4 ? atoi(argv[4]) : 500;
+        return overlay(argv[2], maxCellSize > 0 ? maxCellSize : 1, numQueries > 0 ? numQueries : 1);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "incremental") {
+        int numStops = argc > 3 ? atoi(argv[3]) : 200;
+        int numChanges = argc > 4 ? atoi(argv[4]) : 100;
+        return incremental(argv[2], numStops > 0 ? numStops : 1, numChanges > 0 ? numChanges : 1);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "paths") {
+        int numQueries = argc > 3 ? atoi(argv[3]) : 2000;
+        return paths(argv[2], numQueries > 0 ? numQueries : 1);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "trees") {
+        int numTours = argc > 3 ? atoi(argv[3]) : 50;
+        int numStops = argc > 4 ? atoi(argv[4]) : 5;
+        return trees(argv[2], numTours > 0 ? numTours : 1, numStops > 0 ? numStops : 1);
+    }
+
+    if (argc >= 3 && string(argv[1]) == "stream") {
+        int numStops = argc > 3 ? atoi(argv[3]) : 1000;
+        return stream(argv[2], numStops > 0 ? numStops : 1);
+    }
+
+    cout << "Usage: " << argv[0] << " scaling mapdata.txt [maxThreads] [queries]" << endl;
+    cout << "       " << argv[0] << " sssp mapdata.txt [threads] [delta]" << endl;
+    cout << "       " << argv[0] << " tour mapdata.txt [stops]" << endl;
+    cout << "       " << argv[0] << " cache mapdata.txt routes.cache [queries]" << endl;
+    cout << "       " << argv[0] << " hashmap mapdata.txt [maxThreads]" << endl;
+    cout << "       " << argv[0] << " area mapdata.txt [miles]" << endl;
+    cout << "       " << argv[0] << " depots mapdata.txt [depots] [deliveries]" << endl;
+    cout << "       " << argv[0] << " labels mapdata.txt labels.file [queries]" << endl;
+    cout << "       " << argv[0] << " replan mapdata.txt [stops]" << endl;
+    cout << "       " << argv[0] << " crosscheck mapdata.txt [cases] [seed]" << endl;
+    cout << "       " << argv[0] << " overlay mapdata.txt [cellSize] [queries]" << endl;
+    cout << "       " << argv[0] << " incremental mapdata.txt [stops] [changes]" << endl;
+    cout << "       " << argv[0] << " paths mapdata.txt [queries]" << endl;
+    cout << "       " << argv[0] << " trees mapdata.txt [tours] [stops]" << endl;
+    cout << "       " << argv[0] << " stream mapdata.txt [stops]" << endl;
+    return 1;
+}
@@ -1,19 +1,70 @@
 #include "provided.h"
+#include "Trace.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
+#include <thread>
 using namespace std;
 
 bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v);
 bool parseDelivery(string line, string& lat, string& lon, string& item);
+bool parseDepot(string text, GeoCoord& depot);
+int serve(string mapFile, string socketPath, string cacheFile, const vector<string>& depots);
+int tile(string mapFile, string tileFile);
+int label(string mapFile, string labelFile);
+
+int run(int argc, char *argv[], string cacheFile, const vector<string>& depots);
 
 int main(int argc, char *argv[])
 {
+    // a route cache, a trace file and the depots to serve may be given before running or serving, and are
+    // then dropped from the arguments
+    string cacheFile, traceFile;
+    vector<string> depots;
+    while (argc >= 3 && (string(argv[1]) == "--cache" || string(argv[1]) == "--trace" || string(argv[1]) == "--depot"))
+    {
+        if (string(argv[1]) == "--depot")
+            depots.push_back(argv[2]);
+        else
+            (string(argv[1]) == "--cache" ? cacheFile : traceFile) = argv[2];
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (!traceFile.empty())
+    {
+        nameTraceThread("main");
+        startTracing();
+    }
+    int status = run(argc, argv, cacheFile, depots);
+    if (!traceFile.empty() && !stopTracing(traceFile))
+    {
+        cerr << "Unable to write trace file " << traceFile << endl;
+        return 1;
+    }
+    return status;
+}
+
+int run(int argc, char *argv[], string cacheFile, const vector<string>& depots)
+{
+    if (argc >= 3 && argc <= 4 && string(argv[1]) == "--serve")
+        return serve(argv[2], argc == 4 ? argv[3] : "", cacheFile, depots);
+
+    if (argc == 4 && string(argv[1]) == "--tile")
+        return tile(argv[2], argv[3]);
+
+    if (argc == 4 && string(argv[1]) == "--labels")
+        return label(argv[2], argv[3]);
+
     if (argc != 3)
     {
-        cout << "Usage: " << argv[0] << " mapdata.txt deliveries.txt" << endl;
+        cout << "Usage: " << argv[0] << " [--cache routes.cache] [--trace trace.json] mapdata.txt deliveries.txt" << endl;
+        cout << "       " << argv[0] << " [--cache routes.cache] [--trace trace.json] [--depot lat,lon]... --serve mapdata.txt [socket]" << endl;
+        cout << "       " << argv[0] << " --tile mapdata.txt mapdata.tiles" << endl;
+        cout << "       " << argv[0] << " --labels mapdata.txt mapdata.labels" << endl;
         return 1;
     }
 
@@ -24,6 +75,8 @@ int main(int argc, char *argv[])
         cout << "Unable to load map data file " << argv[1] << endl;
         return 1;
     }
+    if (!cacheFile.empty())
+        sm.openRouteCache(cacheFile);
 
     GeoCoord depot;
     vector<DeliveryRequest> deliveries;
@@ -35,10 +88,18 @@ int main(int argc, char *argv[])
 
     cout << "Generating route...\n\n";
 
+    // each leg is printed as soon as it is routed, so the robot can set off while the rest are still being routed
     DeliveryPlanner dp(&sm);
-    vector<DeliveryCommand> dcs;
     double totalMiles;
-    DeliveryResult result = dp.generateDeliveryPlan(depot, deliveries, dcs, totalMiles);
+    bool started = false;
+    DeliveryResult result = dp.streamDeliveryPlan(depot, deliveries, [&started](const vector<DeliveryCommand>& leg)
+    {
+        if (!started)
+            cout << "Starting at the depot...\n";
+        started = true;
+        for (const auto& dc : leg)
+            cout << dc.description() << endl;
+    }, totalMiles);
     if (result == BAD_COORD)
     {
         cout << "One or more depot or delivery coordinates are invalid." << endl;
@@ -49,13 +110,13 @@ int main(int argc, char *argv[])
         cout << "No route can be found to deliver all items." << endl;
         return 1;
     }
-    cout << "Starting at the depot...\n";
-    for (const auto& dc : dcs)
-        cout << dc.description() << endl;
+    if (!started)
+        cout << "Starting at the depot...\n";
     cout << "You are back at the depot and your deliveries are done!\n";
     cout.setf(ios::fixed);
     cout.precision(2);
     cout << totalMiles << " miles travelled for all deliveries." << endl;
+    return 0;
 }
 
 bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v)
@@ -100,3 +161,97 @@ bool parseDelivery(string line, string& lat, string& lon, string& item)
     }
     return true;
 }
+
+bool parseDepot(string text, GeoCoord& depot)
+{
+    const size_t comma = text.find(',');
+    if (comma == string::npos)
+        return false;
+    
+    // stod throws on text which isn't a number
+    try
+    {
+        depot = GeoCoord(text.substr(0, comma), text.substr(comma + 1));
+    }
+    catch (const exception&)
+    {
+        return false;
+    }
+    return true;
+}
+
+int serve(string mapFile, string socketPath, string cacheFile, const vector<string>& depots)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile))
+    {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    if (!cacheFile.empty())
+        sm.openRouteCache(cacheFile);
+
+    int workers = thread::hardware_concurrency();
+    PlanningServer server(&sm, workers > 0 ? workers : 4, 1024);
+
+    // the legs to and from the depots we serve are read off trees searched once, here, rather than routed
+    for (const auto& d : depots)
+    {
+        GeoCoord depot;
+        if (!parseDepot(d, depot))
+        {
+            cerr << "Bad depot coordinate " << d << ", expected lat,lon" << endl;
+            return 1;
+        }
+        if (!server.addDepot(depot))
+        {
+            cerr << "Depot " << d << " is not on the map" << endl;
+            return 1;
+        }
+    }
+
+    // without a socket path we answer requests from standard input on standard output
+    if (socketPath.empty())
+        return server.serveStream(cin, cout) ? 0 : 1;
+
+    cerr << "Serving on " << socketPath << endl;
+    if (!server.serveUnixSocket(socketPath))
+    {
+        cerr << "Unable to listen on " << socketPath << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int tile(string mapFile, string tileFile)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile))
+    {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    if (!sm.saveTiles(tileFile))
+    {
+        cerr << "Unable to write tiled map file " << tileFile << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int label(string mapFile, string labelFile)
+{
+    StreetMap sm;
+    if (!sm.load(mapFile))
+    {
+        cerr << "Unable to load map data file " << mapFile << endl;
+        return 1;
+    }
+    DistanceOracle oracle(&sm);
+    if (!oracle.buildLabels() || !oracle.saveLabels(labelFile))
+    {
+        cerr << "Unable to write label file " << labelFile << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -6,6 +6,9 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <memory>
+#include <atomic>
+#include <functional>
 
 enum DeliveryResult
 {
@@ -70,7 +73,12 @@ bool operator==(const StreetSegment& lhs, const StreetSegment& rhs)
 }
 
 class StreetMapImpl;
+class MapSnapshot;
 
+  // A StreetMap may be read by any number of threads at once, while other threads change it.
+  // Every query works on an immutable MapSnapshot, which is never modified once published and
+  // is safe for unsynchronized concurrent reads; changes publish a new snapshot instead.
+  // load() publishes a freshly read map the same way, so readers see the old map or the new one.
 class StreetMap
 {
 public:
@@ -78,6 +86,25 @@ public:
     ~StreetMap();
     bool load(std::string mapFile);
     bool getSegmentsThatStartWith(const GeoCoord& gc, std::vector<StreetSegment>& segs) const;
+      // Close or reopen the directed segment from start to end; a two-way closure takes two calls.
+    bool setSegmentClosed(const GeoCoord& start, const GeoCoord& end, bool closed);
+      // Make routing along the directed segment cost weight instead of its length; a negative weight undoes this.
+    bool setSegmentWeight(const GeoCoord& start, const GeoCoord& end, double weight);
+      // The current state of the map, which stays unchanged for as long as it is held.
+    std::shared_ptr<const MapSnapshot> snapshot() const;
+    unsigned int version() const;
+      // Write the loaded map as a tiled map file. load() opens one without reading it, and only
+      // reads each tile of it once a search reaches that part of the map.
+    bool saveTiles(std::string tileFile) const;
+      // For tiled maps: the most memory tiles may take up (the least recently used are dropped
+      // beyond it), and a hint that the given area will be searched soon.
+    void setMemoryBudget(size_t bytes);
+    void prefetch(double minLat, double minLon, double maxLat, double maxLon) const;
+      // Remember the routes found on the map as loaded in cacheFile, which is kept under maxBytes, so that
+      // later runs on the same map answer them without searching. Routes are saved by saveRouteCache()
+      // and when the StreetMap is destroyed.
+    void openRouteCache(std::string cacheFile, size_t maxBytes = 64 << 20);
+    bool saveRouteCache();
       // We prevent a StreetMap object from being copied or assigned.
     StreetMap(const StreetMap&) = delete;
     StreetMap& operator=(const StreetMap&) = delete;
@@ -85,18 +112,76 @@ private:
     StreetMapImpl* m_impl;
 };
 
+  // A route as the numbers of the street segments it follows, on the snapshot of the map it was found on
+  // (which it keeps alive): one small array, rather than a list node and five strings per segment.
+  // Segments are only made when asked for; the other accessors don't make any.
+class StreetPath
+{
+public:
+    StreetPath();
+    StreetPath(std::shared_ptr<const MapSnapshot> snapshot, std::vector<int> edges);
+    size_t size() const
+    {
+        return m_edges.size();
+    }
+    bool empty() const
+    {
+        return m_edges.empty();
+    }
+    void clear();
+    StreetSegment segment(size_t i) const;
+    void toList(std::list<StreetSegment>& route) const;
+    std::string streetName(size_t i) const;
+      // Whether segments i and j are on the same street, by name.
+    bool sameStreet(size_t i, size_t j) const;
+      // The length of segment i in miles, its angle as angleOfLine gives it, and the angle of the turn
+      // from segment i - 1 onto it, as angleBetween2Lines gives it.
+    double length(size_t i) const;
+    double angle(size_t i) const;
+    double turnAngle(size_t i) const;
+      // The numbers of the segments, on the map of snapshot.
+    const std::vector<int>& edges() const
+    {
+        return m_edges;
+    }
+    const std::shared_ptr<const MapSnapshot>& snapshot() const
+    {
+        return m_snapshot;
+    }
+private:
+    std::shared_ptr<const MapSnapshot> m_snapshot;
+    std::vector<int> m_edges;
+};
+
 class PointToPointRouterImpl;
 
 class PointToPointRouter
 {
 public:
     PointToPointRouter(const StreetMap* sm);
+      // A router which always routes on the given snapshot, ignoring later changes to the map.
+    PointToPointRouter(std::shared_ptr<const MapSnapshot> snapshot);
     ~PointToPointRouter();
+      // Safe to call from many threads at once, on one router or on one router per thread.
     DeliveryResult generatePointToPointRoute(
         const GeoCoord& start,
         const GeoCoord& end,
         std::list<StreetSegment>& route,
         double& totalDistanceTravelled) const;
+      // Gives up, returning NO_ROUTE, as soon as *cancelled becomes true.
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        std::list<StreetSegment>& route,
+        double& totalDistanceTravelled,
+        const std::atomic<bool>* cancelled) const;
+      // The same route as a StreetPath, which costs one allocation however long the route is.
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        StreetPath& path,
+        double& totalDistanceTravelled,
+        const std::atomic<bool>* cancelled = nullptr) const;
       // We prevent a PointToPointRouter object from being copied or assigned.
     PointToPointRouter(const PointToPointRouter&) = delete;
     PointToPointRouter& operator=(const PointToPointRouter&) = delete;
@@ -104,6 +189,103 @@ private:
     PointToPointRouterImpl* m_impl;
 };
 
+class ServiceAreaFinderImpl;
+
+class ServiceAreaFinder
+{
+public:
+    ServiceAreaFinder(const StreetMap* sm);
+    ~ServiceAreaFinder();
+      // Every coordinate on the map which can be reached from the depot within maxMiles of road, with its
+      // distance from the depot. The area of each depot is remembered until the map changes, so asking
+      // again, or for a smaller distance, doesn't search again. Safe to call from many threads at once.
+    DeliveryResult findServiceArea(
+        const GeoCoord& depot,
+        double maxMiles,
+        std::vector<std::pair<GeoCoord, double> >& area) const;
+      // The road distance from the depot to location, if it is at most maxMiles; NO_ROUTE otherwise.
+      // Once the depot's area is remembered, this is a single lookup.
+    DeliveryResult findDistanceFromDepot(
+        const GeoCoord& depot,
+        double maxMiles,
+        const GeoCoord& location,
+        double& miles) const;
+      // The convex hull of the service area, counterclockwise, for drawing it on a map.
+    DeliveryResult findServiceAreaBoundary(
+        const GeoCoord& depot,
+        double maxMiles,
+        std::vector<GeoCoord>& boundary) const;
+      // We prevent a ServiceAreaFinder object from being copied or assigned.
+    ServiceAreaFinder(const ServiceAreaFinder&) = delete;
+    ServiceAreaFinder& operator=(const ServiceAreaFinder&) = delete;
+private:
+    ServiceAreaFinderImpl* m_impl;
+};
+
+class DistanceOracleImpl;
+
+class DistanceOracle
+{
+public:
+    DistanceOracle(const StreetMap* sm);
+    ~DistanceOracle();
+      // Label every node of the map with hubs, so that road distances can be looked up instead of searched
+      // for. Building takes a while on a large map, so the labels can be saved and later loaded (mapped,
+      // rather than read) again. Labels only fit the map they were built from.
+    bool buildLabels();
+    bool loadLabels(std::string labelFile);
+    bool saveLabels(std::string labelFile) const;
+      // The road distance from start to end, counting a reweighted segment at its weight. With labels for
+      // the current map, and no street closed or reweighted, this takes well under a microsecond; otherwise
+      // the distance is searched for.
+      // Safe to call from many threads at once.
+    DeliveryResult findDistance(const GeoCoord& start, const GeoCoord& end, double& miles) const;
+      // A distance matrix: miles[i][j] is the road distance from starts[i] to ends[j], or infinity if
+      // there is no route. Returns BAD_COORD if any coordinate isn't on the map.
+    DeliveryResult findDistances(
+        const std::vector<GeoCoord>& starts,
+        const std::vector<GeoCoord>& ends,
+        std::vector<std::vector<double> >& miles) const;
+      // We prevent a DistanceOracle object from being copied or assigned.
+    DistanceOracle(const DistanceOracle&) = delete;
+    DistanceOracle& operator=(const DistanceOracle&) = delete;
+private:
+    DistanceOracleImpl* m_impl;
+};
+
+class OverlayRouterImpl;
+
+  // Routes like PointToPointRouter, but on an overlay: the map is split into cells, and a route is only
+  // searched for inside the cells it starts and ends in, crossing every other cell in a single step.
+  // The cells are cut once, while closures and weights only need the overlay customized again.
+class OverlayRouter
+{
+public:
+    OverlayRouter(const StreetMap* sm);
+    ~OverlayRouter();
+      // Split the map into cells of at most maxCellSize nodes, and customize the overlay for it.
+    bool buildOverlay(int maxCellSize = 1024);
+      // Bring the overlay up to date with the segments closed or reweighted since it was last customized,
+      // redoing only the cells they are in. Until then, routes are found by a PointToPointRouter.
+    bool customize();
+    int cellCount() const;
+      // A cell file holds one cell, with the costs of crossing it, so that the cells of a map can be
+      // customized on different machines; loadCell only takes a cell of the same map, cut the same way.
+    bool saveCell(int cell, std::string cellFile) const;
+    bool loadCell(std::string cellFile);
+      // Safe to call from many threads at once.
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        std::list<StreetSegment>& route,
+        double& totalDistanceTravelled) const;
+      // We prevent an OverlayRouter object from being copied or assigned.
+    OverlayRouter(const OverlayRouter&) = delete;
+    OverlayRouter& operator=(const OverlayRouter&) = delete;
+private:
+    OverlayRouterImpl* m_impl;
+};
+
 struct DeliveryRequest
 {
     DeliveryRequest(std::string it, const GeoCoord& loc)
@@ -132,6 +314,34 @@ private:
     DeliveryOptimizerImpl* m_impl;
 };
 
+class IncrementalOptimizerImpl;
+
+  // Keeps a delivery order optimized while orders are added and cancelled, changing only the part of the
+  // tour near each change instead of optimizing all of it again. Like DeliveryOptimizer, it goes by
+  // crow distances. Not safe to change from several threads at once.
+class IncrementalOptimizer
+{
+public:
+    IncrementalOptimizer(const StreetMap* sm);
+    ~IncrementalOptimizer();
+      // Start from the deliveries in the order given, usually one that was already optimized.
+    void setTour(const GeoCoord& depot, const std::vector<DeliveryRequest>& deliveries);
+      // Optimize the whole tour, whatever its size.
+    void optimize();
+      // Put a new delivery where it lengthens the tour least, then improve the tour around it.
+    void addDelivery(const DeliveryRequest& delivery);
+      // Take out a delivery with the same item and location, then improve the tour where it was.
+      // Returns false if the tour has no such delivery.
+    bool cancelDelivery(const DeliveryRequest& delivery);
+    void getDeliveries(std::vector<DeliveryRequest>& deliveries) const;
+    double crowDistance() const;
+      // We prevent an IncrementalOptimizer object from being copied or assigned.
+    IncrementalOptimizer(const IncrementalOptimizer&) = delete;
+    IncrementalOptimizer& operator=(const IncrementalOptimizer&) = delete;
+private:
+    IncrementalOptimizerImpl* m_impl;
+};
+
 class DeliveryCommand
 {
 public:
@@ -206,18 +416,94 @@ private:
     double       m_distance;    // 1.92 (in miles)
 };
 
+  // A plan which keeps what re-planning it needs: the route of every leg, and the map it was planned on.
+  // legs[i] leads from start (at first the depot) or deliveries[i - 1] to deliveries[i]; the last leads
+  // back to the depot.
+struct DeliveryTour
+{
+    GeoCoord depot;
+    GeoCoord start;
+    std::vector<DeliveryRequest> deliveries;
+    std::vector<StreetPath> legs;
+    std::vector<double> legDistances;
+    std::vector<DeliveryCommand> commands;
+    double totalDistanceTravelled = 0;
+    std::shared_ptr<const MapSnapshot> snapshot;
+};
+
+class DepotTreesImpl;
+
+  // Keeps, for each depot added, the shortest paths from the depot to every node and from every node back
+  // to it, so that a leg leaving or returning to the depot is read off them instead of searched for.
+  // Once the map changes, the trees are brought up to date the next time they are used.
+class DepotTrees
+{
+public:
+    DepotTrees(const StreetMap* sm);
+    ~DepotTrees();
+      // Finds the trees of depot, which takes two searches of the whole map; false if it isn't on the map.
+    bool addDepot(const GeoCoord& depot);
+    bool hasDepot(const GeoCoord& depot) const;
+      // The shortest route from depot to end, or from start back to depot, which must have been added
+      // (BAD_COORD otherwise). It is found on snapshot, or on the map as it is now if snapshot is null.
+      // Safe to call from many threads at once.
+    DeliveryResult routeFromDepot(
+        const GeoCoord& depot,
+        const GeoCoord& end,
+        StreetPath& path,
+        double& totalDistanceTravelled,
+        std::shared_ptr<const MapSnapshot> snapshot = nullptr) const;
+    DeliveryResult routeToDepot(
+        const GeoCoord& start,
+        const GeoCoord& depot,
+        StreetPath& path,
+        double& totalDistanceTravelled,
+        std::shared_ptr<const MapSnapshot> snapshot = nullptr) const;
+      // We prevent a DepotTrees object from being copied or assigned.
+    DepotTrees(const DepotTrees&) = delete;
+    DepotTrees& operator=(const DepotTrees&) = delete;
+private:
+    DepotTreesImpl* m_impl;
+};
+
 class DeliveryPlannerImpl;
 
 class DeliveryPlanner
 {
 public:
     DeliveryPlanner(const StreetMap* sm);
+      // A planner which reads the legs leaving and returning to the depots of trees off their trees.
+    DeliveryPlanner(const StreetMap* sm, const DepotTrees* trees);
     ~DeliveryPlanner();
     DeliveryResult generateDeliveryPlan(
         const GeoCoord& depot,
         const std::vector<DeliveryRequest>& deliveries,
         std::vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+      // The same plan, handed to onLeg one leg at a time, in order, as soon as each leg is routed: the
+      // proceed and turn commands of the leg, then the delivery it ends with (the last leg, back to the
+      // depot, has none). The robot can set off while later legs are still being routed. If a later leg
+      // fails, the legs before it have already been passed on, and the result says why; a bad coordinate,
+      // or a stop the depot can't reach, is found before any leg is. onLeg runs on the calling thread and
+      // must not throw.
+    DeliveryResult streamDeliveryPlan(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        const std::function<void(const std::vector<DeliveryCommand>&)>& onLeg,
+        double& totalDistanceTravelled) const;
+      // The same plan, kept as a tour so that it can be re-planned while it is under way.
+    DeliveryResult generateDeliveryTour(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        DeliveryTour& tour) const;
+      // Plans the rest of previous from position, where the robot is now, once the deliveries in completed
+      // have been made. The remaining deliveries keep their order, and legs of previous which still join
+      // the same stops keep their routes unless the map has changed under them.
+    DeliveryResult replanDeliveryTour(
+        const DeliveryTour& previous,
+        const GeoCoord& position,
+        const std::vector<DeliveryRequest>& completed,
+        DeliveryTour& tour) const;
       // We prevent a DeliveryPlanner object from being copied or assigned.
     DeliveryPlanner(const DeliveryPlanner&) = delete;
     DeliveryPlanner& operator=(const DeliveryPlanner&) = delete;
@@ -225,6 +511,69 @@ private:
     DeliveryPlannerImpl* m_impl;
 };
 
+  // The deliveries of one depot, as assigned by a DepotAssigner, and the plan for delivering them.
+struct DepotPlan
+{
+    GeoCoord depot;
+    std::vector<DeliveryRequest> deliveries;
+    std::vector<DeliveryCommand> commands;
+    double totalDistanceTravelled = 0;
+    DeliveryResult result = DELIVERY_SUCCESS;
+};
+
+class DepotAssignerImpl;
+
+class DepotAssigner
+{
+public:
+    DepotAssigner(const StreetMap* sm);
+    ~DepotAssigner();
+      // Assigns every delivery to the depot nearest to it by road, with a single search from all the
+      // depots at once. assignment[i] is the index of the depot of deliveries[i], or -1 if the delivery
+      // isn't on the map or no depot can reach it. Returns BAD_COORD if a depot isn't on the map.
+    DeliveryResult assignDeliveries(
+        const std::vector<GeoCoord>& depots,
+        const std::vector<DeliveryRequest>& deliveries,
+        std::vector<int>& assignment) const;
+      // Assigns the deliveries, then optimizes (if asked to) and plans the deliveries of every depot.
+      // plans[i] belongs to depots[i] and carries the result of its own plan; deliveries no depot can
+      // reach are returned in unassigned.
+    DeliveryResult planDeliveries(
+        const std::vector<GeoCoord>& depots,
+        const std::vector<DeliveryRequest>& deliveries,
+        bool optimize,
+        std::vector<DepotPlan>& plans,
+        std::vector<DeliveryRequest>& unassigned) const;
+      // We prevent a DepotAssigner object from being copied or assigned.
+    DepotAssigner(const DepotAssigner&) = delete;
+    DepotAssigner& operator=(const DepotAssigner&) = delete;
+private:
+    DepotAssignerImpl* m_impl;
+};
+
+class PlanningServerImpl;
+
+class PlanningServer
+{
+public:
+    PlanningServer(StreetMap* sm, int numWorkers, int queueCapacity);
+    ~PlanningServer();
+      // Keeps the shortest path trees of depot, so that plans from it route two legs fewer. Returns false
+      // if the depot isn't on the map.
+    bool addDepot(const GeoCoord& depot);
+      // Serve newline-delimited JSON requests read from in until end of input.
+    bool serveStream(std::istream& in, std::ostream& out);
+      // Serve newline-delimited JSON requests on a Unix domain socket until stopped.
+    bool serveUnixSocket(std::string socketPath);
+      // Stop accepting requests; requests already queued are still answered.
+    void stop();
+      // We prevent a PlanningServer object from being copied or assigned.
+    PlanningServer(const PlanningServer&) = delete;
+    PlanningServer& operator=(const PlanningServer&) = delete;
+private:
+    PlanningServerImpl* m_impl;
+};
+
 // Tools for computing distance between GeoCoords, angle of a StreetSegment,
 // and angle between two StreetSegments 
 